@@ -5,7 +5,11 @@
  
  #define __CACHE_STUDENT_H__844
 
+ #include <stdint.h>
  #include "steque.h"
+ #include "gfrange.h"
+ #include "gfencoding.h"
+ #include "fd_channel.h"
 
 
 #define CACHE_COMMAND_QUEUE "/cache_command_q"
@@ -16,6 +20,14 @@ typedef struct {
     char path[MAX_CACHE_REQUEST_LEN];
     char shm_name[MAX_SHM_NAME];
     size_t segsize;
+    uint64_t sent_ns; // CLOCK_MONOTONIC time the proxy sent the request
+    uint64_t deadline_ns; // CLOCK_MONOTONIC time the proxy stops waiting; 0 for never
+    gf_range_t range; // optional byte range, resolved by the cache against the file size
+    uint64_t object_id; // if non-zero, serve only this file version (stripes of one response)
+    int accept;         // GF_ACCEPT_*: whether a gzip variant may be sent instead
+    int transport;      // backend carrying the reply (see transport.h)
+    char reply_to[FD_REPLY_NAME_LEN]; // proxy socket the socket backends answer on
+    uint64_t ticket;    // echoed in the fd_reply_t
 } cache_req_t;
 
  #endif // __CACHE_STUDENT_H__844
\ No newline at end of file
@@ -0,0 +1,141 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include "shard_ring.h"
+#include "cache_index.h"
+
+/* Whether [off, off + len) lies inside a file of total bytes */
+static int in_file(uint64_t off, uint64_t len, uint64_t total) {
+    return off <= total && len <= total - off;
+}
+
+int cache_index_open(const char *filename, cache_index_t *index) {
+    const cache_index_header_t *h;
+    struct stat st;
+    char magic[8];
+    void *map;
+    int fd;
+
+    memset(index, 0, sizeof(*index));
+    if ((fd = open(filename, O_RDONLY)) < 0) {
+        return 0;  // left for the text path to report
+    }
+    if (fstat(fd, &st) < 0 || read(fd, magic, sizeof(magic)) != sizeof(magic) ||
+        memcmp(magic, CACHE_INDEX_MAGIC, sizeof(magic)) != 0) {
+        close(fd);
+        return 0;
+    }
+    if ((size_t)st.st_size < sizeof(cache_index_header_t)) {
+        fprintf(stderr, "%s: truncated index\n", filename);
+        close(fd);
+        return -1;
+    }
+    /* Shared and read-only: restarts and reloads find the pages already cached */
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror(filename);
+        return -1;
+    }
+
+    h = map;
+    uint64_t total = st.st_size;
+    if (h->total_len != total || h->nbuckets == 0 || (h->nbuckets & (h->nbuckets - 1)) != 0 ||
+        h->nbuckets <= 2 * (uint64_t)h->nitems || (h->nfiles == 0 && h->nitems > 0) ||
+        !in_file(h->buckets_off, h->nbuckets * sizeof(cache_index_bucket_t), total) ||
+        !in_file(h->items_off, (uint64_t)h->nitems * sizeof(cache_index_item_t), total) ||
+        !in_file(h->files_off, (uint64_t)h->nfiles * sizeof(cache_index_file_t), total) ||
+        !in_file(h->filter_off, h->filter_nbits / 8, total) || (h->filter_off & 7) != 0 ||
+        h->strings_off >= total || ((const char *)map)[total - 1] != '\0') {
+        fprintf(stderr, "%s: damaged index\n", filename);
+        munmap(map, total);
+        return -1;
+    }
+    index->header = h;
+    index->buckets = (const void *)((const char *)map + h->buckets_off);
+    index->items = (const void *)((const char *)map + h->items_off);
+    index->files = (const void *)((const char *)map + h->files_off);
+    index->filter = (const void *)((const char *)map + h->filter_off);
+    index->strings = (const char *)map + h->strings_off;
+    index->strings_len = total - h->strings_off;
+    return 1;
+}
+
+void cache_index_close(cache_index_t *index) {
+    if (index->header != NULL) {
+        munmap((void *)index->header, index->header->total_len);
+        index->header = NULL;
+    }
+}
+
+/* Offsets are checked on use rather than at open, which would touch every page */
+static const char *string_at(const cache_index_t *index, uint64_t off) {
+    return off < index->strings_len ? index->strings + off : "";
+}
+
+const char *cache_index_key(const cache_index_t *index, long item) {
+    return string_at(index, index->items[item].key_off);
+}
+
+const char *cache_index_path(const cache_index_t *index, uint32_t file) {
+    return string_at(index, index->files[file].path_off);
+}
+
+long cache_index_find(const cache_index_t *index, const char *key) {
+    uint64_t h = shard_hash(key);
+    uint64_t mask = index->header->nbuckets - 1;
+    uint32_t nitems = index->header->nitems;
+
+    /* At most half full, so the probe always reaches an empty bucket */
+    for (uint64_t i = h & mask; ; i = (i + 1) & mask) {
+        const cache_index_bucket_t *b = &index->buckets[i];
+        if (b->item == 0 || b->item > nitems) {
+            return -1;
+        }
+        if (b->tag == (uint32_t)(h >> 32) && strcmp(key, cache_index_key(index, b->item - 1)) == 0) {
+            return b->item - 1;
+        }
+    }
+}
+
+int cache_index_hash_fd(int fd, size_t *size, uint32_t *hash) {
+    unsigned char buf[65536];
+    struct stat st;
+    size_t done = 0;
+    uLong crc = crc32(0L, Z_NULL, 0);
+
+    if (fstat(fd, &st) < 0) {
+        return -1;
+    }
+    while (done < (size_t)st.st_size) {
+        ssize_t n = pread(fd, buf, sizeof(buf), done);
+        if (n <= 0) {
+            return -1;
+        }
+        crc = crc32(crc, buf, n);
+        done += n;
+    }
+    *size = st.st_size;
+    *hash = crc;
+    return 0;
+}
+
+int cache_index_same_content(int a, int b, size_t size) {
+    char abuf[16384], bbuf[16384];
+    size_t done = 0;
+    while (done < size) {
+        size_t want = size - done < sizeof(abuf) ? size - done : sizeof(abuf);
+        if (pread(a, abuf, want, done) != (ssize_t)want ||
+            pread(b, bbuf, want, done) != (ssize_t)want ||
+            memcmp(abuf, bbuf, want) != 0) {
+            return 0;
+        }
+        done += want;
+    }
+    return 1;
+}
@@ -0,0 +1,91 @@
+/*
+ Precompiled index of a locals file. mkindex builds it offline (hashing
+ every file once) and simplecached maps it read-only, so startup costs
+ one mmap however many entries there are, and the pages stay in the page
+ cache across restarts of the daemon.
+
+ The file is, in native byte order and with every section 8-byte aligned:
+
+   cache_index_header_t
+   buckets   nbuckets cache_index_bucket_t, open addressing on shard_hash(key)
+   items     nitems cache_index_item_t, sorted by key
+   files     nfiles cache_index_file_t, one per distinct content
+   filter    filter_nbits / 8 bytes of the keys' miss filter (miss_filter.h)
+   strings   keys and paths, each NUL-terminated
+
+ Keys with identical bytes share one file record, as they share one
+ descriptor in a text index. Sizes and hashes are those at build time:
+ rebuild the index (and SIGHUP the daemon) after changing the files.
+ */
+#ifndef __CACHE_INDEX_H__
+#define __CACHE_INDEX_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CACHE_INDEX_MAGIC "GFINDEX1"
+
+typedef struct {
+    char magic[8];
+    uint32_t nitems;
+    uint32_t nfiles;
+    uint64_t nbuckets;      // a power of two, more than twice nitems
+    uint64_t buckets_off;
+    uint64_t items_off;
+    uint64_t files_off;
+    uint64_t filter_off;
+    uint64_t filter_nbits;
+    uint32_t filter_nhashes;
+    uint32_t unused;
+    uint64_t strings_off;
+    uint64_t total_len;
+} cache_index_header_t;
+
+typedef struct {
+    uint32_t tag;           // upper half of shard_hash(key)
+    uint32_t item;          // item number + 1, 0 for an empty bucket
+} cache_index_bucket_t;
+
+typedef struct {
+    uint64_t key_off;       // into strings
+    uint32_t file;
+    uint32_t unused;
+} cache_index_item_t;
+
+typedef struct {
+    uint64_t path_off;      // into strings
+    uint64_t size;
+    uint32_t hash;          // crc32 of the content
+    uint32_t unused;
+} cache_index_file_t;
+
+/* A mapped index */
+typedef struct {
+    const cache_index_header_t *header;
+    const cache_index_bucket_t *buckets;
+    const cache_index_item_t *items;
+    const cache_index_file_t *files;
+    const uint64_t *filter;
+    const char *strings;
+    size_t strings_len;
+} cache_index_t;
+
+/*
+ * Maps filename if it is an index. Returns 1 when mapped, -1 for a
+ * damaged index and 0 for anything else, such as a text locals file or
+ * one that cannot be opened.
+ */
+int cache_index_open(const char *filename, cache_index_t *index);
+void cache_index_close(cache_index_t *index);
+
+/* Item number of key, or -1 */
+long cache_index_find(const cache_index_t *index, const char *key);
+const char *cache_index_key(const cache_index_t *index, long item);
+const char *cache_index_path(const cache_index_t *index, uint32_t file);
+
+/* Size and crc32 of the whole content of fd; -1 on a read error */
+int cache_index_hash_fd(int fd, size_t *size, uint32_t *hash);
+/* Whether the first size bytes of a and b are identical */
+int cache_index_same_content(int a, int b, size_t size);
+
+#endif // __CACHE_INDEX_H__
@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include "cache_log.h"
+
+#define CLOG_RING_SLOTS 128 // power of two
+#define CLOG_MSG_LEN 240
+#define CLOG_BATCH_LEN 16384
+#define CLOG_IDLE_US 2000
+
+typedef struct {
+    int len;
+    char msg[CLOG_MSG_LEN];
+} clog_slot_t;
+
+/* Single-producer (owning worker) / single-consumer (drain thread) ring */
+typedef struct clog_ring {
+    unsigned int head __attribute__((aligned(64)));  // written by producer
+    unsigned int tail __attribute__((aligned(64)));  // written by consumer
+    unsigned long dropped;
+    struct clog_ring *next;
+    clog_slot_t slots[CLOG_RING_SLOTS];
+} clog_ring_t;
+
+static clog_ring_t *rings = NULL;
+static pthread_mutex_t rings_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t drain_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int drain_running = 0;
+static __thread clog_ring_t *tls_ring = NULL;
+
+static clog_ring_t *clog_register(void) {
+    clog_ring_t *ring = calloc(1, sizeof(clog_ring_t));
+    if (ring == NULL) {
+        return NULL;
+    }
+    pthread_mutex_lock(&rings_mutex);
+    ring->next = rings;
+    __atomic_store_n(&rings, ring, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&rings_mutex);
+    tls_ring = ring;
+    return ring;
+}
+
+static void write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n <= 0) {
+            return;
+        }
+        buf += n;
+        len -= n;
+    }
+}
+
+/*
+ * Drains every ring into one buffer per pass. Returns the number of messages,
+ * or -1 if wait is 0 and another drain is already running.
+ */
+static int clog_drain(int wait) {
+    char batch[CLOG_BATCH_LEN];
+    size_t used = 0;
+    int drained = 0;
+
+    if (wait) {
+        pthread_mutex_lock(&drain_mutex);
+    } else if (pthread_mutex_trylock(&drain_mutex) != 0) {
+        return -1;
+    }
+    for (clog_ring_t *ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE);
+         ring != NULL; ring = ring->next) {
+        unsigned int tail = ring->tail;
+        unsigned int head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        while (tail != head) {
+            clog_slot_t *slot = &ring->slots[tail & (CLOG_RING_SLOTS - 1)];
+            if (used + slot->len > sizeof(batch)) {
+                write_all(STDOUT_FILENO, batch, used);
+                used = 0;
+            }
+            memcpy(batch + used, slot->msg, slot->len);
+            used += slot->len;
+            tail++;
+            drained++;
+        }
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+        unsigned long dropped = __atomic_exchange_n(&ring->dropped, 0, __ATOMIC_RELAXED);
+        if (dropped > 0) {
+            int n = snprintf(batch + used, sizeof(batch) - used,
+                             "[Log] dropped %lu messages\n", dropped);
+            if (n > 0 && (size_t)n < sizeof(batch) - used) {
+                used += n;
+            }
+        }
+    }
+    if (used > 0) {
+        write_all(STDOUT_FILENO, batch, used);
+    }
+    pthread_mutex_unlock(&drain_mutex);
+    return drained;
+}
+
+static void *clog_drain_thread(void *arg) {
+    while (1) {
+        if (clog_drain(1) == 0) {
+            usleep(CLOG_IDLE_US);
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Also runs from atexit, which simplecached reaches from its signal
+ * handler; never block there on a drain the interrupted code may hold.
+ */
+void cache_log_flush(void) {
+    clog_drain(0);
+}
+
+void cache_log_init(void) {
+    pthread_t tid;
+    sigset_t all, old;
+
+    /* The drain thread starts with every signal blocked so SIGINT/SIGTERM
+     * (and their exit path) always run on some other thread */
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    int rc = pthread_create(&tid, NULL, clog_drain_thread, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (rc != 0) {
+        perror("[Log] pthread_create");
+        return;
+    }
+    pthread_detach(tid);
+    atexit(cache_log_flush);
+    __atomic_store_n(&drain_running, 1, __ATOMIC_RELEASE);
+}
+
+void cache_log_write(int level, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+
+    if (level <= LOG_LEVEL_WARN || !__atomic_load_n(&drain_running, __ATOMIC_ACQUIRE)) {
+        vfprintf(level <= LOG_LEVEL_WARN ? stderr : stdout, fmt, ap);
+        va_end(ap);
+        return;
+    }
+
+    clog_ring_t *ring = tls_ring ? tls_ring : clog_register();
+    if (ring == NULL) {
+        va_end(ap);
+        return;
+    }
+
+    unsigned int head = ring->head;
+    unsigned int tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    if (head - tail >= CLOG_RING_SLOTS) {
+        __atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+        va_end(ap);
+        return;
+    }
+
+    clog_slot_t *slot = &ring->slots[head & (CLOG_RING_SLOTS - 1)];
+    int n = vsnprintf(slot->msg, sizeof(slot->msg), fmt, ap);
+    va_end(ap);
+    if (n < 0) {
+        return;
+    }
+    if (n >= (int)sizeof(slot->msg)) {
+        n = sizeof(slot->msg) - 1;
+        slot->msg[n - 1] = '\n';
+    }
+    slot->len = n;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
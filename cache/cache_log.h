@@ -0,0 +1,47 @@
+/*
+ Leveled logging for the cache hot path.
+
+ CLOG_DEBUG compiles out unless CACHE_LOG_LEVEL >= LOG_LEVEL_DEBUG; disabled
+ levels are still type-checked but generate no code.
+ CLOG_INFO formats into a per-thread lock-free ring that a background
+ thread drains to stdout, so workers never take the stdio lock or make a
+ write syscall per message. CLOG_WARN and CLOG_ERROR go straight to stderr.
+ */
+#ifndef __CACHE_LOG_H__
+#define __CACHE_LOG_H__
+
+#define LOG_LEVEL_ERROR 0
+#define LOG_LEVEL_WARN  1
+#define LOG_LEVEL_INFO  2
+#define LOG_LEVEL_DEBUG 3
+
+#ifndef CACHE_LOG_LEVEL
+#define CACHE_LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+void cache_log_init(void);
+void cache_log_flush(void);
+void cache_log_write(int level, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+#define CLOG_ERROR(...) cache_log_write(LOG_LEVEL_ERROR, __VA_ARGS__)
+
+#if CACHE_LOG_LEVEL >= LOG_LEVEL_WARN
+#define CLOG_WARN(...) cache_log_write(LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define CLOG_WARN(...) do { if (0) cache_log_write(LOG_LEVEL_WARN, __VA_ARGS__); } while (0)
+#endif
+
+#if CACHE_LOG_LEVEL >= LOG_LEVEL_INFO
+#define CLOG_INFO(...) cache_log_write(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define CLOG_INFO(...) do { if (0) cache_log_write(LOG_LEVEL_INFO, __VA_ARGS__); } while (0)
+#endif
+
+#if CACHE_LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define CLOG_DEBUG(...) cache_log_write(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define CLOG_DEBUG(...) do { if (0) cache_log_write(LOG_LEVEL_DEBUG, __VA_ARGS__); } while (0)
+#endif
+
+#endif // __CACHE_LOG_H__
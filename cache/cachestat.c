@@ -0,0 +1,99 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include "stats.h"
+
+#define USAGE                                                                 \
+"usage:\n"                                                                    \
+"  cachestat [options]\n"                                                     \
+"options:\n"                                                                  \
+"  -i [interval]       Redisplay every interval seconds (Default: print once)\n" \
+"  -z                  Reset all histograms to zero\n"                        \
+"  -u                  Remove the stats segment\n"                            \
+"  -h                  Show this help message\n"
+
+static struct option gLongOptions[] = {
+  {"interval",      required_argument,      NULL,           'i'},
+  {"zero",          no_argument,            NULL,           'z'},
+  {"unlink",        no_argument,            NULL,           'u'},
+  {"help",          no_argument,            NULL,           'h'},
+  {NULL,            0,                      NULL,            0}
+};
+
+static double to_us(uint64_t ns) {
+    return (double)ns / 1000.0;
+}
+
+static void print_stats(const stats_segment_t *seg) {
+    printf("%-14s %10s %10s %10s %10s %10s %10s %10s\n",
+           "stage(us)", "count", "mean", "p50", "p90", "p99", "p999", "max");
+    for (int s = 0; s < STAGE_COUNT; s++) {
+        const stats_hist_t *h = &seg->stages[s];
+        uint64_t count = __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+        uint64_t sum = __atomic_load_n(&h->sum_ns, __ATOMIC_RELAXED);
+        double mean = count ? to_us(sum / count) : 0.0;
+        printf("%-14s %10lu %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+               stats_stage_name(s), (unsigned long)count, mean,
+               to_us(stats_hist_percentile(h, 50.0)),
+               to_us(stats_hist_percentile(h, 90.0)),
+               to_us(stats_hist_percentile(h, 99.0)),
+               to_us(stats_hist_percentile(h, 99.9)),
+               to_us(__atomic_load_n(&h->max_ns, __ATOMIC_RELAXED)));
+    }
+}
+
+int main(int argc, char **argv) {
+    int option_char;
+    double interval = 0;
+    int zero = 0;
+
+    while ((option_char = getopt_long(argc, argv, "i:zuh", gLongOptions, NULL)) != -1) {
+        switch (option_char) {
+            default:
+                fprintf(stderr, "%s", USAGE);
+                exit(1);
+            case 'h':
+                fprintf(stdout, "%s", USAGE);
+                exit(0);
+            case 'i':
+                interval = atof(optarg);
+                break;
+            case 'z':
+                zero = 1;
+                break;
+            case 'u':
+                if (shm_unlink(STATS_SHM_NAME) < 0) {
+                    perror("shm_unlink");
+                    exit(1);
+                }
+                exit(0);
+        }
+    }
+
+    stats_segment_t *seg = stats_open(!zero);
+    if (seg == NULL) {
+        fprintf(stderr, "No stats segment %s (is webproxy or simplecached running?)\n",
+                STATS_SHM_NAME);
+        exit(1);
+    }
+    if (seg->magic != STATS_MAGIC || seg->version != STATS_VERSION) {
+        fprintf(stderr, "Stats segment has an unexpected layout\n");
+        exit(1);
+    }
+
+    if (zero) {
+        memset(seg->stages, 0, sizeof(seg->stages));
+        return 0;
+    }
+
+    print_stats(seg);
+    while (interval > 0) {
+        usleep((useconds_t)(interval * 1000000));
+        printf("\n");
+        print_stats(seg);
+    }
+    return 0;
+}
@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "counters.h"
+#include "stats.h"
+
+static const char *counter_names[CTR_COUNT] = {
+    "requests",
+    "ok",
+    "not_found",
+    "errors",
+    "shed",
+    "bytes",
+    "busy_ns",
+};
+
+static __thread counters_t *slot_owner;
+static __thread counter_slot_t *slot;
+
+static void counters_name(char *buf, size_t len, const char *name) {
+    snprintf(buf, len, "%s.counters", name);
+}
+
+counters_t *counters_create(const char *name) {
+    counters_t *c;
+    if (name == NULL) {
+        c = mmap(NULL, sizeof(*c), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    } else {
+        char shm_name[300];
+        counters_name(shm_name, sizeof(shm_name), name);
+        int fd = shm_open(shm_name, O_RDWR | O_CREAT, 0644);
+        if (fd < 0) {
+            perror("[Stats] shm_open counters");
+            return NULL;
+        }
+        /* A set left by an earlier run starts over from zero */
+        if (ftruncate(fd, 0) < 0 || ftruncate(fd, sizeof(*c)) < 0) {
+            perror("[Stats] ftruncate counters");
+            close(fd);
+            return NULL;
+        }
+        c = mmap(NULL, sizeof(*c), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+    }
+    if (c == MAP_FAILED) {
+        perror("[Stats] mmap counters");
+        return NULL;
+    }
+    c->started_ns = stats_now_ns();
+    __atomic_store_n(&c->magic, COUNTERS_MAGIC, __ATOMIC_RELEASE);
+    return c;
+}
+
+counters_t *counters_open(const char *name) {
+    char shm_name[300];
+    counters_name(shm_name, sizeof(shm_name), name);
+    int fd = shm_open(shm_name, O_RDONLY, 0);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    counters_t *c = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(*c)) {
+        c = mmap(NULL, sizeof(*c), PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (c == MAP_FAILED) {
+        return NULL;
+    }
+    if (__atomic_load_n(&c->magic, __ATOMIC_ACQUIRE) != COUNTERS_MAGIC) {
+        munmap(c, sizeof(*c));
+        return NULL;
+    }
+    return c;
+}
+
+void counters_close(counters_t *c) {
+    if (c != NULL) {
+        munmap(c, sizeof(*c));
+    }
+}
+
+void counters_remove(const char *name) {
+    char shm_name[300];
+    counters_name(shm_name, sizeof(shm_name), name);
+    shm_unlink(shm_name);
+}
+
+counter_slot_t *counters_slot(counters_t *c) {
+    if (slot_owner != c) {
+        uint32_t i = __atomic_fetch_add(&c->nslots, 1, __ATOMIC_RELAXED);
+        slot = &c->slots[i < COUNTERS_MAX_SLOTS ? i : COUNTERS_MAX_SLOTS - 1];
+        slot_owner = c;
+    }
+    return slot;
+}
+
+static uint32_t slots_used(const counters_t *c) {
+    uint32_t n = __atomic_load_n(&c->nslots, __ATOMIC_RELAXED);
+    return n < COUNTERS_MAX_SLOTS ? n : COUNTERS_MAX_SLOTS;
+}
+
+void counters_sum(const counters_t *c, uint64_t total[CTR_COUNT]) {
+    memset(total, 0, sizeof(uint64_t) * CTR_COUNT);
+    for (uint32_t i = 0; i < slots_used(c); i++) {
+        for (int k = 0; k < CTR_COUNT; k++) {
+            total[k] += __atomic_load_n(&c->slots[i].v[k], __ATOMIC_RELAXED);
+        }
+    }
+}
+
+void counters_printf(char *buf, size_t len, size_t *off, const char *fmt, ...) {
+    va_list ap;
+    if (*off >= len) {
+        return;
+    }
+    va_start(ap, fmt);
+    int n = vsnprintf(buf + *off, len - *off, fmt, ap);
+    va_end(ap);
+    if (n > 0) {
+        *off = *off + n < len ? *off + n : len;
+    }
+}
+
+void counters_format(const counters_t *c, const char *prefix, char *buf, size_t len, size_t *off) {
+    uint64_t total[CTR_COUNT];
+    counters_sum(c, total);
+    for (int k = 0; k < CTR_COUNT; k++) {
+        counters_printf(buf, len, off, "%s.%s %" PRIu64 "\n", prefix, counter_names[k], total[k]);
+    }
+    uint64_t answered = total[CTR_OK] + total[CTR_NOT_FOUND];
+    counters_printf(buf, len, off, "%s.hit_ratio %.4f\n", prefix,
+                    answered ? (double)total[CTR_OK] / answered : 0.0);
+    counters_printf(buf, len, off, "%s.uptime_ns %" PRIu64 "\n", prefix,
+                    stats_now_ns() - c->started_ns);
+    for (uint32_t i = 0; i < slots_used(c); i++) {
+        counters_printf(buf, len, off, "%s.thread.%u.requests %" PRIu64 "\n", prefix, i,
+                        __atomic_load_n(&c->slots[i].v[CTR_REQUESTS], __ATOMIC_RELAXED));
+        counters_printf(buf, len, off, "%s.thread.%u.busy_ns %" PRIu64 "\n", prefix, i,
+                        __atomic_load_n(&c->slots[i].v[CTR_BUSY_NS], __ATOMIC_RELAXED));
+    }
+}
@@ -0,0 +1,80 @@
+/*
+ Live request counters, answered on the reserved GETFILE path /__stats.
+
+ Every worker thread owns one cache-line-sized slot and is its only
+ writer, so counting is a plain relaxed store with no lock and no
+ shared line; a reader adds the slots up when asked. The proxy keeps
+ its counters in private memory. simplecached keeps its own in a shm
+ object next to its queue (<queue>.counters), so a proxy's /__stats
+ can report the caches behind it too.
+ */
+#ifndef __COUNTERS_H__
+#define __COUNTERS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define STATS_PATH "/__stats"
+
+#define COUNTERS_MAGIC 0x43545253u
+/* Threads past this share the last slot (and may lose the odd increment) */
+#define COUNTERS_MAX_SLOTS 256
+
+typedef enum {
+    CTR_REQUESTS,   // requests taken
+    CTR_OK,         // answered with a body
+    CTR_NOT_FOUND,  // answered FILE_NOT_FOUND
+    CTR_ERRORS,     // failed, or answered ERROR
+    CTR_SHED,       // refused for load or an expired deadline
+    CTR_BYTES,      // body bytes sent
+    CTR_BUSY_NS,    // time spent serving requests
+    CTR_COUNT
+} counter_t;
+
+typedef struct {
+    uint64_t v[CTR_COUNT];
+} __attribute__((aligned(64))) counter_slot_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t nslots;        // slots handed out so far
+    uint64_t started_ns;    // CLOCK_MONOTONIC at creation
+    counter_slot_t slots[COUNTERS_MAX_SLOTS];
+} counters_t;
+
+/*
+ * Creates a zeroed set: private when name is NULL, otherwise the shm
+ * object <name>.counters (taken over if it exists). NULL on failure.
+ */
+counters_t *counters_create(const char *name);
+/* Maps another process's <name>.counters read-only; NULL if it has none */
+counters_t *counters_open(const char *name);
+void counters_close(counters_t *c);
+void counters_remove(const char *name);
+
+/* The calling thread's slot, handed out on first use */
+counter_slot_t *counters_slot(counters_t *c);
+
+/* Single writer per slot: a load and a store, no read-modify-write */
+static inline void counter_add(counters_t *c, counter_t which, uint64_t n) {
+    if (c != NULL) {
+        counter_slot_t *slot = counters_slot(c);
+        __atomic_store_n(&slot->v[which], __atomic_load_n(&slot->v[which], __ATOMIC_RELAXED) + n,
+                         __ATOMIC_RELAXED);
+    }
+}
+
+/* Sums every slot into total */
+void counters_sum(const counters_t *c, uint64_t total[CTR_COUNT]);
+
+/*
+ * Appends "<prefix>.<counter> <value>" lines for the totals, the hit
+ * ratio and each thread's requests and busy time to buf at *off.
+ */
+void counters_format(const counters_t *c, const char *prefix, char *buf, size_t len, size_t *off);
+
+/* snprintf that appends at *off and never runs past len */
+void counters_printf(char *buf, size_t len, size_t *off, const char *fmt, ...)
+    __attribute__((format(printf, 4, 5)));
+
+#endif // __COUNTERS_H__
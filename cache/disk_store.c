@@ -0,0 +1,365 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "disk_store.h"
+
+#define STORE_MAGIC 0x4c4f4753u    // record header
+#define STORE_TRAILER 0x454e4453u  // record is complete
+#define STORE_BUCKETS 4096
+#define STORE_MAX_INFLIGHT 64
+
+typedef struct {
+    uint32_t magic;
+    uint32_t key_len;
+    uint64_t data_len;
+} record_header_t;
+
+struct store_log {
+    int id;
+    int fd;
+    size_t size;
+    int refs;          // pinned objects; the fd is closed when it drops to 0 after eviction
+    int dead;
+    store_log_t *next; // next newer log
+};
+
+typedef struct store_entry {
+    char *key;
+    store_log_t *log;
+    off_t offset;
+    size_t length;
+    struct store_entry *next;
+} store_entry_t;
+
+static char store_dir[PATH_MAX];
+static size_t store_budget;
+static size_t roll_size;
+static size_t total_bytes;
+static int enabled;
+static store_log_t *oldest, *newest;
+static store_entry_t *buckets[STORE_BUCKETS];
+/* One fetch per key; waiters read its outcome from here, 404s included */
+typedef struct {
+    char *key;     // NULL when the slot is free
+    int done;
+    int status;
+    int waiters;
+} inflight_t;
+
+static inflight_t inflight[STORE_MAX_INFLIGHT];
+static pthread_mutex_t store_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t store_cond = PTHREAD_COND_INITIALIZER;
+
+static unsigned bucket_of(const char *key) {
+    uint32_t h = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)key; *p; p++) {
+        h = (h ^ *p) * 16777619u;
+    }
+    return h % STORE_BUCKETS;
+}
+
+static store_entry_t *lookup_locked(const char *key) {
+    for (store_entry_t *e = buckets[bucket_of(key)]; e != NULL; e = e->next) {
+        if (strcmp(e->key, key) == 0) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+static void pin_locked(store_entry_t *e, store_ref_t *ref) {
+    e->log->refs++;
+    ref->fd = e->log->fd;
+    ref->offset = e->offset;
+    ref->length = e->length;
+    ref->log = e->log;
+}
+
+static void index_put_locked(const char *key, store_log_t *log, off_t offset, size_t length) {
+    store_entry_t *e = lookup_locked(key);
+    if (e == NULL) {
+        e = calloc(1, sizeof(*e));
+        e->key = strdup(key);
+        unsigned b = bucket_of(key);
+        e->next = buckets[b];
+        buckets[b] = e;
+    }
+    e->log = log;
+    e->offset = offset;
+    e->length = length;
+}
+
+static void log_path(char *buf, size_t len, int id) {
+    snprintf(buf, len, "%s/log.%06d", store_dir, id);
+}
+
+static store_log_t *log_append_locked(int id, int fd, size_t size) {
+    store_log_t *log = calloc(1, sizeof(*log));
+    log->id = id;
+    log->fd = fd;
+    log->size = size;
+    if (newest != NULL) {
+        newest->next = log;
+    } else {
+        oldest = log;
+    }
+    newest = log;
+    total_bytes += size;
+    return log;
+}
+
+static void log_put_locked(store_log_t *log) {
+    if (--log->refs == 0 && log->dead) {
+        close(log->fd);
+        free(log);
+    }
+}
+
+/* Drops the oldest logs until the store fits its budget, always keeping the newest */
+static void evict_locked(void) {
+    while (total_bytes > store_budget && oldest != NULL && oldest != newest) {
+        store_log_t *victim = oldest;
+        oldest = victim->next;
+        total_bytes -= victim->size;
+
+        for (int b = 0; b < STORE_BUCKETS; b++) {
+            store_entry_t **pp = &buckets[b];
+            while (*pp != NULL) {
+                store_entry_t *e = *pp;
+                if (e->log == victim) {
+                    *pp = e->next;
+                    free(e->key);
+                    free(e);
+                } else {
+                    pp = &e->next;
+                }
+            }
+        }
+
+        char path[PATH_MAX + 16];
+        log_path(path, sizeof(path), victim->id);
+        unlink(path);
+        victim->dead = 1;
+        victim->refs++;
+        log_put_locked(victim);  // closes now unless a transfer still has it pinned
+    }
+}
+
+/* Indexes every complete record in fd and returns the length of the valid prefix */
+static size_t scan_log(store_log_t *log) {
+    size_t pos = 0;
+    char key[PATH_MAX];
+    while (1) {
+        record_header_t hdr;
+        uint32_t trailer;
+        if (pread(log->fd, &hdr, sizeof(hdr), pos) != sizeof(hdr) ||
+            hdr.magic != STORE_MAGIC || hdr.key_len == 0 || hdr.key_len >= sizeof(key)) {
+            break;
+        }
+        off_t data_off = pos + sizeof(hdr) + hdr.key_len;
+        if (pread(log->fd, key, hdr.key_len, pos + sizeof(hdr)) != hdr.key_len ||
+            pread(log->fd, &trailer, sizeof(trailer), data_off + hdr.data_len) != sizeof(trailer) ||
+            trailer != STORE_TRAILER) {
+            break;
+        }
+        key[hdr.key_len] = '\0';
+        index_put_locked(key, log, data_off, hdr.data_len);
+        pos = data_off + hdr.data_len + sizeof(trailer);
+    }
+    return pos;
+}
+
+static int idcmp(const void *a, const void *b) {
+    return *(const int *)a - *(const int *)b;
+}
+
+int disk_store_open(const char *dir, size_t budget) {
+    snprintf(store_dir, sizeof(store_dir), "%s", dir);
+    store_budget = budget;
+    roll_size = budget / 8;
+    if (roll_size < (1 << 20)) roll_size = 1 << 20;
+    if (roll_size > (64 << 20)) roll_size = 64 << 20;
+
+    if (mkdir(dir, 0755) < 0 && access(dir, W_OK) < 0) {
+        perror("[Store] mkdir");
+        return -1;
+    }
+    DIR *d = opendir(dir);
+    if (d == NULL) {
+        perror("[Store] opendir");
+        return -1;
+    }
+    int ids[4096], nids = 0;
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL && nids < 4096) {
+        int id;
+        if (sscanf(de->d_name, "log.%d", &id) == 1) {
+            ids[nids++] = id;
+        }
+    }
+    closedir(d);
+    qsort(ids, nids, sizeof(int), idcmp);
+
+    pthread_mutex_lock(&store_mutex);
+    for (int i = 0; i < nids; i++) {
+        char path[PATH_MAX + 16];
+        log_path(path, sizeof(path), ids[i]);
+        int fd = open(path, O_RDWR);
+        if (fd < 0) {
+            continue;
+        }
+        store_log_t *log = log_append_locked(ids[i], fd, 0);
+        size_t valid = scan_log(log);
+        if (ftruncate(fd, valid) < 0) {   // drop a record cut short by a crash
+            perror("[Store] ftruncate");
+        }
+        log->size = valid;
+        total_bytes += valid;
+    }
+    evict_locked();
+    enabled = 1;
+    pthread_mutex_unlock(&store_mutex);
+    return 0;
+}
+
+int disk_store_enabled(void) {
+    return enabled;
+}
+
+int disk_store_get(const char *key, store_ref_t *ref) {
+    pthread_mutex_lock(&store_mutex);
+    store_entry_t *e = lookup_locked(key);
+    if (e != NULL) {
+        pin_locked(e, ref);
+    }
+    pthread_mutex_unlock(&store_mutex);
+    return e != NULL ? 0 : -1;
+}
+
+void disk_store_release(store_ref_t *ref) {
+    if (ref->log == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&store_mutex);
+    log_put_locked(ref->log);
+    pthread_mutex_unlock(&store_mutex);
+    ref->log = NULL;
+}
+
+/* Appends one record, rolling to a new log when the current one is full */
+static int put_locked(const char *key, const char *data, size_t len) {
+    if (newest == NULL || newest->size >= roll_size) {
+        int id = newest ? newest->id + 1 : 0;
+        char path[PATH_MAX + 16];
+        log_path(path, sizeof(path), id);
+        int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            perror("[Store] open log");
+            return -1;
+        }
+        log_append_locked(id, fd, 0);
+    }
+
+    store_log_t *log = newest;
+    record_header_t hdr = { STORE_MAGIC, strlen(key), len };
+    uint32_t trailer = STORE_TRAILER;
+    off_t pos = log->size;
+    off_t data_off = pos + sizeof(hdr) + hdr.key_len;
+    if (pwrite(log->fd, &hdr, sizeof(hdr), pos) != sizeof(hdr) ||
+        pwrite(log->fd, key, hdr.key_len, pos + sizeof(hdr)) != hdr.key_len ||
+        pwrite(log->fd, data, len, data_off) != (ssize_t)len ||
+        pwrite(log->fd, &trailer, sizeof(trailer), data_off + len) != sizeof(trailer)) {
+        perror("[Store] append");
+        return -1;
+    }
+
+    size_t record = sizeof(hdr) + hdr.key_len + len + sizeof(trailer);
+    log->size += record;
+    total_bytes += record;
+    index_put_locked(key, log, data_off, len);
+    evict_locked();
+    return 0;
+}
+
+static void inflight_free_locked(inflight_t *f) {
+    free(f->key);
+    f->key = NULL;
+}
+
+int disk_store_fetch(const char *key, store_fetch_fn fetch, void *arg, store_ref_t *ref) {
+    pthread_mutex_lock(&store_mutex);
+    while (1) {
+        store_entry_t *e = lookup_locked(key);
+        if (e != NULL) {
+            pin_locked(e, ref);
+            pthread_mutex_unlock(&store_mutex);
+            return 200;
+        }
+
+        inflight_t *f = NULL, *free_slot = NULL;
+        for (int i = 0; i < STORE_MAX_INFLIGHT; i++) {
+            if (inflight[i].key != NULL && strcmp(inflight[i].key, key) == 0) {
+                f = &inflight[i];
+                break;
+            } else if (inflight[i].key == NULL && free_slot == NULL) {
+                free_slot = &inflight[i];
+            }
+        }
+
+        if (f != NULL) {
+            /* Someone is already fetching this key: take its outcome instead of refetching */
+            f->waiters++;
+            while (!f->done) {
+                pthread_cond_wait(&store_cond, &store_mutex);
+            }
+            int status = f->status;
+            if (--f->waiters == 0) {
+                inflight_free_locked(f);
+            }
+            if (status != 200) {
+                pthread_mutex_unlock(&store_mutex);
+                return status;
+            }
+            continue;  // pin the record the fetcher wrote
+        }
+        if (free_slot == NULL) {
+            /* Every slot is busy; wait for one to finish */
+            pthread_cond_wait(&store_cond, &store_mutex);
+            continue;
+        }
+
+        f = free_slot;
+        f->key = strdup(key);
+        f->done = 0;
+        f->waiters = 0;
+        pthread_mutex_unlock(&store_mutex);
+
+        char *data = NULL;
+        size_t len = 0;
+        int status = fetch(key, &data, &len, arg);
+
+        pthread_mutex_lock(&store_mutex);
+        if (status == 200 && put_locked(key, data, len) < 0) {
+            status = 500;
+        }
+        free(data);
+        f->status = status;
+        f->done = 1;
+        if (f->waiters == 0) {
+            inflight_free_locked(f);
+        }
+        pthread_cond_broadcast(&store_cond);
+        if (status != 200) {
+            pthread_mutex_unlock(&store_mutex);
+            return status;
+        }
+        /* Loop around to pin the record just written */
+    }
+}
@@ -0,0 +1,49 @@
+/*
+ Log-structured on-disk store for objects simplecached admits on a miss.
+
+ Objects are appended to numbered log files in one directory, each record
+ being a header, the key, the body and a trailer that marks it complete.
+ The in-memory index maps a key to (log, offset, length) and is rebuilt
+ by scanning the logs at startup; a record cut short by a crash is
+ truncated away. When the logs exceed the byte budget the oldest log is
+ dropped whole (FIFO eviction), which keeps every write sequential.
+ */
+#ifndef __DISK_STORE_H__
+#define __DISK_STORE_H__
+
+#include <stddef.h>
+#include <sys/types.h>
+
+typedef struct store_log store_log_t;
+
+/* A pinned object: fd stays valid until disk_store_release */
+typedef struct {
+    int fd;
+    off_t offset;
+    size_t length;
+    store_log_t *log;
+} store_ref_t;
+
+/*
+ * Fills *data and *len with the object for key and returns an HTTP
+ * status; the store frees *data with free() after a 200.
+ */
+typedef int (*store_fetch_fn)(const char *key, char **data, size_t *len, void *arg);
+
+/* Opens (creating if needed) the store in dir; returns 0 or -1 */
+int disk_store_open(const char *dir, size_t budget);
+int disk_store_enabled(void);
+
+/* Returns 0 and pins the object on a hit, -1 on a miss */
+int disk_store_get(const char *key, store_ref_t *ref);
+void disk_store_release(store_ref_t *ref);
+
+/*
+ * Read-through lookup. On a miss, calls fetch once per key even when
+ * several threads miss at the same time; the others wait for it and
+ * then read the stored copy. Returns 200 with ref pinned, or the status
+ * the fetch returned.
+ */
+int disk_store_fetch(const char *key, store_fetch_fn fetch, void *arg, store_ref_t *ref);
+
+#endif // __DISK_STORE_H__
@@ -0,0 +1,269 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include "shard_ring.h"
+#include "fd_cache.h"
+
+/* Descriptors kept free for sockets, queues and the store when sizing from the limit */
+#define FD_CACHE_RESERVE 256
+
+enum { ENTRY_OPENING, ENTRY_OPEN, ENTRY_FAILED };
+
+struct fd_cache_entry {
+    fd_cache_entry_t *next;         // hash chain, while in the table
+    fd_cache_entry_t *lru_prev;     // LRU list, while open and in the table
+    fd_cache_entry_t *lru_next;
+    uint64_t hash;
+    int shard;
+    int fd;
+    int refs;
+    int state;
+    int detached;                   // out of the table: the last release frees it
+    char path[];
+};
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t opened;          // an ENTRY_OPENING entry settled
+    fd_cache_entry_t **buckets;
+    size_t mask;
+    fd_cache_entry_t lru;           // sentinel: lru.lru_next is the most recent
+    size_t count;                   // entries in the table, opening ones included
+    size_t capacity;
+} __attribute__((aligned(64))) fd_shard_t;
+
+static fd_shard_t *shards;
+
+static void lru_unlink(fd_cache_entry_t *e) {
+    e->lru_prev->lru_next = e->lru_next;
+    e->lru_next->lru_prev = e->lru_prev;
+}
+
+static void lru_push(fd_shard_t *s, fd_cache_entry_t *e) {
+    e->lru_next = s->lru.lru_next;
+    e->lru_prev = &s->lru;
+    s->lru.lru_next->lru_prev = e;
+    s->lru.lru_next = e;
+}
+
+static fd_cache_entry_t **chain_of(fd_shard_t *s, uint64_t hash) {
+    return &s->buckets[(hash / FD_CACHE_SHARDS) & s->mask];
+}
+
+static void table_remove(fd_shard_t *s, fd_cache_entry_t *e) {
+    fd_cache_entry_t **p = chain_of(s, e->hash);
+    while (*p != e) {
+        p = &(*p)->next;
+    }
+    *p = e->next;
+    if (e->state == ENTRY_OPEN) {
+        lru_unlink(e);
+    }
+    e->detached = 1;
+    s->count--;
+}
+
+static void entry_free(fd_cache_entry_t *e) {
+    if (e->fd >= 0) {
+        close(e->fd);
+    }
+    free(e);
+}
+
+/*
+ * Takes the least recently used unpinned entries out of the table until
+ * the shard is back within its capacity, chaining them on *victims to be
+ * closed once the lock is dropped.
+ */
+static void evict(fd_shard_t *s, fd_cache_entry_t **victims) {
+    fd_cache_entry_t *e = s->lru.lru_prev;
+    while (s->count > s->capacity && e != &s->lru) {
+        fd_cache_entry_t *prev = e->lru_prev;
+        if (e->refs == 0) {
+            table_remove(s, e);
+            e->next = *victims;
+            *victims = e;
+        }
+        e = prev;
+    }
+}
+
+static void free_victims(fd_cache_entry_t *victims) {
+    while (victims != NULL) {
+        fd_cache_entry_t *next = victims->next;
+        entry_free(victims);
+        victims = next;
+    }
+}
+
+long fd_cache_init(size_t capacity) {
+    struct rlimit rl;
+    size_t per_shard, nbuckets = 16;
+
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+        if (capacity == 0) {
+            capacity = rl.rlim_cur / 2;
+        } else if (capacity + FD_CACHE_RESERVE > rl.rlim_cur && rl.rlim_cur != RLIM_INFINITY) {
+            rlim_t want = capacity + FD_CACHE_RESERVE;
+            rl.rlim_cur = rl.rlim_max == RLIM_INFINITY || want < rl.rlim_max ? want : rl.rlim_max;
+            if (setrlimit(RLIMIT_NOFILE, &rl) == 0 && capacity + FD_CACHE_RESERVE > rl.rlim_cur) {
+                capacity = rl.rlim_cur > 2 * FD_CACHE_RESERVE ? rl.rlim_cur - FD_CACHE_RESERVE : rl.rlim_cur / 2;
+                fprintf(stderr, "[fd_cache] RLIMIT_NOFILE allows %zu cached descriptors\n", capacity);
+            }
+        }
+    }
+    if (capacity < FD_CACHE_SHARDS) {
+        capacity = FD_CACHE_SHARDS;
+    }
+    per_shard = capacity / FD_CACHE_SHARDS;
+    while (nbuckets < 2 * per_shard) {
+        nbuckets *= 2;
+    }
+
+    fd_shard_t *fresh = calloc(FD_CACHE_SHARDS, sizeof(fd_shard_t));
+    if (fresh == NULL) {
+        return -1;
+    }
+    for (int i = 0; i < FD_CACHE_SHARDS; i++) {
+        fd_shard_t *s = &fresh[i];
+        if ((s->buckets = calloc(nbuckets, sizeof(fd_cache_entry_t *))) == NULL) {
+            return -1;
+        }
+        pthread_mutex_init(&s->lock, NULL);
+        pthread_cond_init(&s->opened, NULL);
+        s->mask = nbuckets - 1;
+        s->lru.lru_next = s->lru.lru_prev = &s->lru;
+        s->capacity = per_shard;
+    }
+    __atomic_store_n(&shards, fresh, __ATOMIC_RELEASE);
+    return per_shard * FD_CACHE_SHARDS;
+}
+
+int fd_cache_enabled(void) {
+    return __atomic_load_n(&shards, __ATOMIC_ACQUIRE) != NULL;
+}
+
+int fd_cache_acquire(const char *path, fd_cache_entry_t **entry) {
+    uint64_t hash = shard_hash(path);
+    fd_shard_t *s = &shards[hash % FD_CACHE_SHARDS];
+    fd_cache_entry_t *e, *victims = NULL;
+    int fd, err;
+
+    pthread_mutex_lock(&s->lock);
+    for (e = *chain_of(s, hash); e != NULL; e = e->next) {
+        if (e->hash == hash && strcmp(e->path, path) == 0) {
+            break;
+        }
+    }
+    if (e != NULL) {
+        e->refs++;
+        /* Single flight: wait for the thread already opening it */
+        while (e->state == ENTRY_OPENING) {
+            pthread_cond_wait(&s->opened, &s->lock);
+        }
+        if (e->state == ENTRY_FAILED) {
+            err = e->fd;
+            if (--e->refs == 0) {
+                free(e);
+            }
+            pthread_mutex_unlock(&s->lock);
+            errno = err;
+            return -1;
+        }
+        if (!e->detached) {
+            lru_unlink(e);
+            lru_push(s, e);
+        }
+        pthread_mutex_unlock(&s->lock);
+        *entry = e;
+        return e->fd;
+    }
+
+    if ((e = calloc(1, sizeof(*e) + strlen(path) + 1)) == NULL) {
+        pthread_mutex_unlock(&s->lock);
+        errno = ENOMEM;
+        return -1;
+    }
+    strcpy(e->path, path);
+    e->hash = hash;
+    e->shard = hash % FD_CACHE_SHARDS;
+    e->fd = -1;
+    e->refs = 1;
+    e->state = ENTRY_OPENING;
+    e->next = *chain_of(s, hash);
+    *chain_of(s, hash) = e;
+    s->count++;
+    pthread_mutex_unlock(&s->lock);
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    err = errno;
+
+    pthread_mutex_lock(&s->lock);
+    if (fd < 0) {
+        /* Nothing is remembered: the next request tries again */
+        if (!e->detached) {
+            table_remove(s, e);
+        }
+        e->state = ENTRY_FAILED;
+        e->fd = err;
+        pthread_cond_broadcast(&s->opened);
+        if (--e->refs == 0) {
+            free(e);
+        }
+        pthread_mutex_unlock(&s->lock);
+        errno = err;
+        return -1;
+    }
+    e->fd = fd;
+    e->state = ENTRY_OPEN;
+    if (!e->detached) {
+        lru_push(s, e);
+        evict(s, &victims);
+    }
+    pthread_cond_broadcast(&s->opened);
+    pthread_mutex_unlock(&s->lock);
+    free_victims(victims);
+    *entry = e;
+    return fd;
+}
+
+void fd_cache_release(fd_cache_entry_t *e) {
+    fd_shard_t *s = &shards[e->shard];
+    fd_cache_entry_t *victims = NULL;
+
+    pthread_mutex_lock(&s->lock);
+    if (--e->refs == 0 && e->detached) {
+        e->next = victims;
+        victims = e;
+    } else if (e->refs == 0) {
+        evict(s, &victims);  // pinned entries may have held the shard over capacity
+    }
+    pthread_mutex_unlock(&s->lock);
+    free_victims(victims);
+}
+
+void fd_cache_invalidate(void) {
+    for (int i = 0; shards != NULL && i < FD_CACHE_SHARDS; i++) {
+        fd_shard_t *s = &shards[i];
+        fd_cache_entry_t *victims = NULL;
+
+        pthread_mutex_lock(&s->lock);
+        for (size_t b = 0; b <= s->mask; b++) {
+            while (s->buckets[b] != NULL) {
+                fd_cache_entry_t *e = s->buckets[b];
+                table_remove(s, e);
+                if (e->refs == 0) {
+                    e->next = victims;
+                    victims = e;
+                }
+            }
+        }
+        pthread_mutex_unlock(&s->lock);
+        free_victims(victims);
+    }
+}
@@ -0,0 +1,38 @@
+/*
+ Bounded cache of open descriptors for simplecache, so a corpus can be
+ far larger than RLIMIT_NOFILE and startup opens nothing.
+
+ Files are opened on first use and kept in a per-shard LRU list; paths
+ hash to one of FD_CACHE_SHARDS shards, each with its own lock, so
+ lookups of different files rarely contend. Threads that ask for a file
+ while another is opening it wait for that open instead of issuing their
+ own. A caller pins the entry it was given until fd_cache_release, and
+ eviction and invalidation only ever close unpinned descriptors: a
+ pinned one is closed by its last release. Pinned entries may hold a
+ shard above its share of the capacity for that long.
+ */
+#ifndef __FD_CACHE_H__
+#define __FD_CACHE_H__
+
+#include <stddef.h>
+
+#define FD_CACHE_SHARDS 16
+
+typedef struct fd_cache_entry fd_cache_entry_t;
+
+/*
+ * Sets up a cache keeping at most capacity descriptors open, raising
+ * RLIMIT_NOFILE towards it if needed; 0 picks half the limit. Returns
+ * the capacity in effect, or -1 if out of memory.
+ */
+long fd_cache_init(size_t capacity);
+int fd_cache_enabled(void);
+
+/* Returns an open descriptor for path and pins *entry, or -1 (errno set) */
+int fd_cache_acquire(const char *path, fd_cache_entry_t **entry);
+void fd_cache_release(fd_cache_entry_t *entry);
+
+/* Forgets every descriptor, e.g. after a reload, so files are opened afresh */
+void fd_cache_invalidate(void);
+
+#endif // __FD_CACHE_H__
@@ -0,0 +1,149 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "shm_channel.h"
+#include "fd_channel.h"
+
+/* How often a blocked receive checks that the cache is still alive */
+#define FD_LIVENESS_NS (20 * 1000000ull)
+
+static __thread int reply_sock = -1;
+static __thread char reply_name[FD_REPLY_NAME_LEN];
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Abstract namespace: nothing to unlink when the proxy exits */
+static socklen_t reply_addr(struct sockaddr_un *addr, const char *name) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    size_t len = strnlen(name, sizeof(addr->sun_path) - 1);
+    memcpy(addr->sun_path + 1, name, len);
+    return offsetof(struct sockaddr_un, sun_path) + 1 + len;
+}
+
+int fd_reply_socket(char *name, size_t len) {
+    static unsigned int next_socket;
+    struct sockaddr_un addr;
+
+    if (reply_sock < 0) {
+        int sock = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (sock < 0) {
+            perror("[Proxy] socket");
+            return -1;
+        }
+        snprintf(reply_name, sizeof(reply_name), "gfproxy.%d.%u", (int)getpid(),
+                 __atomic_fetch_add(&next_socket, 1, __ATOMIC_RELAXED));
+        if (bind(sock, (struct sockaddr *)&addr, reply_addr(&addr, reply_name)) < 0) {
+            perror("[Proxy] bind reply socket");
+            close(sock);
+            return -1;
+        }
+        reply_sock = sock;
+    }
+    snprintf(name, len, "%s", reply_name);
+    return reply_sock;
+}
+
+/* Receives one datagram; a passed descriptor goes to *fd */
+static ssize_t recv_reply(int sock, fd_reply_t *reply, int *fd) {
+    char control[CMSG_SPACE(sizeof(int))];
+    struct iovec iov = { reply, sizeof(*reply) };
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    *fd = -1;
+    ssize_t n = recvmsg(sock, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+    if (n < 0) {
+        return -1;
+    }
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+        memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+    }
+    return n;
+}
+
+int fd_reply_recv(int sock, uint64_t ticket, fd_reply_t *reply, int *fd,
+                  uint64_t deadline_ns, pid_t owner) {
+    while (1) {
+        ssize_t n = recv_reply(sock, reply, fd);
+        if (n == (ssize_t)sizeof(*reply) && reply->ticket == ticket) {
+            return 0;
+        }
+        if (n >= 0) {
+            /* A reply to a request this thread already gave up on */
+            if (*fd >= 0) {
+                close(*fd);
+            }
+            continue;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            perror("[Proxy] recvmsg");
+            return -1;
+        }
+
+        uint64_t now = monotonic_ns();
+        if (deadline_ns != 0 && now >= deadline_ns) {
+            return -1;
+        }
+        uint64_t until = now + FD_LIVENESS_NS;
+        if (deadline_ns != 0 && deadline_ns < until) {
+            until = deadline_ns;
+        }
+        struct pollfd pfd = { sock, POLLIN, 0 };
+        if (poll(&pfd, 1, (until - now + 999999) / 1000000) == 0 &&
+            owner != 0 && kill(owner, 0) < 0 && errno == ESRCH) {
+            return SHM_WRITER_DEAD;
+        }
+    }
+}
+
+int fd_reply_send(const char *reply_to, const fd_reply_t *reply, int fd) {
+    char control[CMSG_SPACE(sizeof(int))];
+    struct sockaddr_un addr;
+    struct iovec iov = { (void *)reply, sizeof(*reply) };
+    struct msghdr msg = {0};
+    msg.msg_name = &addr;
+    msg.msg_namelen = reply_addr(&addr, reply_to);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (fd >= 0) {
+        memset(control, 0, sizeof(control));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+
+    /* One socket serves every worker; sendmsg on a datagram socket is atomic */
+    static int sock = -1;
+    if (__atomic_load_n(&sock, __ATOMIC_ACQUIRE) < 0) {
+        int s = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        int expected = -1;
+        if (s < 0) {
+            return -1;
+        }
+        if (!__atomic_compare_exchange_n(&sock, &expected, s, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            close(s);
+        }
+    }
+    /* A proxy that has gone away refuses the datagram; nothing to undo */
+    return sendmsg(__atomic_load_n(&sock, __ATOMIC_ACQUIRE), &msg, MSG_NOSIGNAL) < 0 ? -1 : 0;
+}
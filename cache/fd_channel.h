@@ -0,0 +1,49 @@
+/*
+ Descriptor passing between simplecached and the proxy.
+
+ The cache answers a request with a datagram on the proxy thread's Unix
+ socket carrying the status and, on a hit, a descriptor (SCM_RIGHTS):
+ the open file itself, or a pipe or socket the body is streamed into.
+ The request still travels through the command queue, naming the
+ socket in cache_req_t.reply_to. The fd, pipe and stream transports in
+ transport.c are built on this.
+ */
+#ifndef __FD_CHANNEL_H__
+#define __FD_CHANNEL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* Room for an abstract socket name in cache_req_t */
+#define FD_REPLY_NAME_LEN 64
+
+typedef struct {
+    uint64_t ticket;     // echoes cache_req_t.ticket, so late replies are told apart
+    int32_t status;      // HTTP-style, as in shm_data_t
+    int32_t encoding;    // GF_ENC_* of the bytes at offset
+    uint64_t offset;     // where the body starts in the passed file
+    uint64_t length;     // body length
+    uint64_t identity_size;
+    uint64_t object_id;
+} fd_reply_t;
+
+/*
+ * Proxy side: the calling thread's reply socket, bound on first use;
+ * name gets what to put in reply_to. Returns the socket or -1.
+ */
+int fd_reply_socket(char *name, size_t len);
+
+/*
+ * Waits for the reply to ticket up to a CLOCK_MONOTONIC deadline (0
+ * waits forever), dropping stale replies. *fd gets the passed file or
+ * -1. Returns 0, -1 on timeout or error, or SHM_WRITER_DEAD once owner
+ * (if non-zero) has exited.
+ */
+int fd_reply_recv(int sock, uint64_t ticket, fd_reply_t *reply, int *fd,
+                  uint64_t deadline_ns, pid_t owner);
+
+/* Cache side: sends reply to the socket named by reply_to, with fd unless it is -1 */
+int fd_reply_send(const char *reply_to, const fd_reply_t *reply, int fd);
+
+#endif // __FD_CHANNEL_H__
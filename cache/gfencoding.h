@@ -0,0 +1,39 @@
+/*
+ Optional content-encoding extension for GETFILE.
+
+ Like the range extension, the request rides on the path as a suffix:
+ GETFILE GET /path;enc=gzip
+ A client that sends it gets a gzip stream (RFC 1952) as the body of an
+ ordinary GETFILE OK, whose length is the compressed length. It cannot
+ be combined with ;range=, which addresses bytes of the plain file.
+ */
+#ifndef __GF_ENCODING_H__
+#define __GF_ENCODING_H__
+
+#include <string.h>
+
+#define GF_ENCODING_SUFFIX ";enc=gzip"
+
+/* Encoding of the bytes carried by a response */
+#define GF_ENC_IDENTITY 0
+#define GF_ENC_GZIP 1
+
+/* What the proxy asks the cache for in cache_req_t.accept */
+#define GF_ACCEPT_IDENTITY 0   // plain bytes only (ranges and stripes)
+#define GF_ACCEPT_SMALLER 1    // gzip if the cache has a variant worth it; the proxy inflates
+#define GF_ACCEPT_GZIP 2       // gzip always; the client asked for it
+
+/*
+ * Strips a trailing encoding suffix from path in place.
+ * Returns GF_ENC_GZIP if it was there, GF_ENC_IDENTITY otherwise.
+ */
+static inline int gf_parse_encoding(char *path) {
+    size_t len = strlen(path), slen = strlen(GF_ENCODING_SUFFIX);
+    if (len < slen || strcmp(path + len - slen, GF_ENCODING_SUFFIX) != 0) {
+        return GF_ENC_IDENTITY;
+    }
+    path[len - slen] = '\0';
+    return GF_ENC_GZIP;
+}
+
+#endif // __GF_ENCODING_H__
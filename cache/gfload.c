@@ -0,0 +1,540 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <getopt.h>
+#include <math.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "stats.h"
+#include "trace.h"
+
+/*
+ * GETFILE load generator. Requests are drawn from a workload file (the
+ * first column of each line, so locals.txt works too) either uniformly or
+ * with Zipf popularity, in closed-loop (each thread back to back) or
+ * open-loop (fixed arrival rate, latency measured from the scheduled
+ * arrival so queueing is not hidden) mode. With -T it replays a trace
+ * recorded by webproxy -L instead, open-loop at the recorded arrival
+ * times divided by -x, and compares latency and answers with the trace.
+ */
+
+#define USAGE                                                                         \
+"usage:\n"                                                                            \
+"  gfload [options]\n"                                                                \
+"options:\n"                                                                          \
+"  -s [server_addr]    Server address (Default: 127.0.0.1)\n"                         \
+"  -p [server_port]    Server port (Default: 25362)\n"                                \
+"  -w [workload_path]  Workload file, first column is the path (Default: workload.txt)\n" \
+"  -t [thread_count]   Concurrent connections (Default: 8, Range: 1-1000)\n"          \
+"  -r [request_count]  Total requests (Default: 1000)\n"                              \
+"  -d [seconds]        Run for a duration instead of a request count\n"               \
+"  -R [rate]           Open-loop arrival rate in req/s (Default: 0 = closed loop)\n"  \
+"  -z [exponent]       Zipf popularity exponent (Default: 0 = uniform)\n"             \
+"  -T [trace_file]     Replay a webproxy -L trace instead of a workload\n"          \
+"  -x [speed]          Replay speed-up, 0 for back to back (Default: 1 = recorded pace)\n" \
+"  -G [dir]            Generate a corpus into dir (with locals.txt and workload.txt) and exit\n" \
+"  -N [file_count]     Files to generate with -G (Default: 100)\n"                   \
+"  -S [distribution]   Sizes for -G: fixed:N, uniform:MIN:MAX, lognormal:MEDIAN:SIGMA\n" \
+"                      (Default: lognormal:65536:1.5)\n"                              \
+"  -h                  Show this help message\n"
+
+static struct option gLongOptions[] = {
+  {"server",        required_argument,      NULL,           's'},
+  {"port",          required_argument,      NULL,           'p'},
+  {"workload-path", required_argument,      NULL,           'w'},
+  {"thread-count",  required_argument,      NULL,           't'},
+  {"request-count", required_argument,      NULL,           'r'},
+  {"duration",      required_argument,      NULL,           'd'},
+  {"rate",          required_argument,      NULL,           'R'},
+  {"zipf",          required_argument,      NULL,           'z'},
+  {"trace",         required_argument,      NULL,           'T'},
+  {"speed",         required_argument,      NULL,           'x'},
+  {"generate",      required_argument,      NULL,           'G'},
+  {"file-count",    required_argument,      NULL,           'N'},
+  {"sizes",         required_argument,      NULL,           'S'},
+  {"help",          no_argument,            NULL,           'h'},
+  {NULL,            0,                      NULL,            0}
+};
+
+#define MAX_PATH_LEN 1024
+#define RECV_BUFSIZE 65536
+
+typedef struct {
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    char **paths;
+    double *cdf;             // cumulative popularity, NULL for uniform
+    int npaths;
+    unsigned long nrequests; // 0 when running for a duration
+    uint64_t end_ns;         // 0 when running for a request count
+    double rate;
+    trace_entry_t *trace;    // replayed in place of paths, NULL otherwise
+    double speed;            // replay speed-up, 0 for back to back
+    uint64_t start_ns;
+    unsigned long next;      // next request slot, shared by all threads
+} load_t;
+
+typedef struct {
+    unsigned long ok, notfound, errors;
+    unsigned long mismatched;   // replay: answered differently than in the trace
+    unsigned long long bytes;
+} load_counts_t;
+
+static load_t load;
+static stats_hist_t latency;
+static stats_hist_t recorded;   // replay: latencies the trace recorded
+static load_counts_t totals;
+static pthread_mutex_t totals_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t xorshift(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1Dull;
+}
+
+static double uniform01(uint64_t *state) {
+    return (xorshift(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static int pick_path(uint64_t *state) {
+    if (load.cdf == NULL) {
+        return (int)(xorshift(state) % load.npaths);
+    }
+    double u = uniform01(state);
+    int lo = 0, hi = load.npaths - 1;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (load.cdf[mid] < u) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static void build_zipf(double s) {
+    load.cdf = malloc(load.npaths * sizeof(double));
+    double sum = 0;
+    for (int i = 0; i < load.npaths; i++) {
+        sum += 1.0 / pow(i + 1, s);
+        load.cdf[i] = sum;
+    }
+    for (int i = 0; i < load.npaths; i++) {
+        load.cdf[i] /= sum;
+    }
+}
+
+static void read_workload(const char *filename) {
+    FILE *fp = fopen(filename, "r");
+    if (fp == NULL) {
+        perror(filename);
+        exit(1);
+    }
+    char line[MAX_PATH_LEN];
+    int capacity = 64;
+    load.paths = malloc(capacity * sizeof(char *));
+    while (fgets(line, sizeof(line), fp)) {
+        char *ptr = line;
+        char *path = strsep(&ptr, " \t\r\n");
+        if (path == NULL || path[0] != '/') {
+            continue;
+        }
+        if (load.npaths == capacity) {
+            capacity *= 2;
+            load.paths = realloc(load.paths, capacity * sizeof(char *));
+        }
+        load.paths[load.npaths++] = strdup(path);
+    }
+    fclose(fp);
+    if (load.npaths == 0) {
+        fprintf(stderr, "No paths in workload %s\n", filename);
+        exit(1);
+    }
+}
+
+static void resolve(const char *server, unsigned short port) {
+    struct addrinfo hints = {0}, *res;
+    char portstr[16];
+    snprintf(portstr, sizeof(portstr), "%u", port);
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    int rc = getaddrinfo(server, portstr, &hints, &res);
+    if (rc != 0) {
+        fprintf(stderr, "getaddrinfo %s: %s\n", server, gai_strerror(rc));
+        exit(1);
+    }
+    memcpy(&load.addr, res->ai_addr, res->ai_addrlen);
+    load.addrlen = res->ai_addrlen;
+    freeaddrinfo(res);
+}
+
+/*
+ * Parses "GETFILE <STATUS> <len>" terminated by a delimiter (the provided
+ * gfserver sends "GETFILE OK <len> "; a trailing "\r\n\r\n" is also accepted).
+ * Returns the header length, 0 if more bytes are needed, -1 if malformed.
+ */
+static int parse_header(const char *buf, int len, char *status, size_t *file_len) {
+    int field = 0, i = 0, start = 0;
+    char tokens[3][32];
+    while (i < len && field < 3) {
+        if (buf[i] == ' ' || buf[i] == '\t' || buf[i] == '\r' || buf[i] == '\n') {
+            if (i > start) {
+                int n = i - start;
+                if (n >= (int)sizeof(tokens[0])) {
+                    return -1;
+                }
+                memcpy(tokens[field], buf + start, n);
+                tokens[field][n] = '\0';
+                field++;
+            }
+            start = i + 1;
+        }
+        i++;
+    }
+    if (field < 3) {
+        return (len >= 128) ? -1 : 0;
+    }
+    if (strcmp(tokens[0], "GETFILE") != 0) {
+        return -1;
+    }
+    if (len - i >= 3 && buf[i - 1] == '\r' && strncmp(buf + i, "\n\r\n", 3) == 0) {
+        i += 3;
+    }
+    strcpy(status, tokens[1]);
+    *file_len = strtoull(tokens[2], NULL, 10);
+    return i;
+}
+
+/* Issues one GETFILE request. Returns 0 = OK, 1 = not found, -1 = error. */
+static int getfile(const char *path, size_t *received) {
+    char buf[RECV_BUFSIZE];
+    char status[32];
+    size_t file_len = 0;
+    int hdrlen = 0, used = 0, rc = -1;
+
+    *received = 0;
+    int sock = socket(load.addr.ss_family, SOCK_STREAM, 0);
+    if (sock < 0) {
+        return -1;
+    }
+    if (connect(sock, (struct sockaddr *)&load.addr, load.addrlen) < 0) {
+        close(sock);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    int n = snprintf(buf, sizeof(buf), "GETFILE GET %s\r\n\r\n", path);
+    if (send(sock, buf, n, MSG_NOSIGNAL) != n) {
+        close(sock);
+        return -1;
+    }
+
+    while (hdrlen == 0) {
+        ssize_t r = recv(sock, buf + used, 128 - used, 0);
+        if (r <= 0) {
+            close(sock);
+            return -1;
+        }
+        used += r;
+        hdrlen = parse_header(buf, used, status, &file_len);
+        if (hdrlen < 0) {
+            close(sock);
+            return -1;
+        }
+    }
+
+    if (strcmp(status, "FILE_NOT_FOUND") == 0) {
+        rc = 1;
+    } else if (strcmp(status, "OK") == 0) {
+        size_t got = used - hdrlen;
+        while (got < file_len) {
+            ssize_t r = recv(sock, buf, sizeof(buf), 0);
+            if (r <= 0) {
+                break;
+            }
+            got += r;
+        }
+        *received = got;
+        rc = (got == file_len) ? 0 : -1;
+    }
+    close(sock);
+    return rc;
+}
+
+static void sleep_until(uint64_t ns) {
+    struct timespec ts = { .tv_sec = ns / 1000000000ull, .tv_nsec = ns % 1000000000ull };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+}
+
+static void *load_worker(void *arg) {
+    uint64_t rng = 0x9E3779B97F4A7C15ull ^ ((uint64_t)(uintptr_t)arg << 17) ^ stats_now_ns();
+    load_counts_t counts = {0};
+
+    while (1) {
+        unsigned long slot = __atomic_fetch_add(&load.next, 1, __ATOMIC_RELAXED);
+        if (load.nrequests > 0 && slot >= load.nrequests) {
+            break;
+        }
+
+        const trace_entry_t *entry = load.trace ? &load.trace[slot] : NULL;
+        uint64_t begin_ns;
+        if (entry != NULL && load.speed > 0) {
+            begin_ns = load.start_ns + (uint64_t)(entry->arrival_ns / load.speed);
+            if (load.end_ns > 0 && begin_ns >= load.end_ns) {
+                break;
+            }
+            sleep_until(begin_ns);
+        } else if (load.rate > 0) {
+            begin_ns = load.start_ns + (uint64_t)(slot * (1e9 / load.rate));
+            if (load.end_ns > 0 && begin_ns >= load.end_ns) {
+                break;
+            }
+            sleep_until(begin_ns);
+        } else {
+            begin_ns = stats_now_ns();
+            if (load.end_ns > 0 && begin_ns >= load.end_ns) {
+                break;
+            }
+        }
+
+        size_t received;
+        int rc = getfile(entry ? entry->path : load.paths[pick_path(&rng)], &received);
+        stats_hist_record(&latency, stats_now_ns() - begin_ns);
+        if (entry != NULL && rc != (entry->status == 200 ? 0 : entry->status == 400 ? 1 : -1)) {
+            counts.mismatched++;  // trace status is a gfstatus_t: GF_OK 200, GF_FILE_NOT_FOUND 400
+        }
+
+        if (rc == 0) counts.ok++;
+        else if (rc == 1) counts.notfound++;
+        else counts.errors++;
+        counts.bytes += received;
+    }
+
+    pthread_mutex_lock(&totals_mutex);
+    totals.ok += counts.ok;
+    totals.notfound += counts.notfound;
+    totals.errors += counts.errors;
+    totals.mismatched += counts.mismatched;
+    totals.bytes += counts.bytes;
+    pthread_mutex_unlock(&totals_mutex);
+    return NULL;
+}
+
+static size_t draw_size(const char *spec, uint64_t *rng) {
+    double a = 0, b = 0;
+    if (sscanf(spec, "fixed:%lf", &a) == 1) {
+        return (size_t)a;
+    }
+    if (sscanf(spec, "uniform:%lf:%lf", &a, &b) == 2) {
+        return (size_t)(a + uniform01(rng) * (b - a));
+    }
+    if (sscanf(spec, "lognormal:%lf:%lf", &a, &b) == 2) {
+        /* Box-Muller */
+        double u1 = uniform01(rng), u2 = uniform01(rng);
+        double z = sqrt(-2.0 * log(u1 + 1e-300)) * cos(2 * M_PI * u2);
+        return (size_t)(a * exp(b * z));
+    }
+    fprintf(stderr, "Invalid size distribution: %s\n", spec);
+    exit(1);
+}
+
+static void generate_corpus(const char *dir, int nfiles, const char *spec) {
+    char path[PATH_MAX + 32], abs_dir[PATH_MAX];
+    char buf[RECV_BUFSIZE];
+    uint64_t rng = 0x2545F4914F6CDD1Dull;
+
+    mkdir(dir, 0755);
+    if (realpath(dir, abs_dir) == NULL) {
+        perror(dir);
+        exit(1);
+    }
+    snprintf(path, sizeof(path), "%s/locals.txt", abs_dir);
+    FILE *locals = fopen(path, "w");
+    snprintf(path, sizeof(path), "%s/workload.txt", abs_dir);
+    FILE *workload = fopen(path, "w");
+    if (locals == NULL || workload == NULL) {
+        perror("fopen");
+        exit(1);
+    }
+
+    for (size_t i = 0; i < sizeof(buf); i++) {
+        buf[i] = (char)xorshift(&rng);
+    }
+
+    unsigned long long total = 0;
+    for (int i = 0; i < nfiles; i++) {
+        size_t size = draw_size(spec, &rng);
+        snprintf(path, sizeof(path), "%s/gen_%05d.bin", abs_dir, i);
+        FILE *fp = fopen(path, "w");
+        if (fp == NULL) {
+            perror(path);
+            exit(1);
+        }
+        for (size_t left = size; left > 0;) {
+            size_t n = left < sizeof(buf) ? left : sizeof(buf);
+            fwrite(buf, 1, n, fp);
+            left -= n;
+        }
+        fclose(fp);
+        fprintf(locals, "/gen_%05d.bin %s\n", i, path);
+        fprintf(workload, "/gen_%05d.bin\n", i);
+        total += size;
+    }
+    fclose(locals);
+    fclose(workload);
+    printf("Generated %d files (%llu bytes) in %s\n", nfiles, total, abs_dir);
+}
+
+static void print_latency(const char *label, const stats_hist_t *hist) {
+    printf("%s: mean %.1f p50 %.1f p99 %.1f p999 %.1f max %.1f\n", label,
+           hist->count ? hist->sum_ns / 1e3 / hist->count : 0.0,
+           stats_hist_percentile(hist, 50.0) / 1e3,
+           stats_hist_percentile(hist, 99.0) / 1e3,
+           stats_hist_percentile(hist, 99.9) / 1e3,
+           hist->max_ns / 1e3);
+}
+
+int main(int argc, char **argv) {
+    int option_char;
+    char *server = "127.0.0.1";
+    char *workload = "workload.txt";
+    char *gendir = NULL;
+    char *sizes = "lognormal:65536:1.5";
+    char *trace = NULL;
+    unsigned short port = 25362;
+    int nthreads = 8;
+    int nfiles = 100;
+    double duration = 0;
+    double zipf = 0;
+
+    load.nrequests = 1000;
+    load.speed = 1;
+
+    while ((option_char = getopt_long(argc, argv, "s:p:w:t:r:d:R:z:T:x:G:N:S:h", gLongOptions, NULL)) != -1) {
+        switch (option_char) {
+            default:
+                fprintf(stderr, "%s", USAGE);
+                exit(1);
+            case 'h':
+                fprintf(stdout, "%s", USAGE);
+                exit(0);
+            case 's':
+                server = optarg;
+                break;
+            case 'p':
+                port = atoi(optarg);
+                break;
+            case 'w':
+                workload = optarg;
+                break;
+            case 't':
+                nthreads = atoi(optarg);
+                break;
+            case 'r':
+                load.nrequests = strtoul(optarg, NULL, 10);
+                break;
+            case 'd':
+                duration = atof(optarg);
+                break;
+            case 'R':
+                load.rate = atof(optarg);
+                break;
+            case 'z':
+                zipf = atof(optarg);
+                break;
+            case 'T':
+                trace = optarg;
+                break;
+            case 'x':
+                load.speed = atof(optarg);
+                break;
+            case 'G':
+                gendir = optarg;
+                break;
+            case 'N':
+                nfiles = atoi(optarg);
+                break;
+            case 'S':
+                sizes = optarg;
+                break;
+        }
+    }
+
+    if (gendir != NULL) {
+        generate_corpus(gendir, nfiles, sizes);
+        return 0;
+    }
+
+    if (nthreads < 1 || nthreads > 1000) {
+        fprintf(stderr, "Invalid number of threads\n");
+        exit(1);
+    }
+
+    if (trace != NULL) {
+        long n = trace_load(trace, &load.trace);
+        if (n <= 0) {
+            fprintf(stderr, "No requests in trace %s\n", trace);
+            exit(1);
+        }
+        load.nrequests = n;
+        for (long i = 0; i < n; i++) {
+            stats_hist_record(&recorded, load.trace[i].latency_ns);
+        }
+    } else {
+        read_workload(workload);
+        if (zipf > 0) {
+            build_zipf(zipf);
+        }
+    }
+    resolve(server, port);
+
+    load.start_ns = stats_now_ns();
+    if (duration > 0 && trace != NULL) {
+        load.end_ns = load.start_ns + (uint64_t)(duration * 1e9);
+    } else if (duration > 0) {
+        load.nrequests = 0;
+        load.end_ns = load.start_ns + (uint64_t)(duration * 1e9);
+    }
+
+    pthread_t threads[nthreads];
+    for (int i = 0; i < nthreads; i++) {
+        if (pthread_create(&threads[i], NULL, load_worker, (void *)(uintptr_t)i) != 0) {
+            perror("pthread_create");
+            exit(1);
+        }
+    }
+    for (int i = 0; i < nthreads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    double elapsed = (stats_now_ns() - load.start_ns) / 1e9;
+    unsigned long total = totals.ok + totals.notfound + totals.errors;
+    if (trace != NULL) {
+        printf("mode: replay x%.2f, threads: %d, trace: %lu requests over %.3f s\n", load.speed, nthreads,
+               load.nrequests, load.trace[load.nrequests - 1].arrival_ns / 1e9);
+    } else {
+        printf("mode: %s, threads: %d, paths: %d, zipf: %.2f\n",
+               load.rate > 0 ? "open-loop" : "closed-loop", nthreads, load.npaths, zipf);
+    }
+    printf("requests: %lu ok: %lu not_found: %lu errors: %lu\n",
+           total, totals.ok, totals.notfound, totals.errors);
+    printf("elapsed: %.3f s  throughput: %.1f req/s  %.2f MB/s\n",
+           elapsed, total / elapsed, totals.bytes / elapsed / 1e6);
+    print_latency("latency(us)", &latency);
+    if (trace != NULL) {
+        print_latency("recorded(us)", &recorded);
+        printf("mismatched: %lu\n", totals.mismatched);
+    }
+
+    return totals.errors > 0;
+}
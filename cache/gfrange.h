@@ -0,0 +1,91 @@
+/*
+ Optional byte-range extension for GETFILE.
+
+ The gfserver library parses the request line itself, so the range rides
+ on the path as a suffix:  GETFILE GET /path;range=START-END
+ START and END are inclusive byte offsets like HTTP's Range header; END
+ may be omitted to read to the end of the file. The response is an
+ ordinary GETFILE OK whose length is the number of bytes in the range.
+ */
+#ifndef __GF_RANGE_H__
+#define __GF_RANGE_H__
+
+#include <stdlib.h>
+#include <string.h>
+
+#define GF_RANGE_SUFFIX ";range="
+
+typedef struct {
+    int present;
+    size_t start;
+    size_t end;      // inclusive; only meaningful when has_end
+    int has_end;
+} gf_range_t;
+
+/*
+ * Copies path without any range suffix into clean and fills range.
+ * Returns 0 on success, -1 if the suffix is malformed or clean is too small.
+ */
+static inline int gf_parse_range(const char *path, char *clean, size_t cleanlen, gf_range_t *range) {
+    const char *suffix = strstr(path, GF_RANGE_SUFFIX);
+    size_t pathlen = suffix ? (size_t)(suffix - path) : strlen(path);
+
+    memset(range, 0, sizeof(*range));
+    if (pathlen >= cleanlen) {
+        return -1;
+    }
+    memcpy(clean, path, pathlen);
+    clean[pathlen] = '\0';
+    if (suffix == NULL) {
+        return 0;
+    }
+
+    const char *spec = suffix + strlen(GF_RANGE_SUFFIX);
+    char *endp;
+    if (*spec < '0' || *spec > '9') {
+        return -1;
+    }
+    range->start = strtoull(spec, &endp, 10);
+    if (*endp != '-') {
+        return -1;
+    }
+    spec = endp + 1;
+    if (*spec != '\0') {
+        if (*spec < '0' || *spec > '9') {
+            return -1;
+        }
+        range->end = strtoull(spec, &endp, 10);
+        if (*endp != '\0' || range->end < range->start) {
+            return -1;
+        }
+        range->has_end = 1;
+    }
+    range->present = 1;
+    return 0;
+}
+
+/*
+ * Clamps a range against the object size. Returns 0 and sets offset/length,
+ * or -1 if the range starts past the end of the object.
+ */
+static inline int gf_range_resolve(const gf_range_t *range, size_t size, size_t *offset, size_t *length) {
+    if (!range->present) {
+        *offset = 0;
+        *length = size;
+        return 0;
+    }
+    if (range->start >= size && !(size == 0 && range->start == 0)) {
+        return -1;
+    }
+    if (size == 0) {
+        *offset = 0;
+        *length = 0;
+        return 0;
+    }
+    size_t last = (range->has_end && range->end < size) ? range->end : size - 1;
+    *offset = range->start;
+    *length = last - range->start + 1;
+    return 0;
+}
+
+#endif // __GF_RANGE_H__
@@ -1,104 +1,470 @@
 #include <stdio.h>
+#include <inttypes.h>
+#include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
-#include <semaphore.h>
 #include <mqueue.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <zlib.h>
 #include "steque.h"
 #include "gfserver.h"
 #include "shm_channel.h"
 #include "cache-student.h"
+#include "stats.h"
+#include "shard_ring.h"
+#include "numa_place.h"
+#include "miss_filter.h"
+#include "transport.h"
+#include "counters.h"
+#include "probes.h"
+#include "io_engine.h"
+#include "trace.h"
 
-ssize_t handle_with_cache(gfcontext_t *ctx, const char *path, void *arg) {
-    shm_data_t *shm;
-    
-    // Get shared memory segment from pool
-    shm = get_shm_segment();
+/* Set up by webproxy from -c and -R; one ring point per shard when -c is 1 */
+shard_ring_t cache_ring;
+int cache_replicas = 1;
+
+/* Resends before giving up on a cache that died, backing off 1, 2, 4... ms */
+#define CACHE_RETRIES 8
+
+/* Set from webproxy's -T and -I; 0 disables either */
+uint64_t cache_timeout_ns = 60 * 1000000000ull;
+unsigned int max_inflight = 0;
+static unsigned int inflight;
+
+/* Set from webproxy's -F; how bodies come back from the cache */
+const transport_ops_t *cache_transport;
+
+/* Created by webproxy; answered with the caches' own on /__stats */
+counters_t *proxy_counters;
+
+/*
+ * gfserver owns its worker threads, so each one pins itself the first
+ * time it handles a request. No-op unless webproxy was started with -P.
+ */
+static void pin_worker_thread(void) {
+    static int next_slot;
+    static __thread int pinned;
+    if (!pinned && numa_place_enabled()) {
+        numa_pin_thread(__atomic_fetch_add(&next_slot, 1, __ATOMIC_RELAXED));
+        pinned = 1;
+    }
+}
+
+/*
+ * Opens the command queue of the first reachable shard owning path.
+ * A cache that shut down cleanly has no queue, so mq_open fails; one
+ * that was killed leaves its queue but its owner PID is gone. Either
+ * way the request falls over to the next replica on the ring. owner gets
+ * the PID of the cache behind the queue, 0 if it has no record.
+ */
+static mqd_t open_cache_queue(const char *path, pid_t *owner) {
+    /* Whether each shard was last found down, so a dead one is reported once, not per request */
+    static int shard_down[SHARD_MAX];
+    int owners[SHARD_MAX];
+    int n = shard_ring_owners(&cache_ring, path, owners, cache_replicas);
+    for (int i = 0; i < n; i++) {
+        char name[MAX_SHM_NAME];
+        shard_queue_name(name, sizeof(name), owners[i], cache_ring.nshards);
+        if (!shard_owner_alive(name)) {
+            if (!__atomic_exchange_n(&shard_down[owners[i]], 1, __ATOMIC_RELAXED)) {
+                fprintf(stderr, "[Proxy] cache shard %d is dead (%s), trying next replica\n", owners[i], name);
+            }
+            continue;
+        }
+        mqd_t mq = mq_open(name, O_WRONLY);
+        if (mq != (mqd_t)-1) {
+            if (__atomic_exchange_n(&shard_down[owners[i]], 0, __ATOMIC_RELAXED)) {
+                fprintf(stderr, "[Proxy] cache shard %d is back (%s)\n", owners[i], name);
+            }
+            *owner = shard_owner_pid(name);
+            return mq;
+        }
+        if (!__atomic_exchange_n(&shard_down[owners[i]], 1, __ATOMIC_RELAXED)) {
+            fprintf(stderr, "[Proxy] cache shard %d unreachable (%s), trying next replica\n", owners[i], name);
+        }
+    }
+    return (mqd_t)-1;
+}
+
+/*
+ * 1 if the cache open_cache_queue would pick for path definitely lacks
+ * it, judged by the key filter that cache publishes next to its queue.
+ */
+static int cache_absent(const char *path) {
+    int owners[SHARD_MAX];
+    int n = shard_ring_owners(&cache_ring, path, owners, cache_replicas);
+    for (int i = 0; i < n; i++) {
+        char name[MAX_SHM_NAME];
+        shard_queue_name(name, sizeof(name), owners[i], cache_ring.nshards);
+        if (shard_owner_alive(name)) {
+            return miss_filter_absent(name, owners[i], path);
+        }
+    }
+    return 0;
+}
+
+/* Deadline for the next post from the cache; a stalled cache is given up on */
+static uint64_t next_deadline(void) {
+    return cache_timeout_ns ? stats_now_ns() + cache_timeout_ns : 0;
+}
+
+/* mq_send that gives up at a CLOCK_MONOTONIC deadline when the queue stays full */
+static int send_request(mqd_t mq, cache_req_t *request) {
+    if (request->deadline_ns == 0) {
+        return mq_send(mq, (char *)request, sizeof(*request), 0);
+    }
+    struct timespec ts;
+    uint64_t now = stats_now_ns();
+    uint64_t left = request->deadline_ns > now ? request->deadline_ns - now : 0;
+    clock_gettime(CLOCK_REALTIME, &ts);  // mq_timedsend only takes the realtime clock
+    left += ts.tv_nsec;
+    ts.tv_sec += left / 1000000000ull;
+    ts.tv_nsec = left % 1000000000ull;
+    return mq_timedsend(mq, (char *)request, sizeof(*request), 0, &ts);
+}
+
+/*
+ * The client side of one response. Bytes go out through gfs_send, or
+ * straight to the context's socket for zero-copy transports, and are
+ * inflated on the way when the cache sent gzip the client did not ask for.
+ */
+typedef struct {
+    transport_sink_t sink;  // first, so the callbacks can cast back
+    gfcontext_t *ctx;
+    mqd_t mq;               // the cache's queue, for stripes
+    size_t sent;            // body bytes the client got
+    size_t limit;           // body bytes the header promised
+    int inflating;
+    z_stream zs;
+} proxy_sink_t;
+
+static ssize_t sink_send(transport_sink_t *sink, const void *buf, size_t len) {
+    proxy_sink_t *ps = (proxy_sink_t *)sink;
+    uint64_t send_ns = stats_now_ns();
+    ssize_t bytes_sent = gfs_send(ps->ctx, (void *)buf, len);
+    send_ns = stats_now_ns() - send_ns;
+    sink->send_ns += send_ns;
+    GF_PROBE2(gfs__send, bytes_sent, send_ns);
+    if (bytes_sent != (ssize_t)len) {
+        perror("[Proxy] Error sending data to client");
+        return -1;
+    }
+    ps->sent += bytes_sent;
+    return bytes_sent;
+}
+
+/* gfs_send is bypassed, so account for the bytes the way it would */
+static void sink_sent(transport_sink_t *sink, size_t len) {
+    proxy_sink_t *ps = (proxy_sink_t *)sink;
+    GF_PROBE2(gfs__send, len, 0);  // sent by the transport; it times the whole body
+    ps->ctx->bytes_transferred += len;
+    ps->sent += len;
+}
+
+/* Inflates one chunk of a gzip body and sends what comes out */
+static ssize_t sink_inflate(transport_sink_t *sink, const void *buf, size_t len) {
+    proxy_sink_t *ps = (proxy_sink_t *)sink;
+    unsigned char out[16384];
+
+    ps->zs.next_in = (Bytef *)buf;
+    ps->zs.avail_in = len;
+    do {
+        ps->zs.next_out = out;
+        ps->zs.avail_out = sizeof(out);
+        int ret = inflate(&ps->zs, Z_NO_FLUSH);
+        size_t have = sizeof(out) - ps->zs.avail_out;
+        if (ret == Z_BUF_ERROR && have == 0) {
+            break;  // wants the next chunk
+        }
+        if ((ret != Z_OK && ret != Z_STREAM_END) || have > ps->limit - ps->sent) {
+            fprintf(stderr, "[Proxy] Bad gzip body from cache: %d\n", ret);
+            return -1;
+        }
+        if (have > 0 && sink_send(sink, out, have) < 0) {
+            return -1;
+        }
+        if (ret == Z_STREAM_END) {
+            break;
+        }
+    } while (ps->zs.avail_in > 0 || ps->zs.avail_out == 0);
+    return len;
+}
+
+static int sink_request(transport_sink_t *sink, cache_req_t *request) {
+    return send_request(((proxy_sink_t *)sink)->mq, request);
+}
+
+/*
+ * Gives the rest of a response to the I/O threads (-E). Once we return,
+ * gfserver reads the socket until the client hangs up and then closes
+ * it, so the threads get their own descriptor and the read side is shut
+ * down, which ends that read at once; the body is marked sent so that
+ * gfserver does not pad it. -1 leaves the response to consume.
+ */
+static int hand_off(gfcontext_t *ctx, const transport_ops_t *transport, transport_chan_t *ch,
+                    const cache_req_t *request, const transport_reply_t *reply) {
+    if (transport->handoff == NULL || !io_engine_running()) {
+        return -1;
+    }
+    int sock = fcntl(ctx->socket, F_DUPFD_CLOEXEC, 0);
+    if (sock < 0) {
+        return -1;
+    }
+    if (transport->handoff(ch, request, reply, sock, cache_timeout_ns) < 0) {
+        close(sock);
+        return -1;
+    }
+    shutdown(ctx->socket, SHUT_RD);
+    ctx->bytes_transferred = ctx->file_len;
+    return 0;
+}
+
+static ssize_t serve_from_cache(gfcontext_t *ctx, const char *path, gfstatus_t *status) {
+    const transport_ops_t *transport = cache_transport;
+    transport_reply_t reply;
+    uint64_t start_ns = stats_now_ns();
     
-    /* 
-    printf("[Proxy] Thread %ld acquired segment: %s\n", pthread_self(), shm->name);
-    printf("[Proxy] Thread %ld requesting file: %s\n", pthread_self(), path)*/
+    pin_worker_thread();
     
     /*Prepare request*/ 
     cache_req_t request;
-    strncpy(request.path, path, sizeof(request.path) - 1);
-    request.path[sizeof(request.path) - 1] = '\0';
-    strncpy(request.shm_name, shm->name, sizeof(request.shm_name) - 1);
-    request.shm_name[sizeof(request.shm_name) - 1] = '\0';
-    request.segsize = shm->segsize;
+    char reqpath[MAX_CACHE_REQUEST_LEN];
+    snprintf(reqpath, sizeof(reqpath), "%s", path);
+    int want_gzip = gf_parse_encoding(reqpath) == GF_ENC_GZIP;
+    if (gf_parse_range(reqpath, request.path, sizeof(request.path), &request.range) < 0 ||
+        (want_gzip && request.range.present)) {
+        return SERVER_FAILURE;
+    }
     
-    // Initialize semaphores
-    sem_init(&shm->wsem, 1, 0);
-    sem_init(&shm->rsem, 1, 1);
+    /* A definite miss needs no channel and no round trip to the cache */
+    if (cache_absent(request.path)) {
+        *status = GF_FILE_NOT_FOUND;
+        counter_add(proxy_counters, CTR_NOT_FOUND, 1);
+        gfs_sendheader(ctx, GF_FILE_NOT_FOUND, 0);
+        return 0;
+    }
     
-    // Open message queue and send request
-    mqd_t mq = mq_open(CACHE_COMMAND_QUEUE, O_WRONLY);
-    if (mq == (mqd_t)-1) {
-        perror("[Proxy] mq_open");
-        return_segment_to_pool(shm);
+    /* Unless the client asked for gzip, take one only if it beats sending without copies */
+    request.accept = want_gzip ? GF_ACCEPT_GZIP
+                   : request.range.present || transport->zero_copy ? GF_ACCEPT_IDENTITY
+                   : GF_ACCEPT_SMALLER;
+    request.shm_name[0] = '\0';
+    request.segsize = 0;
+    request.object_id = 0;
+    request.reply_to[0] = '\0';
+    request.ticket = 0;
+    request.deadline_ns = next_deadline();
+    transport_chan_t *ch = transport->acquire(&request);
+    if (ch == NULL) {
         return SERVER_FAILURE;
     }
     
-    if (mq_send(mq, (char*)&request, sizeof(request), 0) == -1) {
-        perror("[Proxy] mq_send");
+    /*
+     * Send the request and wait for its status. A cache that dies first
+     * (or is restarting, so has no queue yet) costs a few resends; the
+     * channel is reusable at once because nobody will write to it.
+     */
+    uint64_t mq_ns = stats_now_ns();
+    mqd_t mq = (mqd_t)-1;
+    pid_t owner = 0;
+    int rc = SHM_WRITER_DEAD;
+    for (int attempt = 0; rc == SHM_WRITER_DEAD; attempt++) {
+        if (attempt > 0) {
+            if (mq != (mqd_t)-1) {
+                mq_close(mq);
+            }
+            if (attempt > CACHE_RETRIES ||
+                (request.deadline_ns != 0 && stats_now_ns() >= request.deadline_ns)) {
+                fprintf(stderr, "[Proxy] No live cache for %s\n", request.path);
+                transport->release(ch, 1);
+                return SERVER_FAILURE;
+            }
+            usleep(1000 << (attempt - 1));
+        }
+        
+        // Open message queue and send request
+        mq = open_cache_queue(request.path, &owner);
+        if (mq == (mqd_t)-1) {
+            continue;
+        }
+        transport->arm(ch, &request, owner);
+        request.sent_ns = stats_now_ns();
+        if (send_request(mq, &request) == -1) {
+            perror("[Proxy] mq_send");
+            mq_close(mq);
+            transport->release(ch, 1);
+            return SERVER_FAILURE;
+        }
+        GF_PROBE3(mq__send, request.path, owner, request.transport);
+        if (attempt == 0) {
+            stats_record(STAGE_MQ_SEND, stats_now_ns() - mq_ns);
+        }
+        
+        // Wait for status and file metadata
+        rc = transport->await(ch, &reply, request.deadline_ns);
+        if (rc == SHM_WRITER_DEAD) {
+            fprintf(stderr, "[Proxy] Cache %d died before answering %s, resending\n", (int)owner, request.path);
+        }
+    }
+    if (rc < 0) {
+        fprintf(stderr, "[Proxy] Timed out waiting for the cache on %s\n", request.path);
         mq_close(mq);
-        return_segment_to_pool(shm);
+        transport->release(ch, 0);
         return SERVER_FAILURE;
     }
-    mq_close(mq);
-    
-    // printf("[Proxy] Thread %ld waiting for cache\n", pthread_self());
-    
-    // Wait for status and file metadata
-    sem_wait(&shm->wsem);
-    
-    // printf("[Proxy] Thread %ld received status: %d\n", pthread_self(), shm->status);
     
     // Check status
-    if (shm->status == 404) {
-        // printf("[Proxy] Thread %ld: file not found\n", pthread_self());
-        gfs_sendheader(ctx, GF_FILE_NOT_FOUND, 0);
-        sem_post(&shm->rsem);
-        return_segment_to_pool(shm);
-        return SERVER_FAILURE;
+    if (reply.status != 200) {
+        mq_close(mq);
+        *status = reply.status == 404 ? GF_FILE_NOT_FOUND : GF_ERROR;
+        counter_add(proxy_counters, reply.status == 404 ? CTR_NOT_FOUND : CTR_ERRORS, 1);
+        gfs_sendheader(ctx, *status, 0);
+        transport->release(ch, 1);
+        return 0;  // header sent; a failure would make gfserver send another
     }
     
-    if (shm->status != 200) {
-        // printf("[Proxy] Thread %ld: error status %d\n", pthread_self(), shm->status);
-        gfs_sendheader(ctx, GF_ERROR, 0);
-        sem_post(&shm->rsem);
-        return_segment_to_pool(shm);
-        return SERVER_FAILURE;
+    proxy_sink_t ps;
+    memset(&ps, 0, sizeof(ps));
+    ps.sink.write = sink_send;
+    ps.sink.sent = sink_sent;
+    ps.sink.request = sink_request;
+    ps.sink.sock = ctx->socket;
+    ps.sink.timeout_ns = cache_timeout_ns;
+    ps.sink.start_ns = start_ns;
+    ps.ctx = ctx;
+    ps.mq = mq;
+    ps.limit = reply.length;
+    if (reply.encoding == GF_ENC_GZIP && !want_gzip) {
+        /* The header promises the plain size the cache reported */
+        ps.inflating = inflateInit2(&ps.zs, 16 + MAX_WBITS) == Z_OK;
+        ps.sink.write = sink_inflate;
+        ps.sink.sock = -1;
+        ps.limit = reply.identity_size;
     }
     
-    // Send OK header to client
-    size_t file_size = shm->file_size;
-    gfs_sendheader(ctx, GF_OK, file_size);
-    // printf("[Proxy] Thread %ld sent header: OK, size=%zu\n", pthread_self(), file_size);
-    
-    sem_post(&shm->rsem);  // Signal cache to start sending data
-    
-    // SIMPLE LOOP - Transfer data chunks
-    size_t bytes_transferred = 0;
-    size_t bytes_sent = 0;
+    *status = GF_OK;
+    counter_add(proxy_counters, CTR_OK, 1);
+    gfs_sendheader(ctx, GF_OK, ps.limit);
+    if ((reply.encoding != GF_ENC_GZIP || want_gzip) &&
+        hand_off(ctx, transport, ch, &request, &reply) == 0) {
+        mq_close(mq);
+        transport->release(ch, 0);
+        return 0;  // the I/O thread counts the body it sends
+    }
+    if (reply.encoding != GF_ENC_GZIP || want_gzip || ps.inflating) {
+        transport->consume(ch, &request, &reply, &ps.sink);
+    }
+    mq_close(mq);
+    transport->release(ch, 0);
+    if (ps.inflating) {
+        inflateEnd(&ps.zs);
+    }
     
-    while (bytes_transferred < file_size) {
-        sem_wait(&shm->wsem);
-        
-        bytes_sent = gfs_send(ctx, shm->data, shm->bytes_written);
-        if (bytes_sent <= 0) {
-            perror("[Proxy] Error sending data to client");
-            break;
+    if (ps.sent == ps.limit) {
+        stats_record(STAGE_LAST_CHUNK, stats_now_ns() - start_ns);
+    } else {
+        /*
+         * The header promised more than we have: the cache died, the deadline
+         * passed or a stripe did not match. gfserver would pad the body with
+         * zeros, so cut the connection instead, as hand_off does, and let the
+         * client see a truncated response rather than a corrupt one.
+         */
+        fprintf(stderr, "[Proxy] %s cut short at %zu of %zu bytes\n", request.path, ps.sent, ps.limit);
+        shutdown(ctx->socket, SHUT_RDWR);
+        ctx->bytes_transferred = ctx->file_len;
+        *status = GF_ERROR;
+        counter_add(proxy_counters, CTR_ERRORS, 1);
+    }
+    stats_record(STAGE_SOCKET_SEND, ps.sink.send_ns);
+    return ps.sent;
+}
+
+/* Answers /__stats: this proxy's counters and segments, then each cache's queue and counters */
+static ssize_t serve_stats(gfcontext_t *ctx) {
+    size_t len = 1 << 16, off = 0;
+    char *buf = malloc(len);
+    int free_count, parked, total;
+    if (buf == NULL) {
+        return SERVER_FAILURE;
+    }
+
+    counters_format(proxy_counters, "proxy", buf, len, &off);
+    shm_pool_usage(&free_count, &parked, &total);
+    counters_printf(buf, len, &off, "proxy.transport %s\n", cache_transport->name);
+    counters_printf(buf, len, &off, "proxy.segments.total %d\nproxy.segments.free %d\nproxy.segments.parked %d\n",
+                    total, free_count, parked);
+    if (max_inflight > 0) {
+        counters_printf(buf, len, &off, "proxy.inflight %u\n", __atomic_load_n(&inflight, __ATOMIC_RELAXED));
+    }
+    if (trace_enabled()) {
+        counters_printf(buf, len, &off, "proxy.trace.dropped %" PRIu64 "\n", trace_dropped());
+    }
+    for (int shard = 0; shard < cache_ring.nshards; shard++) {
+        char name[MAX_SHM_NAME], prefix[32];
+        struct mq_attr attr;
+        shard_queue_name(name, sizeof(name), shard, cache_ring.nshards);
+        snprintf(prefix, sizeof(prefix), "cache.%d", shard);
+        counters_printf(buf, len, &off, "%s.alive %d\n", prefix, shard_owner_alive(name));
+        mqd_t mq = mq_open(name, O_RDONLY | O_NONBLOCK);
+        if (mq != (mqd_t)-1) {
+            if (mq_getattr(mq, &attr) == 0) {
+                counters_printf(buf, len, &off, "%s.queue_depth %ld\n", prefix, attr.mq_curmsgs);
+            }
+            mq_close(mq);
+        }
+        counters_t *counters = counters_open(name);
+        if (counters != NULL) {
+            counters_format(counters, prefix, buf, len, &off);
+            counters_close(counters);
         }
-        
-        bytes_transferred += bytes_sent;
-        /* printf("[Proxy] Thread %ld: sent %zu bytes (total: %zu/%zu)\n",
-            pthread_self(), bytes_sent, bytes_transferred, file_size); */
-        
-        sem_post(&shm->rsem);
     }
-    
-    /* printf("[Proxy] Thread %ld completed: %zu bytes\n", pthread_self(), bytes_transferred); */
-    
-    return_segment_to_pool(shm);
-    return bytes_transferred;
-}
\ No newline at end of file
+
+    gfs_sendheader(ctx, GF_OK, off);
+    ssize_t sent = gfs_send(ctx, buf, off);
+    free(buf);
+    return sent;
+}
+
+/*
+ * Sheds the request outright when this proxy already has max_inflight
+ * requests out, rather than queueing more threads behind a slow cache.
+ */
+ssize_t handle_with_cache(gfcontext_t *ctx, const char *path, void *arg) {
+    gfstatus_t status = GF_ERROR;
+    ssize_t ret;
+    if (strcmp(path, STATS_PATH) == 0) {
+        return serve_stats(ctx);
+    }
+    uint64_t start_ns = stats_now_ns();
+    GF_PROBE1(request__start, path);
+    counter_add(proxy_counters, CTR_REQUESTS, 1);
+    if (max_inflight > 0 && __atomic_add_fetch(&inflight, 1, __ATOMIC_RELAXED) > max_inflight) {
+        __atomic_sub_fetch(&inflight, 1, __ATOMIC_RELAXED);
+        counter_add(proxy_counters, CTR_SHED, 1);
+        fprintf(stderr, "[Proxy] Shedding %s: %u requests in flight\n", path, max_inflight);
+        GF_PROBE3(request__done, path, SERVER_FAILURE, stats_now_ns() - start_ns);
+        trace_record(path, GF_ERROR, 0, start_ns, stats_now_ns());
+        return SERVER_FAILURE;
+    }
+    ret = serve_from_cache(ctx, path, &status);
+    if (max_inflight > 0) {
+        __atomic_sub_fetch(&inflight, 1, __ATOMIC_RELAXED);
+    }
+    if (ret < 0) {
+        counter_add(proxy_counters, CTR_ERRORS, 1);
+    } else {
+        counter_add(proxy_counters, CTR_BYTES, ret);
+    }
+    uint64_t busy_ns = stats_now_ns() - start_ns;
+    counter_add(proxy_counters, CTR_BUSY_NS, busy_ns);
+    GF_PROBE3(request__done, path, ret, busy_ns);
+    if (ret < 0) {
+        status = GF_ERROR;  // gfserver answers with an error header
+    }
+    trace_record(path, status, status == GF_OK ? ctx->file_len : 0, start_ns, start_ns + busy_ns);
+    return ret;
+}
@@ -0,0 +1,357 @@
+#define _GNU_SOURCE  // MSG_NOSIGNAL
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include "steque.h"
+#include "stats.h"
+#include "probes.h"
+#include "io_engine.h"
+
+/* How often every transfer is polled and checked for a stalled or dead cache */
+#define IO_TICK_MS 20
+#define IO_MAX_EVENTS 64
+
+/* One response body on its way from a segment to a client */
+typedef struct xfer {
+    shm_data_t *shm;
+    int sock;
+    int sock_armed;         // sock is in the epoll set, waiting for EPOLLOUT
+    size_t length;          // body bytes the header promised
+    size_t sent;
+    size_t chunk;           // bytes of the chunk being sent, 0 while waiting for one
+    size_t chunk_sent;
+    int held;               // consumed a post from the cache without acknowledging it
+    int cache_done;         // the cache made its last post
+    int dead;               // finished; freed once the current batch of events is handled
+    uint64_t timeout_ns;
+    uint64_t deadline_ns;   // for the cache's next post, 0 for none
+    struct xfer *prev, *next;
+    char path[256];
+} xfer_t;
+
+typedef struct {
+    pthread_t thread;
+    int epfd;
+    int wake_fd;            // bumped when incoming has transfers
+    pthread_mutex_t lock;
+    steque_t incoming;      // handed over by workers, not yet in the epoll set
+    xfer_t *active;         // owned by the thread alone
+} io_thread_t;
+
+enum { XFER_MORE, XFER_DONE, XFER_FAILED };
+
+static io_thread_t *io_threads;
+static int io_nthreads;
+static counters_t *io_counters;
+
+static uint64_t cache_deadline(const xfer_t *x) {
+    return x->timeout_ns ? stats_now_ns() + x->timeout_ns : 0;
+}
+
+/* Waits for the client socket to drain; one-shot so a full socket doesn't spin */
+static int arm_sock(io_thread_t *t, xfer_t *x) {
+    struct epoll_event ev = { .events = EPOLLOUT | EPOLLONESHOT, .data.ptr = x };
+    if (epoll_ctl(t->epfd, x->sock_armed ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, x->sock, &ev) < 0) {
+        perror("[Proxy] epoll_ctl client socket");
+        return -1;
+    }
+    x->sock_armed = 1;
+    return 0;
+}
+
+/*
+ * Moves a transfer as far as it goes without blocking: takes each chunk
+ * the cache posted, sends it, and acknowledges it once it is all out.
+ */
+static int xfer_pump(io_thread_t *t, xfer_t *x) {
+    if (x->shm->event_fd >= 0) {
+        uint64_t count;
+        ssize_t r = read(x->shm->event_fd, &count, sizeof(count));  // the semaphore says what is ready
+        (void)r;
+    }
+    while (x->sent < x->length) {
+        if (x->chunk == 0) {
+            if (shm_reader_poll(x->shm) != 0) {
+                return XFER_MORE;
+            }
+            size_t nbytes = x->shm->bytes_written;
+            if (nbytes == 0) {
+                x->cache_done = 1;  // the cache cut the body short
+                return XFER_FAILED;
+            }
+            x->held = 1;
+            if (nbytes > x->length - x->sent) {
+                return XFER_FAILED;
+            }
+            GF_PROBE3(chunk__consume, x->shm->name, nbytes, 0);
+            x->chunk = nbytes;
+            x->chunk_sent = 0;
+        }
+
+        uint64_t send_ns = stats_now_ns();
+        ssize_t n = send(x->sock, x->shm->data + x->chunk_sent, x->chunk - x->chunk_sent,
+                         MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return arm_sock(t, x) < 0 ? XFER_FAILED : XFER_MORE;
+        }
+        if (n <= 0) {
+            perror("[Proxy] Error sending data to client");
+            return XFER_FAILED;
+        }
+        GF_PROBE2(gfs__send, n, stats_now_ns() - send_ns);
+        x->chunk_sent += n;
+        x->sent += n;
+        if (x->chunk_sent < x->chunk) {
+            continue;
+        }
+
+        x->chunk = 0;
+        x->held = 0;
+        x->cache_done = x->sent == x->length;  // that was its last post
+        shm_reader_done(x->shm);
+        x->deadline_ns = cache_deadline(x);
+    }
+    return XFER_DONE;
+}
+
+/* Pools or parks the segment; the client socket stays open until xfer_close */
+static void xfer_release(io_thread_t *t, xfer_t *x, int rc) {
+    if (rc == XFER_FAILED) {
+        fprintf(stderr, "[Proxy] I/O thread gave up on %s after %zu of %zu bytes\n",
+                x->path, x->sent, x->length);
+    }
+    if (x->shm->event_fd >= 0) {
+        epoll_ctl(t->epfd, EPOLL_CTL_DEL, x->shm->event_fd, NULL);
+    }
+    if (x->cache_done) {
+        return_segment_to_pool(x->shm);
+    } else {
+        shm_abandon_segment(x->shm, x->held);
+    }
+    x->shm = NULL;
+    counter_add(io_counters, CTR_BYTES, x->sent);
+}
+
+/* Closes the client; the struct goes on graveyard */
+static void xfer_close(io_thread_t *t, xfer_t *x, xfer_t **graveyard) {
+    if (x->sock_armed) {
+        epoll_ctl(t->epfd, EPOLL_CTL_DEL, x->sock, NULL);
+    }
+    close(x->sock);
+
+    if (x->prev != NULL) {
+        x->prev->next = x->next;
+    } else {
+        t->active = x->next;
+    }
+    if (x->next != NULL) {
+        x->next->prev = x->prev;
+    }
+    x->dead = 1;
+    x->next = *graveyard;
+    *graveyard = x;
+}
+
+/*
+ * Like gfserver, waits for the client to hang up before closing: closing
+ * with its bytes unread would reset the connection under the body.
+ */
+static int xfer_linger(io_thread_t *t, xfer_t *x) {
+    char buf[256];
+    ssize_t n;
+    while ((n = recv(x->sock, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+    }
+    if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+        return XFER_DONE;
+    }
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLRDHUP, .data.ptr = x };
+    if (epoll_ctl(t->epfd, x->sock_armed ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, x->sock, &ev) < 0) {
+        return XFER_DONE;
+    }
+    x->sock_armed = 1;
+    return XFER_MORE;
+}
+
+static void xfer_step(io_thread_t *t, xfer_t *x, xfer_t **graveyard) {
+    if (x->shm != NULL) {
+        int rc = xfer_pump(t, x);
+        if (rc == XFER_MORE) {
+            return;
+        }
+        xfer_release(t, x, rc);
+        if (rc == XFER_FAILED) {
+            xfer_close(t, x, graveyard);
+            return;
+        }
+        x->deadline_ns = cache_deadline(x);  // bounds the wait for the client too
+    }
+    if (xfer_linger(t, x) != XFER_MORE) {
+        xfer_close(t, x, graveyard);
+    }
+}
+
+/* Puts transfers the workers handed over into this thread's epoll set */
+static void adopt_incoming(io_thread_t *t, xfer_t **graveyard) {
+    uint64_t count;
+    ssize_t r = read(t->wake_fd, &count, sizeof(count));
+    (void)r;
+
+    xfer_t *known = t->active;
+    pthread_mutex_lock(&t->lock);
+    while (!steque_isempty(&t->incoming)) {
+        xfer_t *x = steque_pop(&t->incoming);
+        x->prev = NULL;
+        x->next = t->active;
+        if (t->active != NULL) {
+            t->active->prev = x;
+        }
+        t->active = x;
+        if (x->shm->event_fd >= 0) {
+            struct epoll_event ev = { .events = EPOLLIN, .data.ptr = x };
+            if (epoll_ctl(t->epfd, EPOLL_CTL_ADD, x->shm->event_fd, &ev) < 0) {
+                perror("[Proxy] epoll_ctl segment eventfd");  // the tick still polls it
+            }
+        }
+    }
+    pthread_mutex_unlock(&t->lock);
+    /* The cache may have posted before the eventfd was watched */
+    for (xfer_t *x = t->active, *next; x != known; x = next) {
+        next = x->next;
+        xfer_step(t, x, graveyard);
+    }
+}
+
+/*
+ * Polls every transfer, gives up on those whose cache stalled or died,
+ * and closes clients that never hang up.
+ */
+static void tick(io_thread_t *t, xfer_t **graveyard) {
+    uint64_t now = stats_now_ns();
+    for (xfer_t *x = t->active, *next; x != NULL; x = next) {
+        next = x->next;
+        int expired = x->deadline_ns != 0 && now >= x->deadline_ns;
+        if (x->shm == NULL) {
+            if (expired) {
+                xfer_close(t, x, graveyard);
+            }
+            continue;
+        }
+        int rc = xfer_pump(t, x);
+        if (rc == XFER_MORE && x->chunk == 0) {
+            if (!shm_writer_alive(x->shm)) {
+                fprintf(stderr, "[Proxy] Cache died while sending %s\n", x->path);
+                rc = XFER_FAILED;
+            } else if (expired) {
+                fprintf(stderr, "[Proxy] Timed out waiting for the cache on %s\n", x->path);
+                rc = XFER_FAILED;
+            }
+        }
+        if (rc == XFER_FAILED) {
+            xfer_release(t, x, rc);
+            xfer_close(t, x, graveyard);
+        } else if (rc == XFER_DONE) {
+            xfer_step(t, x, graveyard);
+        }
+    }
+}
+
+static void *io_thread_main(void *arg) {
+    io_thread_t *t = arg;
+    struct epoll_event events[IO_MAX_EVENTS];
+    uint64_t last_tick = stats_now_ns();
+
+    while (1) {
+        int n = epoll_wait(t->epfd, events, IO_MAX_EVENTS, IO_TICK_MS);
+        if (n < 0 && errno != EINTR) {
+            perror("[Proxy] epoll_wait");
+            break;
+        }
+        uint64_t busy_ns = stats_now_ns();
+        xfer_t *graveyard = NULL;
+        for (int i = 0; i < n; i++) {
+            xfer_t *x = events[i].data.ptr;
+            if (x == NULL) {
+                adopt_incoming(t, &graveyard);
+            } else if (!x->dead) {
+                xfer_step(t, x, &graveyard);
+            }
+        }
+        if (busy_ns - last_tick >= IO_TICK_MS * 1000000ull) {
+            tick(t, &graveyard);
+            last_tick = busy_ns;
+        }
+        while (graveyard != NULL) {
+            xfer_t *x = graveyard;
+            graveyard = x->next;
+            free(x);
+        }
+        counter_add(io_counters, CTR_BUSY_NS, stats_now_ns() - busy_ns);
+    }
+    return NULL;
+}
+
+int io_engine_start(int nthreads, counters_t *counters) {
+    io_threads = calloc(nthreads, sizeof(io_thread_t));
+    if (io_threads == NULL) {
+        return -1;
+    }
+    io_counters = counters;
+    for (int i = 0; i < nthreads; i++) {
+        io_thread_t *t = &io_threads[i];
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+        t->epfd = epoll_create1(EPOLL_CLOEXEC);
+        t->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (t->epfd < 0 || t->wake_fd < 0 || epoll_ctl(t->epfd, EPOLL_CTL_ADD, t->wake_fd, &ev) < 0) {
+            perror("[Proxy] I/O thread epoll");
+            return -1;
+        }
+        pthread_mutex_init(&t->lock, NULL);
+        steque_init(&t->incoming);
+        if (pthread_create(&t->thread, NULL, io_thread_main, t) != 0) {
+            perror("[Proxy] pthread_create I/O thread");
+            return -1;
+        }
+        pthread_detach(t->thread);
+        io_nthreads = i + 1;
+    }
+    return 0;
+}
+
+int io_engine_running(void) {
+    return io_nthreads > 0;
+}
+
+int io_engine_stream(shm_data_t *shm, int sock, size_t length, const char *path, uint64_t timeout_ns) {
+    static unsigned int next_thread;
+    if (io_nthreads == 0) {
+        return -1;
+    }
+    xfer_t *x = calloc(1, sizeof(*x));
+    if (x == NULL) {
+        return -1;
+    }
+    x->shm = shm;
+    x->sock = sock;
+    x->length = length;
+    x->timeout_ns = timeout_ns;
+    snprintf(x->path, sizeof(x->path), "%s", path);
+
+    shm_reader_done(shm);  // Signal cache to start sending data
+    x->deadline_ns = cache_deadline(x);
+
+    io_thread_t *t = &io_threads[__atomic_fetch_add(&next_thread, 1, __ATOMIC_RELAXED) % io_nthreads];
+    pthread_mutex_lock(&t->lock);
+    steque_enqueue(&t->incoming, x);
+    pthread_mutex_unlock(&t->lock);
+    uint64_t one = 1;
+    if (write(t->wake_fd, &one, sizeof(one)) < 0) {
+        perror("[Proxy] eventfd write");
+    }
+    return 0;
+}
@@ -0,0 +1,35 @@
+/*
+ Proxy I/O threads that finish responses for the gfserver workers (-E).
+
+ A worker still sends the request and waits for the cache's status. For
+ a 200 it then hands the segment and its own descriptor for the client
+ socket to one of these threads and goes back for the next client. Each
+ thread keeps any number of transfers in one epoll set and wakes when
+ the cache bumps a segment's eventfd (shm_enable_events) or a client
+ socket it had filled drains, so a handful of threads keep many slow
+ clients and cache transfers moving at once. A tick every 20ms polls
+ every transfer, which also covers a cache that could not get the
+ eventfd, and gives up on stalled or dead caches.
+ */
+#ifndef __IO_ENGINE_H__
+#define __IO_ENGINE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "shm_channel.h"
+#include "counters.h"
+
+/* Starts nthreads I/O threads that count what they send into counters; -1 on failure */
+int io_engine_start(int nthreads, counters_t *counters);
+int io_engine_running(void);
+
+/*
+ * Takes over shm, whose 200 status was read and not yet acknowledged,
+ * and sock: acknowledges the status, sends the length body bytes as the
+ * cache posts them, then pools or parks the segment and closes sock.
+ * timeout_ns bounds each wait for the cache (0 for none). Returns -1,
+ * with nothing taken over, if the engine is not running or out of memory.
+ */
+int io_engine_stream(shm_data_t *shm, int sock, size_t length, const char *path, uint64_t timeout_ns);
+
+#endif // __IO_ENGINE_H__
@@ -15,6 +15,7 @@ import glob
 import subprocess
 import time
 import re
+import zlib
 
 # gfclient_download maximum request count
 MAX_GFCLIENT_DOWNLOAD_REQUEST_COUNT = 1000
@@ -56,6 +57,9 @@ WORKLOAD_URL_PATH = 'ipcstress'
 LOCALS_FILENAME = 'locals-ipcstress.txt'
 WORKLOAD_FILENAME = 'workload-ipcstress.txt'
 
+# Written by simplecached -H: "crc32 size key" for every file it serves
+CONTENT_HASH_FILENAME = 'content-hashes.txt'
+
 # Minimum size of the shared memory to use in the tests
 # This value has been know to change from semester to semester
 MIN_SEG_SIZE = 824
@@ -216,7 +220,9 @@ def run_ipcstress(
         '-c',
         f'./{LOCALS_FILENAME}',
         '-t',
-        str(cache_thread_count)
+        str(cache_thread_count),
+        '-H',
+        f'./{CONTENT_HASH_FILENAME}'
     ], cwd=workdir, stdout=subprocess.PIPE, stderr=subprocess.PIPE, bufsize=1, universal_newlines=True
     )
 
@@ -475,8 +481,42 @@ def run_ipcstress(
     return 0
 
 
+def crc32_file(filename: str) -> Tuple[int, int]:
+    """ CRC-32 and size of a file, matching simplecached's content hash. """
+    crc = 0
+    size = 0
+    with open(filename, 'rb') as file:
+        while chunk := file.read(1 << 20):
+            crc = zlib.crc32(chunk, crc)
+            size += len(chunk)
+    return crc, size
+
+
+def verify_content_hashes(workdir: str, hash_filename: str) -> bool:
+    """ Check downloads against the hashes simplecached exported. """
+    expected = {}
+    with open(hash_filename, 'r') as file:
+        for line in file:
+            fields = line.split(' ', 2)
+            if len(fields) == 3:
+                expected[os.path.basename(fields[2].rstrip('\n'))] = (
+                    int(fields[0], 16), int(fields[1]))
+
+    success = True
+    for filename in glob.glob(f'{workdir}/{WORKLOAD_URL_PATH}/*'):
+        want = expected.get(os.path.basename(filename))
+        if want and crc32_file(filename) != want:
+            print(f'Hash mismatch: {os.path.basename(filename)}')
+            success = False
+    return success
+
+
 def verify_results(workdir: str) -> bool:
     """ Verify results, return True on success. """
+    hash_filename = f'{workdir}/{CONTENT_HASH_FILENAME}'
+    if os.path.isfile(hash_filename):
+        return verify_content_hashes(workdir, hash_filename)
+
     filenames = glob.glob(f'{workdir}/{WORKLOAD_URL_PATH}/*')
     result_filename = f'{workdir}/{WORKLOAD_URL_PATH}/sha1sum-result.txt'
     run_sha1sum(filenames, result_filename)
@@ -716,7 +756,9 @@ def run_ipcstress_multi_proxy(
         '-c',
         f'./{LOCALS_FILENAME}',
         '-t',
-        str(cache_thread_count)
+        str(cache_thread_count),
+        '-H',
+        f'./{CONTENT_HASH_FILENAME}'
     ], cwd=workdir, stdout=subprocess.PIPE, stderr=subprocess.PIPE, bufsize=1, universal_newlines=True
     )
 
@@ -0,0 +1,276 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "cache-student.h"
+#include "shard_ring.h"
+#include "miss_filter.h"
+
+#define MISS_FILTER_MAGIC 0x4d495353u
+#define MISS_FILTER_HASHES 7
+#define MISS_FILTER_BITS_PER_KEY 10   // about 1% false positives with 7 hashes
+#define MISS_FILTER_MIN_BITS (1u << 12)
+/* A proxy looks for a missing or replaced filter at most this often */
+#define MISS_FILTER_RETRY_NS (100 * 1000000ull)
+
+typedef struct {
+    uint32_t magic;
+    uint32_t nhashes;
+    uint64_t seq;       // odd while the bits are being rewritten
+    uint64_t nbits;     // a power of two
+    uint64_t bits[];
+} miss_filter_shm_t;
+
+static size_t filter_bytes(uint64_t nbits) {
+    return sizeof(miss_filter_shm_t) + nbits / 8;
+}
+
+static void filter_name(char *buf, size_t len, const char *queue) {
+    snprintf(buf, len, "%s.keys", queue);
+}
+
+/* Decorrelated from the ring position, which also comes from shard_hash */
+static uint64_t filter_hash(const char *key) {
+    uint64_t h = shard_hash(key) ^ 0x9e3779b97f4a7c15ULL;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/* Bit i of a key is h1 + i * h2 (double hashing) */
+#define FILTER_BIT(h, i, nbits) (((uint32_t)(h) + (i) * (((h) >> 32) | 1)) & ((nbits) - 1))
+
+/* Cache side: one filter per process, rewritten only by its reload path */
+static int writer_fd = -1;
+static miss_filter_shm_t *writer;
+static size_t writer_len;
+
+static void writer_mark_busy(miss_filter_shm_t *f) {
+    if ((__atomic_load_n(&f->seq, __ATOMIC_SEQ_CST) & 1) == 0) {
+        __atomic_add_fetch(&f->seq, 1, __ATOMIC_SEQ_CST);
+    }
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static int writer_map(size_t len) {
+    struct stat st;
+    if (fstat(writer_fd, &st) < 0) {
+        return -1;
+    }
+    if ((size_t)st.st_size < len && ftruncate(writer_fd, len) < 0) {
+        perror("[Cache] ftruncate filter");
+        return -1;
+    }
+    if ((size_t)st.st_size > len) {
+        len = st.st_size;  // never shrink: proxies may map all of it
+    }
+    void *map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, writer_fd, 0);
+    if (map == MAP_FAILED) {
+        perror("[Cache] mmap filter");
+        return -1;
+    }
+    if (writer != NULL) {
+        munmap(writer, writer_len);
+    }
+    writer = map;
+    writer_len = len;
+    return 0;
+}
+
+int miss_filter_create(const char *queue) {
+    char name[MAX_SHM_NAME + 16];
+    filter_name(name, sizeof(name), queue);
+    /* Reuse a filter a killed predecessor left, so proxies mapping it see it go busy */
+    writer_fd = shm_open(name, O_RDWR | O_CREAT, 0644);
+    if (writer_fd < 0) {
+        perror("[Cache] shm_open filter");
+        return -1;
+    }
+    if (writer_map(filter_bytes(MISS_FILTER_MIN_BITS)) < 0) {
+        close(writer_fd);
+        writer_fd = -1;
+        return -1;
+    }
+    if (writer->magic != MISS_FILTER_MAGIC) {
+        writer->nhashes = MISS_FILTER_HASHES;
+        writer->nbits = MISS_FILTER_MIN_BITS;
+        writer->seq = 1;
+        __atomic_store_n(&writer->magic, MISS_FILTER_MAGIC, __ATOMIC_SEQ_CST);
+    }
+    writer_mark_busy(writer);
+    return 0;
+}
+
+uint64_t miss_filter_nbits(size_t nkeys) {
+    uint64_t nbits = MISS_FILTER_MIN_BITS;
+    while (nbits < nkeys * MISS_FILTER_BITS_PER_KEY) {
+        nbits <<= 1;
+    }
+    return nbits;
+}
+
+uint32_t miss_filter_nhashes(void) {
+    return MISS_FILTER_HASHES;
+}
+
+/* Sizes the filter for nbits and clears it, leaving it marked busy */
+static int writer_reset(uint64_t nbits) {
+    writer_mark_busy(writer);
+    if (filter_bytes(nbits) > writer_len && writer_map(filter_bytes(nbits)) < 0) {
+        return -1;  // stays busy, so proxies keep asking the cache
+    }
+    writer_mark_busy(writer);  // the mapping may be new
+    writer->nbits = nbits;
+    memset(writer->bits, 0, nbits / 8);
+    return 0;
+}
+
+void miss_filter_begin(size_t nkeys) {
+    if (writer != NULL) {
+        writer_reset(miss_filter_nbits(nkeys));
+    }
+}
+
+void miss_filter_set(uint64_t *bits, uint64_t nbits, const char *key) {
+    uint64_t h = filter_hash(key);
+    for (uint64_t i = 0; i < MISS_FILTER_HASHES; i++) {
+        uint64_t bit = FILTER_BIT(h, i, nbits);
+        bits[bit / 64] |= 1ull << (bit % 64);
+    }
+}
+
+int miss_filter_load(const uint64_t *bits, uint64_t nbits, uint32_t nhashes) {
+    if (nhashes != MISS_FILTER_HASHES || nbits < MISS_FILTER_MIN_BITS || (nbits & (nbits - 1)) != 0) {
+        return -1;
+    }
+    if (writer != NULL && writer_reset(nbits) == 0) {
+        memcpy(writer->bits, bits, nbits / 8);
+        miss_filter_end();
+    }
+    return 0;
+}
+
+void miss_filter_add(const char *key) {
+    if (writer == NULL) {
+        return;
+    }
+    uint64_t h = filter_hash(key);
+    for (uint64_t i = 0; i < writer->nhashes; i++) {
+        uint64_t bit = FILTER_BIT(h, i, writer->nbits);
+        __atomic_or_fetch(&writer->bits[bit / 64], 1ull << (bit % 64), __ATOMIC_RELAXED);
+    }
+}
+
+void miss_filter_end(void) {
+    if (writer != NULL && filter_bytes(writer->nbits) <= writer_len) {
+        __atomic_add_fetch(&writer->seq, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+void miss_filter_remove(const char *queue) {
+    char name[MAX_SHM_NAME + 16];
+    filter_name(name, sizeof(name), queue);
+    if (writer == NULL) {
+        writer_fd = shm_open(name, O_RDWR, 0);
+        if (writer_fd < 0 || writer_map(sizeof(miss_filter_shm_t)) < 0) {
+            shm_unlink(name);
+            return;
+        }
+    }
+    writer_mark_busy(writer);
+    shm_unlink(name);
+}
+
+/*
+ * Proxy side. A mapping is never unmapped because other worker threads
+ * may be reading it; it is only replaced when the cache grew the filter
+ * or a restarted cache created a new one, so the leak is a few pages
+ * per cache restart.
+ */
+typedef struct {
+    const miss_filter_shm_t *map;
+    size_t len;
+    ino_t ino;
+} filter_view_t;
+
+static filter_view_t *views[SHARD_MAX];
+static uint64_t last_refresh_ns[SHARD_MAX];
+static pthread_mutex_t views_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Maps queue's filter again if it was replaced or grew; rate limited */
+static void refresh_view(const char *queue, int slot) {
+    char name[MAX_SHM_NAME + 16];
+    struct stat st;
+
+    pthread_mutex_lock(&views_mutex);
+    uint64_t now = now_ns();
+    if (now - last_refresh_ns[slot] < MISS_FILTER_RETRY_NS && last_refresh_ns[slot] != 0) {
+        pthread_mutex_unlock(&views_mutex);
+        return;
+    }
+    last_refresh_ns[slot] = now;
+
+    filter_name(name, sizeof(name), queue);
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        __atomic_store_n(&views[slot], NULL, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&views_mutex);
+        return;
+    }
+    filter_view_t *old = views[slot];
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(miss_filter_shm_t) &&
+        (old == NULL || old->ino != st.st_ino || old->len < (size_t)st.st_size)) {
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        filter_view_t *view = malloc(sizeof(*view));
+        if (map != MAP_FAILED && view != NULL) {
+            view->map = map;
+            view->len = st.st_size;
+            view->ino = st.st_ino;
+            __atomic_store_n(&views[slot], view, __ATOMIC_RELEASE);
+        } else {
+            free(view);
+        }
+    }
+    close(fd);
+    pthread_mutex_unlock(&views_mutex);
+}
+
+int miss_filter_absent(const char *queue, int slot, const char *key) {
+    if (slot < 0 || slot >= SHARD_MAX) {
+        return 0;
+    }
+    filter_view_t *view = __atomic_load_n(&views[slot], __ATOMIC_ACQUIRE);
+    if (view == NULL) {
+        refresh_view(queue, slot);
+        return 0;
+    }
+    const miss_filter_shm_t *f = view->map;
+    uint64_t seq = __atomic_load_n(&f->seq, __ATOMIC_ACQUIRE);
+    uint64_t nbits = __atomic_load_n(&f->nbits, __ATOMIC_RELAXED);
+    if (f->magic != MISS_FILTER_MAGIC || (seq & 1) || filter_bytes(nbits) > view->len) {
+        refresh_view(queue, slot);  // being rebuilt, replaced or grown
+        return 0;
+    }
+
+    uint64_t h = filter_hash(key);
+    int absent = 0;
+    for (uint64_t i = 0; i < f->nhashes && !absent; i++) {
+        uint64_t bit = FILTER_BIT(h, i, nbits);
+        absent = !(__atomic_load_n(&f->bits[bit / 64], __ATOMIC_RELAXED) & (1ull << (bit % 64)));
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return absent && __atomic_load_n(&f->seq, __ATOMIC_RELAXED) == seq;
+}
@@ -0,0 +1,44 @@
+/*
+ Negative-lookup filter shared by simplecached with its proxies.
+
+ The cache publishes a Bloom filter of the keys it serves in a shm
+ object next to its queue (<queue>.keys). A proxy that finds a key
+ definitely absent answers FILE_NOT_FOUND itself, without a segment,
+ a message or a cache worker. The header carries a sequence number
+ that is odd while the cache rewrites the bits (startup, reload), so
+ a reader that sees it odd or changed falls back to asking the cache.
+ A cache that can fetch misses (-u) publishes no filter.
+ */
+#ifndef __MISS_FILTER_H__
+#define __MISS_FILTER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Cache side: create or take over the filter of queue, marked not ready */
+int miss_filter_create(const char *queue);
+/* Rewrites the filter for nkeys keys; add each with miss_filter_add, then miss_filter_end */
+void miss_filter_begin(size_t nkeys);
+void miss_filter_add(const char *key);
+void miss_filter_end(void);
+/*
+ * Publishes bits built offline with miss_filter_set (mkindex) in one
+ * copy. Returns -1, leaving the filter alone, if they were built with a
+ * different number of hashes.
+ */
+int miss_filter_load(const uint64_t *bits, uint64_t nbits, uint32_t nhashes);
+/* Offline: the filter size for nkeys, and setting key's bits in such a filter */
+uint64_t miss_filter_nbits(size_t nkeys);
+uint32_t miss_filter_nhashes(void);
+void miss_filter_set(uint64_t *bits, uint64_t nbits, const char *key);
+/* Marks the filter not ready and unlinks it (shutdown, or a cache that fetches misses) */
+void miss_filter_remove(const char *queue);
+
+/*
+ * Proxy side: 1 if the cache behind queue definitely has no key, 0 if
+ * it may have it or publishes no usable filter. slot is a small number
+ * unique to the queue (its shard) under which the mapping is kept.
+ */
+int miss_filter_absent(const char *queue, int slot, const char *key);
+
+#endif // __MISS_FILTER_H__
@@ -0,0 +1,322 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include "stats.h"
+#include "shard_ring.h"
+#include "miss_filter.h"
+#include "cache_index.h"
+
+#define USAGE                                                                 \
+"usage:\n"                                                                    \
+"  mkindex [options]\n"                                                       \
+"options:\n"                                                                  \
+"  -c [locals]         Locals file to compile (Default: locals.txt)\n"        \
+"  -o [index]          Index to write, replaced atomically (Default: locals.idx)\n" \
+"  -h                  Show this help message\n"                              \
+"Start simplecached with -c [index] to serve from it.\n"
+
+static struct option gLongOptions[] = {
+  {"cachedir",      required_argument,      NULL,           'c'},
+  {"output",        required_argument,      NULL,           'o'},
+  {"help",          no_argument,            NULL,           'h'},
+  {NULL,            0,                      NULL,            0}
+};
+
+typedef struct {
+    char *key;
+    char *path;
+    size_t size;
+    uint32_t hash;
+    long row;           // in the locals file
+    long same_as;       // an earlier entry with identical bytes, or -1
+    uint32_t file;
+} entry_t;
+
+static entry_t *entries;
+
+static int by_key(const void *a, const void *b) {
+    const entry_t *x = a, *y = b;
+    int cmp = strcmp(x->key, y->key);
+    /* Equal keys keep their order in the locals file */
+    return cmp != 0 ? cmp : (x->row < y->row ? -1 : x->row > y->row);
+}
+
+static int by_content(const void *a, const void *b) {
+    const entry_t *x = &entries[*(const long *)a], *y = &entries[*(const long *)b];
+    if (x->size != y->size) {
+        return x->size < y->size ? -1 : 1;
+    }
+    if (x->hash != y->hash) {
+        return x->hash < y->hash ? -1 : 1;
+    }
+    return *(const long *)a < *(const long *)b ? -1 : 1;
+}
+
+/* Reads "key path" rows; returns the count, or -1 */
+static long read_locals(const char *filename) {
+    FILE *fp = fopen(filename, "r");
+    char *line = NULL;
+    size_t cap = 0;
+    long n = 0, capacity = 1024;
+    int oom = 0;
+
+    if (fp == NULL) {
+        perror(filename);
+        return -1;
+    }
+    entries = malloc(capacity * sizeof(entry_t));
+    while (!oom && getline(&line, &cap, fp) > 0) {
+        char *ptr, *key, *path;
+        line[strcspn(line, "\n")] = '\0';
+        /* The key and path point into one copy of the line, as in simplecache */
+        if (entries == NULL || (ptr = strdup(line)) == NULL) {
+            oom = 1;
+            break;
+        }
+        key = strsep(&ptr, " \t");
+        path = strsep(&ptr, " \t");
+        if (path == NULL) {
+            fprintf(stderr, "Missing path for %s.\n", key);
+            exit(1);
+        }
+        if (n == capacity) {
+            capacity *= 2;
+            if ((entries = realloc(entries, capacity * sizeof(entry_t))) == NULL) {
+                oom = 1;
+                break;
+            }
+        }
+        entries[n].key = key;
+        entries[n].path = path;
+        entries[n].row = n;
+        entries[n].same_as = -1;
+        n++;
+    }
+    free(line);
+    fclose(fp);
+    if (oom || entries == NULL) {
+        fprintf(stderr, "Out of memory reading %s\n", filename);
+        return -1;
+    }
+    return n;
+}
+
+/* Sizes and hashes every file, like a text index at startup; a file that cannot be read is fatal */
+static void hash_files(long n) {
+    for (long i = 0; i < n; i++) {
+        int fd = open(entries[i].path, O_RDONLY);
+        if (fd < 0) {
+            fprintf(stderr, "Unable to open file %s.\n", entries[i].path);
+            exit(1);
+        }
+        if (cache_index_hash_fd(fd, &entries[i].size, &entries[i].hash) < 0) {
+            fprintf(stderr, "Unable to read file %s.\n", entries[i].path);
+            exit(1);
+        }
+        close(fd);
+    }
+}
+
+static int same_file_content(const entry_t *a, const entry_t *b) {
+    int fa, fb, same;
+    if (strcmp(a->path, b->path) == 0) {
+        return 1;
+    }
+    if ((fa = open(a->path, O_RDONLY)) < 0) {
+        return 0;
+    }
+    if ((fb = open(b->path, O_RDONLY)) < 0) {
+        close(fa);
+        return 0;
+    }
+    same = cache_index_same_content(fa, fb, a->size);
+    close(fa);
+    close(fb);
+    return same;
+}
+
+/*
+ * Points entries with identical bytes at the earliest of them, which
+ * becomes their shared file record. Hashes only pick the candidates; the
+ * bytes are compared before anything is merged. Returns the file count.
+ */
+static uint32_t dedup(long n) {
+    long *order = malloc(n * sizeof(long));
+    uint32_t nfiles = 0;
+    long i, j;
+
+    for (i = 0; i < n; i++) {
+        order[i] = i;
+    }
+    qsort(order, n, sizeof(long), by_content);
+    for (i = 0; i < n; i++) {
+        entry_t *e = &entries[order[i]];
+        for (j = i - 1; j >= 0 && entries[order[j]].size == e->size &&
+                        entries[order[j]].hash == e->hash; j--) {
+            /* Compare against the record a candidate already shares, so copies stay O(1) each */
+            long c = entries[order[j]].same_as < 0 ? order[j] : entries[order[j]].same_as;
+            if (same_file_content(&entries[c], e)) {
+                e->same_as = c;
+                break;
+            }
+        }
+    }
+    free(order);
+    for (i = 0; i < n; i++) {
+        entries[i].file = entries[i].same_as < 0 ? nfiles++ : entries[entries[i].same_as].file;
+    }
+    return nfiles;
+}
+
+static uint64_t align8(uint64_t off) {
+    return (off + 7) & ~7ull;
+}
+
+static int write_index(const char *filename, long n, uint32_t nfiles) {
+    cache_index_header_t header = { .nitems = n, .nfiles = nfiles, .nbuckets = 16 };
+    cache_index_bucket_t *buckets;
+    cache_index_item_t *items = calloc(n ? n : 1, sizeof(cache_index_item_t));
+    cache_index_file_t *files = calloc(nfiles ? nfiles : 1, sizeof(cache_index_file_t));
+    uint64_t *filter;
+    static const char pad[8];
+    char tmp[PATH_MAX];
+    uint64_t strings_len = 0;
+    FILE *out;
+    long i;
+    int failed;
+
+    while (header.nbuckets <= 2 * (uint64_t)n) {
+        header.nbuckets *= 2;
+    }
+    buckets = calloc(header.nbuckets, sizeof(cache_index_bucket_t));
+    header.filter_nbits = miss_filter_nbits(n);
+    header.filter_nhashes = miss_filter_nhashes();
+    filter = calloc(header.filter_nbits / 64, sizeof(uint64_t));
+    if (items == NULL || files == NULL || buckets == NULL || filter == NULL) {
+        fprintf(stderr, "Out of memory building %s\n", filename);
+        return -1;
+    }
+    memcpy(header.magic, CACHE_INDEX_MAGIC, sizeof(header.magic));
+    header.buckets_off = align8(sizeof(header));
+    header.items_off = align8(header.buckets_off + header.nbuckets * sizeof(cache_index_bucket_t));
+    header.files_off = align8(header.items_off + n * sizeof(cache_index_item_t));
+    header.filter_off = align8(header.files_off + nfiles * sizeof(cache_index_file_t));
+    header.strings_off = header.filter_off + header.filter_nbits / 8;
+
+    /* Keys in key order, then each distinct file's path */
+    for (i = 0; i < n; i++) {
+        uint64_t h = shard_hash(entries[i].key);
+        uint64_t mask = header.nbuckets - 1, b;
+        items[i].key_off = strings_len;
+        items[i].file = entries[i].file;
+        strings_len += strlen(entries[i].key) + 1;
+        for (b = h & mask; buckets[b].item != 0; b = (b + 1) & mask) {
+        }
+        buckets[b].tag = h >> 32;
+        buckets[b].item = i + 1;
+        miss_filter_set(filter, header.filter_nbits, entries[i].key);
+    }
+    for (i = 0; i < n; i++) {
+        if (entries[i].same_as < 0) {
+            cache_index_file_t *f = &files[entries[i].file];
+            f->path_off = strings_len;
+            f->size = entries[i].size;
+            f->hash = entries[i].hash;
+            strings_len += strlen(entries[i].path) + 1;
+        }
+    }
+    /* A file with no entries still ends in the NUL cache_index_open checks for */
+    if (strings_len == 0) {
+        strings_len = 1;
+    }
+    header.total_len = header.strings_off + strings_len;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", filename);
+    if ((out = fopen(tmp, "w")) == NULL) {
+        perror(tmp);
+        return -1;
+    }
+    fwrite(&header, sizeof(header), 1, out);
+    fwrite(pad, 1, header.buckets_off - sizeof(header), out);
+    fwrite(buckets, sizeof(cache_index_bucket_t), header.nbuckets, out);
+    fwrite(pad, 1, header.items_off - ftell(out), out);
+    fwrite(items, sizeof(cache_index_item_t), n, out);
+    fwrite(pad, 1, header.files_off - ftell(out), out);
+    fwrite(files, sizeof(cache_index_file_t), nfiles, out);
+    fwrite(pad, 1, header.filter_off - ftell(out), out);
+    fwrite(filter, 1, header.filter_nbits / 8, out);
+    for (i = 0; i < n; i++) {
+        fwrite(entries[i].key, 1, strlen(entries[i].key) + 1, out);
+    }
+    for (i = 0; i < n; i++) {
+        if (entries[i].same_as < 0) {
+            fwrite(entries[i].path, 1, strlen(entries[i].path) + 1, out);
+        }
+    }
+    if (n == 0) {
+        fwrite(pad, 1, 1, out);
+    }
+    failed = ferror(out) || ftell(out) != (long)header.total_len;
+    if (fclose(out) != 0 || failed || rename(tmp, filename) < 0) {
+        perror(filename);
+        unlink(tmp);
+        return -1;
+    }
+    free(buckets);
+    free(filter);
+    free(items);
+    free(files);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int option_char;
+    char *locals = "locals.txt";
+    char *output = "locals.idx";
+    uint64_t start_ns = stats_now_ns();
+    long n, i, kept;
+    uint32_t nfiles;
+
+    while ((option_char = getopt_long(argc, argv, "c:o:h", gLongOptions, NULL)) != -1) {
+        switch (option_char) {
+            default:
+                fprintf(stderr, "%s", USAGE);
+                exit(1);
+            case 'h':
+                fprintf(stdout, "%s", USAGE);
+                exit(0);
+            case 'c':
+                locals = optarg;
+                break;
+            case 'o':
+                output = optarg;
+                break;
+        }
+    }
+
+    if ((n = read_locals(locals)) < 0) {
+        exit(1);
+    }
+    /* Sorted by key; a key listed twice keeps its first row */
+    qsort(entries, n, sizeof(entry_t), by_key);
+    for (i = 0, kept = 0; i < n; i++) {
+        if (kept > 0 && strcmp(entries[kept - 1].key, entries[i].key) == 0) {
+            fprintf(stderr, "Duplicate key %s, keeping %s.\n", entries[i].key, entries[kept - 1].path);
+            continue;
+        }
+        entries[kept++] = entries[i];
+    }
+    n = kept;
+    hash_files(n);
+    nfiles = dedup(n);
+    if (write_index(output, n, nfiles) < 0) {
+        exit(1);
+    }
+    printf("Indexed %ld keys (%u distinct files) from %s into %s in %.1f ms\n",
+           n, nfiles, locals, output, (stats_now_ns() - start_ns) / 1e6);
+    return 0;
+}
@@ -0,0 +1,151 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include "numa_place.h"
+
+#define NUMA_MAX_NODE_ID 1024
+
+typedef struct {
+    int id;          // kernel node id, which may be sparse
+    int ncpus;
+    int *cpus;
+} numa_node_t;
+
+static int enabled;
+static int nnodes = 1;
+static numa_node_t nodes[NUMA_MAX_NODES];
+static __thread int thread_node = -1;
+
+/* Parses a sysfs list such as "0-3,8-11" into ids */
+static int parse_list(const char *list, int **ids) {
+    char *copy = strdup(list), *ptr = copy, *tok;
+    int n = 0;
+    while ((tok = strsep(&ptr, ",\n")) != NULL) {
+        if (*tok == '\0') {
+            continue;
+        }
+        int lo, hi;
+        if (sscanf(tok, "%d-%d", &lo, &hi) != 2) {
+            hi = lo = atoi(tok);
+        }
+        for (int id = lo; id <= hi; id++) {
+            *ids = realloc(*ids, (n + 1) * sizeof(int));
+            (*ids)[n++] = id;
+        }
+    }
+    free(copy);
+    return n;
+}
+
+static int read_list(const char *path, int **ids) {
+    char list[4096];
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        return -1;
+    }
+    int n = fgets(list, sizeof(list), f) != NULL ? parse_list(list, ids) : 0;
+    fclose(f);
+    return n;
+}
+
+int numa_place_init(int enable) {
+    enabled = enable;
+    if (!enable) {
+        return 1;
+    }
+
+    /* Walk the online node ids (sparse on some machines); memory-only
+     * nodes have no CPUs to pin to, so they get no entry */
+    int *ids = NULL;
+    int nids = read_list("/sys/devices/system/node/online", &ids);
+    nnodes = 0;
+    for (int i = 0; i < nids && nnodes < NUMA_MAX_NODES; i++) {
+        char path[96];
+        if (ids[i] >= NUMA_MAX_NODE_ID) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", ids[i]);
+        numa_node_t *node = &nodes[nnodes];
+        node->ncpus = read_list(path, &node->cpus);
+        if (node->ncpus > 0) {
+            node->id = ids[i];
+            nnodes++;
+        }
+    }
+    free(ids);
+
+    if (nnodes == 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        nnodes = 1;
+        nodes[0].id = 0;
+        for (int cpu = 0; cpu < online; cpu++) {
+            nodes[0].cpus = realloc(nodes[0].cpus, (cpu + 1) * sizeof(int));
+            nodes[0].cpus[nodes[0].ncpus++] = cpu;
+        }
+    }
+    return nnodes;
+}
+
+int numa_place_enabled(void) {
+    return enabled;
+}
+
+int numa_node_count(void) {
+    return enabled ? nnodes : 1;
+}
+
+int numa_pin_thread(int slot) {
+    if (!enabled) {
+        return 0;
+    }
+    int node = slot % nnodes;
+    numa_node_t *n = &nodes[node];
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(n->cpus[(slot / nnodes) % n->ncpus], &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+        perror("pthread_setaffinity_np");
+    }
+    thread_node = node;
+    return node;
+}
+
+void numa_move_thread(int node) {
+    if (!enabled || node == thread_node || node < 0 || node >= nnodes) {
+        return;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int i = 0; i < nodes[node].ncpus; i++) {
+        CPU_SET(nodes[node].cpus[i], &set);
+    }
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0) {
+        thread_node = node;
+    }
+}
+
+int numa_thread_node(void) {
+    return thread_node < 0 ? 0 : thread_node;
+}
+
+int numa_bind_memory(void *addr, size_t len, int node) {
+    if (!enabled) {
+        return 0;
+    }
+    unsigned long mask[NUMA_MAX_NODE_ID / (8 * sizeof(unsigned long))] = {0};
+    int id = nodes[node].id;
+    mask[id / (8 * sizeof(unsigned long))] |= 1UL << (id % (8 * sizeof(unsigned long)));
+    /* mbind wants a page-aligned start; segments come straight from mmap */
+    if (syscall(SYS_mbind, addr, len, MPOL_BIND, mask, NUMA_MAX_NODE_ID + 1,
+                MPOL_MF_MOVE) < 0) {
+        perror("mbind");
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,40 @@
+/*
+ Optional NUMA placement for the segment pool and worker threads.
+
+ Nodes and their CPUs are read from sysfs (a machine without it is one
+ node holding every online CPU). Worker threads are pinned to a single
+ core, spread round-robin over nodes, and remember their node so the
+ segment pool can hand them segments whose memory is bound to the same
+ node with mbind. Everything is a no-op until numa_place_init(1).
+ */
+#ifndef __NUMA_PLACE_H__
+#define __NUMA_PLACE_H__
+
+#include <stddef.h>
+
+#define NUMA_MAX_NODES 16
+
+/* Discovers the topology when enable is set; returns the node count */
+int numa_place_init(int enable);
+int numa_place_enabled(void);
+int numa_node_count(void);
+
+/*
+ * Pins the calling thread to one core. Slots are spread over nodes first,
+ * so slot i lands on node i % nodes. Returns the thread's node.
+ */
+int numa_pin_thread(int slot);
+
+/* Moves the calling thread onto node's CPUs if it is not already there */
+void numa_move_thread(int node);
+
+/* Node of the calling thread, or 0 if it was never pinned */
+int numa_thread_node(void);
+
+/*
+ * Binds [addr, addr+len) to node (an index as returned by numa_pin_thread,
+ * mapped to the kernel's node id); call before the pages are first touched
+ */
+int numa_bind_memory(void *addr, size_t len, int node);
+
+#endif // __NUMA_PLACE_H__
@@ -0,0 +1,48 @@
+/*
+ Static tracepoints (USDT) on the proxy and cache hot paths.
+
+ With <sys/sdt.h> (systemtap-sdt-dev) each probe is a single nop plus a
+ note in .note.stapsdt, so it costs nothing until perf or bpftrace
+ attaches, e.g.
+
+   bpftrace -e 'usdt:./webproxy_noasan:gfcache:request__done { @[str(arg0)] = hist(arg2); }'
+   perf probe -x ./simplecached_noasan sdt_gfcache:chunk__publish
+
+ Without the header, or with -DGF_NO_PROBES, they compile to nothing.
+ All probes live under the provider gfcache:
+
+   request__start   (path)                          proxy: a client request arrives
+   request__done    (path, bytes, ns)               proxy: response finished, -1 bytes on failure
+   segment__acquire (segment, segsize)              proxy: a segment leaves the pool
+   segment__release (segment, clean)                proxy: pooled (1) or parked (0)
+   mq__send         (path, cache_pid, transport)    proxy: request on a cache's queue
+   mq__receive      (path, transport, queued_ns)    cache: a worker picked a request up
+   lookup__done     (path, status, bytes)           cache: the answer a request gets
+   chunk__publish   (segment, bytes, file_offset)   cache: a chunk is in the segment
+   chunk__consume   (segment, bytes, stripe)        proxy: a chunk was taken out of it
+   gfs__send        (bytes, ns)                     proxy: a send to the client completed;
+                                                    ns is 0 for sendfile/splice transports
+   origin__hedge    (path, origin)                  curl proxy: a slow request was hedged
+ */
+#ifndef __PROBES_H__
+#define __PROBES_H__
+
+#if !defined(GF_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define GF_HAVE_PROBES 1
+#endif
+#endif
+
+#ifdef GF_HAVE_PROBES
+#define GF_PROBE1(name, a) DTRACE_PROBE1(gfcache, name, a)
+#define GF_PROBE2(name, a, b) DTRACE_PROBE2(gfcache, name, a, b)
+#define GF_PROBE3(name, a, b, c) DTRACE_PROBE3(gfcache, name, a, b, c)
+#else
+/* Arguments are still referenced so a probe never leaves a variable unused */
+#define GF_PROBE1(name, a) do { (void)(a); } while (0)
+#define GF_PROBE2(name, a, b) do { (void)(a); (void)(b); } while (0)
+#define GF_PROBE3(name, a, b, c) do { (void)(a); (void)(b); (void)(c); } while (0)
+#endif
+
+#endif // __PROBES_H__
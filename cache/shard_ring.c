@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "cache-student.h"
+#include "shard_ring.h"
+
+/* FNV-1a with a murmur3 finalizer so short, similar paths spread evenly */
+uint64_t shard_hash(const char *key) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (const unsigned char *p = (const unsigned char *)key; *p; p++) {
+        h ^= *p;
+        h *= 0x100000001b3ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static int _pointcmp(const void *a, const void *b) {
+    uint64_t x = ((const shard_point_t *)a)->hash;
+    uint64_t y = ((const shard_point_t *)b)->hash;
+    return x < y ? -1 : x > y;
+}
+
+int shard_ring_init(shard_ring_t *ring, int nshards, int vnodes) {
+    if (nshards < 1 || nshards > SHARD_MAX || vnodes < 1) {
+        return -1;
+    }
+    ring->nshards = nshards;
+    ring->npoints = nshards * vnodes;
+    ring->points = malloc(ring->npoints * sizeof(shard_point_t));
+    if (ring->points == NULL) {
+        return -1;
+    }
+
+    for (int shard = 0; shard < nshards; shard++) {
+        for (int v = 0; v < vnodes; v++) {
+            char label[32];
+            snprintf(label, sizeof(label), "shard-%d-%d", shard, v);
+            ring->points[shard * vnodes + v].hash = shard_hash(label);
+            ring->points[shard * vnodes + v].shard = shard;
+        }
+    }
+    qsort(ring->points, ring->npoints, sizeof(shard_point_t), _pointcmp);
+    return 0;
+}
+
+void shard_ring_destroy(shard_ring_t *ring) {
+    free(ring->points);
+    ring->points = NULL;
+    ring->npoints = 0;
+}
+
+int shard_ring_owners(const shard_ring_t *ring, const char *key, int *owners, int n) {
+    if (n > ring->nshards) {
+        n = ring->nshards;
+    }
+    if (ring->nshards == 1) {
+        owners[0] = 0;
+        return n;
+    }
+
+    /* First point at or after the key's hash, wrapping at the top */
+    uint64_t h = shard_hash(key);
+    int lo = 0, hi = ring->npoints;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (ring->points[mid].hash < h) lo = mid + 1;
+        else hi = mid;
+    }
+
+    int found = 0;
+    for (int i = 0; i < ring->npoints && found < n; i++) {
+        int shard = ring->points[(lo + i) % ring->npoints].shard;
+        int seen = 0;
+        for (int j = 0; j < found; j++) {
+            if (owners[j] == shard) {
+                seen = 1;
+                break;
+            }
+        }
+        if (!seen) {
+            owners[found++] = shard;
+        }
+    }
+    return found;
+}
+
+void shard_queue_name(char *buf, size_t len, int shard, int nshards) {
+    if (nshards <= 1) {
+        snprintf(buf, len, "%s", CACHE_COMMAND_QUEUE);
+    } else {
+        snprintf(buf, len, "%s_%d", CACHE_COMMAND_QUEUE, shard);
+    }
+}
+
+static void owner_name(char *buf, size_t len, const char *queue) {
+    snprintf(buf, len, "%s.owner", queue);
+}
+
+int shard_publish_owner(const char *queue) {
+    char name[MAX_SHM_NAME + 16];
+    pid_t pid = getpid();
+    owner_name(name, sizeof(name), queue);
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("[Cache] shm_open owner");
+        return -1;
+    }
+    int rc = pwrite(fd, &pid, sizeof(pid), 0) == sizeof(pid) ? 0 : -1;
+    close(fd);
+    return rc;
+}
+
+void shard_unpublish_owner(const char *queue) {
+    char name[MAX_SHM_NAME + 16];
+    owner_name(name, sizeof(name), queue);
+    shm_unlink(name);
+}
+
+pid_t shard_owner_pid(const char *queue) {
+    char name[MAX_SHM_NAME + 16];
+    pid_t pid;
+    owner_name(name, sizeof(name), queue);
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        return 0;  // no record (older cache)
+    }
+    ssize_t n = pread(fd, &pid, sizeof(pid), 0);
+    close(fd);
+    return n == sizeof(pid) ? pid : 0;
+}
+
+int shard_owner_alive(const char *queue) {
+    pid_t pid = shard_owner_pid(queue);
+    if (pid == 0) {
+        return 1;  // let mq_open decide
+    }
+    return kill(pid, 0) == 0 || errno != ESRCH;
+}
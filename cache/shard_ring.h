@@ -0,0 +1,56 @@
+/*
+ Consistent hash ring for spreading paths over several simplecached
+ instances. Each shard owns `vnodes` points on a 64-bit ring; a path
+ belongs to the shard owning the first point at or after its hash, and
+ its replicas are the next distinct shards walking clockwise. Adding or
+ removing one shard only moves the keys adjacent to its points.
+ */
+#ifndef __SHARD_RING_H__
+#define __SHARD_RING_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define SHARD_MAX 64
+#define SHARD_DEFAULT_VNODES 160
+
+typedef struct {
+    uint64_t hash;
+    int shard;
+} shard_point_t;
+
+typedef struct {
+    int nshards;
+    int npoints;
+    shard_point_t *points;  // sorted by hash
+} shard_ring_t;
+
+int shard_ring_init(shard_ring_t *ring, int nshards, int vnodes);
+void shard_ring_destroy(shard_ring_t *ring);
+
+/*
+ * Writes up to n distinct shards responsible for key into owners, primary
+ * first. Returns how many were written (min(n, nshards)).
+ */
+int shard_ring_owners(const shard_ring_t *ring, const char *key, int *owners, int n);
+
+/* Command queue of one shard; a single instance keeps CACHE_COMMAND_QUEUE */
+void shard_queue_name(char *buf, size_t len, int shard, int nshards);
+
+uint64_t shard_hash(const char *key);
+
+/*
+ * simplecached records its PID in a small shm object next to its queue
+ * (<queue>.owner). A cache killed with SIGKILL leaves its queue behind,
+ * so proxies check the owner before sending and fail over if it is gone.
+ */
+int shard_publish_owner(const char *queue);
+void shard_unpublish_owner(const char *queue);
+
+/* 0 if the queue's owner is known to be dead, 1 otherwise */
+int shard_owner_alive(const char *queue);
+/* PID recorded for the queue's owner, or 0 if there is no record */
+pid_t shard_owner_pid(const char *queue);
+
+#endif // __SHARD_RING_H__
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE  // sem_clockwait
 #include "shm_channel.h"
 #include <sys/mman.h>
 #include <fcntl.h>
@@ -6,16 +7,182 @@
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <dirent.h>
+#include <stddef.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include "steque.h"
+#include "numa_place.h"
+#include "gfencoding.h"
+#include "probes.h"
 
-// Shared memory queue and synchronization
-steque_t shm_queue;
+// Shared memory queues (one per NUMA node) and synchronization
+steque_t shm_queue[NUMA_MAX_NODES];
 pthread_mutex_t shm_queue_mutex = PTHREAD_MUTEX_INITIALIZER;
 pthread_cond_t shm_queue_cond = PTHREAD_COND_INITIALIZER;
+// Segments given up on, waiting for the cache's last post
+static steque_t shm_abandoned;
+static int shm_pool_total;
+static int shm_events;
+/* Cache side: this thread's copy of the attached segment's eventfd */
+static __thread int notify_fd = -1;
+static __thread shm_data_t *notify_shm;
 
-// Create a pool of shared memory segments
+/*
+ * Segment eventfds travel from the proxy to each cache once, over a
+ * datagram socket the cache binds at startup (SCM_RIGHTS, as in
+ * fd_channel.c). The proxy remembers which caches have a segment's
+ * descriptor; the cache keeps them by segment name.
+ */
+#define SHM_EVENT_PEERS 8
+#define SHM_EVENT_BUCKETS 256
+/* Entries received between sweeps for those of proxies that exited */
+#define SHM_EVENT_SWEEP 64
+
+typedef struct {
+    char name[100];
+    pid_t reader_pid;
+} shm_event_msg_t;
+
+typedef struct shm_event_entry {
+    struct shm_event_entry *next;
+    char name[100];
+    pid_t reader_pid;
+    int fd;
+} shm_event_entry_t;
+
+/* Proxy side: per segment, the caches already holding its eventfd */
+static pid_t (*event_peers)[SHM_EVENT_PEERS];
+/* Cache side */
+static int event_sock = -1;
+static shm_event_entry_t *event_table[SHM_EVENT_BUCKETS];
+static int event_received;
+static pthread_mutex_t event_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* How often a blocked wait checks that the other side is still alive */
+#define SHM_LIVENESS_NS (20 * 1000000ull)
+
+static int pid_alive(pid_t pid) {
+    return pid == 0 || kill(pid, 0) == 0 || errno != ESRCH;
+}
+
+int shm_writer_alive(shm_data_t *shm) {
+    pid_t writer = __atomic_load_n(&shm->writer_pid, __ATOMIC_SEQ_CST);
+    return pid_alive(writer ? writer : shm->owner_pid);
+}
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/*
+ * Waits on sem in SHM_LIVENESS_NS slices until deadline_ns (0: forever).
+ * Returns 0 once posted, -1 on timeout, SHM_WRITER_DEAD once peer_alive fails.
+ */
+static int wait_watching(sem_t *sem, uint64_t deadline_ns, int (*peer_alive)(shm_data_t *), shm_data_t *shm) {
+    while (1) {
+        uint64_t until = monotonic_ns() + SHM_LIVENESS_NS;
+        if (deadline_ns != 0 && deadline_ns < until) {
+            until = deadline_ns;
+        }
+        struct timespec ts = { until / 1000000000ull, until % 1000000000ull };
+        if (sem_clockwait(sem, CLOCK_MONOTONIC, &ts) == 0) {
+            return 0;
+        }
+        if (errno != ETIMEDOUT && errno != EINTR) {
+            return -1;
+        }
+        if (!peer_alive(shm)) {
+            return SHM_WRITER_DEAD;
+        }
+        if (deadline_ns != 0 && monotonic_ns() >= deadline_ns) {
+            return -1;
+        }
+    }
+}
+
+static int reader_alive(shm_data_t *shm) {
+    return pid_alive(shm->reader_pid);
+}
+
+/*
+ * Returns 1 once the cache is done with an abandoned segment. Every post
+ * it made after the proxy gave up is acknowledged so the writer reaches
+ * a wait, sees cancelled and makes its final post. The writer cannot
+ * move past a post until it is acknowledged, so finished read right
+ * after consuming one tells whether that was the last. A segment whose
+ * cache died is free as well.
+ */
+static int reap_segment_locked(shm_data_t *shm) {
+    while (sem_trywait(&shm->wsem) == 0) {
+        if (__atomic_load_n(&shm->finished, __ATOMIC_SEQ_CST)) {
+            return 1;
+        }
+        sem_post(&shm->rsem);
+    }
+    return !shm_writer_alive(shm);  // a dead cache never posts again
+}
+
+static void reap_abandoned_locked(void) {
+    for (int n = steque_size(&shm_abandoned); n > 0; n--) {
+        shm_data_t *shm = steque_pop(&shm_abandoned);
+        if (reap_segment_locked(shm)) {
+            shm->file_size = 0;
+            shm->status = 0;
+            steque_enqueue(&shm_queue[shm->node], shm);
+        } else {
+            steque_enqueue(&shm_abandoned, shm);
+        }
+    }
+}
+
+// Pops from the caller's node first; caller holds shm_queue_mutex
+static shm_data_t *pop_segment_locked(void) {
+    int nnodes = numa_node_count();
+    int local = numa_thread_node();
+    for (int i = 0; i < nnodes; i++) {
+        steque_t *queue = &shm_queue[(local + i) % nnodes];
+        if (!steque_isempty(queue)) {
+            return steque_pop(queue);
+        }
+    }
+    return NULL;
+}
+
+/* Unlinks /shm_<pid>_<i> segments left behind by proxies that were killed */
+static void sweep_stale_segments(void) {
+    DIR *dir = opendir("/dev/shm");
+    struct dirent *ent;
+    if (dir == NULL) {
+        return;
+    }
+    while ((ent = readdir(dir)) != NULL) {
+        int pid, index, end = 0;
+        if (sscanf(ent->d_name, "shm_%d_%d%n", &pid, &index, &end) == 2 &&
+            ent->d_name[end] == '\0' && pid > 0 && !pid_alive(pid)) {
+            char name[300];
+            snprintf(name, sizeof(name), "/%s", ent->d_name);
+            shm_unlink(name);
+        }
+    }
+    closedir(dir);
+}
+
+// Create a pool of shared memory segments, spread round-robin over NUMA nodes
 void create_shm_pool(int nsegments, int segsize) {
+    sweep_stale_segments();
+    if (shm_events && (event_peers = calloc(nsegments, sizeof(*event_peers))) == NULL) {
+        perror("calloc");
+        shm_events = 0;
+    }
     for (int i = 0; i < nsegments; i++) {
+        int node = i % numa_node_count();
         char name[128];
         snprintf(name, sizeof(name), "/shm_%d_%d", getpid(), i);
         // Remove any previous shm with same name
@@ -34,6 +201,8 @@ void create_shm_pool(int nsegments, int segsize) {
         if (shm == MAP_FAILED) {
             perror("mmap");
         }
+        /* Before the first touch, so every page is allocated on node */
+        numa_bind_memory(shm, sizeof(shm_data_t) + segsize, node);
 
         /*Initialize shared memory structure */
         strncpy(shm->name, name, sizeof(shm->name)-1);
@@ -41,38 +210,107 @@ void create_shm_pool(int nsegments, int segsize) {
         shm->segsize = segsize;
         shm->file_size = 0;
         shm->status = 0;
+        shm->node = node;
+        shm->reader_pid = getpid();
+        shm->index = i;
+        shm->event_fd = -1;
+        if (shm_events) {
+            shm->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (shm->event_fd < 0) {
+                perror("eventfd");
+            }
+        }
 
         /* Add to segment pool queue */
         pthread_mutex_lock(&shm_queue_mutex);
-        steque_enqueue(&shm_queue, shm);
+        steque_enqueue(&shm_queue[node], shm);
+        shm_pool_total++;
         pthread_mutex_unlock(&shm_queue_mutex);
     }
 }
 
+void shm_enable_events(void) {
+    shm_events = 1;
+}
+
+void shm_pool_usage(int *free_count, int *parked, int *total) {
+    pthread_mutex_lock(&shm_queue_mutex);
+    *free_count = 0;
+    for (int i = 0; i < numa_node_count(); i++) {
+        *free_count += steque_size(&shm_queue[i]);
+    }
+    *parked = steque_size(&shm_abandoned);
+    *total = shm_pool_total;
+    pthread_mutex_unlock(&shm_queue_mutex);
+}
+
 
 shm_data_t* get_shm_segment(void) {
     shm_data_t *shm;
     pthread_mutex_lock(&shm_queue_mutex);
-    while (steque_isempty(&shm_queue)) {
-        pthread_cond_wait(&shm_queue_cond, &shm_queue_mutex);
+    reap_abandoned_locked();
+    while ((shm = pop_segment_locked()) == NULL) {
+        if (steque_isempty(&shm_abandoned)) {
+            pthread_cond_wait(&shm_queue_cond, &shm_queue_mutex);
+        } else {
+            /* Nobody returns a parked segment; poll them while we wait */
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += 10 * 1000000;
+            if (ts.tv_nsec >= 1000000000) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000;
+            }
+            pthread_cond_timedwait(&shm_queue_cond, &shm_queue_mutex, &ts);
+        }
+        reap_abandoned_locked();
     }
-    shm = steque_pop(&shm_queue);
     pthread_mutex_unlock(&shm_queue_mutex);
 
     // Reset semaphores for reuse
     shm->file_size = 0;
     shm->status = 0;
+    GF_PROBE2(segment__acquire, shm->name, shm->segsize);
+
+    return shm;
+}
 
+shm_data_t* try_get_shm_segment(void) {
+    shm_data_t *shm = NULL;
+    pthread_mutex_lock(&shm_queue_mutex);
+    reap_abandoned_locked();
+    shm = pop_segment_locked();
+    pthread_mutex_unlock(&shm_queue_mutex);
+
+    if (shm != NULL) {
+        shm->file_size = 0;
+        shm->status = 0;
+        GF_PROBE2(segment__acquire, shm->name, shm->segsize);
+    }
     return shm;
 }
 
 // Return a segment to the pool
 void return_segment_to_pool(shm_data_t *shm) {
+    GF_PROBE2(segment__release, shm->name, 1);
     shm->file_size = 0;
     shm->status = 0;
     shm->bytes_written = 0;  
     pthread_mutex_lock(&shm_queue_mutex);
-    steque_enqueue(&shm_queue, shm);
+    steque_enqueue(&shm_queue[shm->node], shm);
+    pthread_mutex_unlock(&shm_queue_mutex);
+    pthread_cond_broadcast(&shm_queue_cond);
+}
+
+void shm_abandon_segment(shm_data_t *shm, int ack) {
+    GF_PROBE2(segment__release, shm->name, 0);
+    __atomic_store_n(&shm->cancelled, 1, __ATOMIC_SEQ_CST);
+    if (ack) {
+        sem_post(&shm->rsem);
+    }
+    pthread_mutex_lock(&shm_queue_mutex);
+    steque_enqueue(&shm_abandoned, shm);
+    reap_abandoned_locked();
     pthread_mutex_unlock(&shm_queue_mutex);
     pthread_cond_broadcast(&shm_queue_cond);
 }
@@ -80,8 +318,8 @@ void return_segment_to_pool(shm_data_t *shm) {
 // Cleanup all shared memory segments
 void cleanup_shm_pool(void) {
     pthread_mutex_lock(&shm_queue_mutex);
-    while (!steque_isempty(&shm_queue)) {
-        shm_data_t *shm = (shm_data_t *)steque_pop(&shm_queue);
+    shm_data_t *shm;
+    while ((shm = pop_segment_locked()) != NULL) {
 
         char name_copy[128];
         strncpy(name_copy, shm->name, sizeof(name_copy)-1);
@@ -89,13 +327,365 @@ void cleanup_shm_pool(void) {
         // Destroy semaphores
         sem_destroy(&shm->rsem);
         sem_destroy(&shm->wsem);
+        if (shm->event_fd >= 0) {
+            close(shm->event_fd);
+        }
         // Unmap and unlink
         munmap(shm, sizeof(shm_data_t) + shm->segsize);
         if (shm_unlink(name_copy) < 0) {
             perror("shm_unlink");
         }
     }
+    shm_pool_total = 0;
     pthread_mutex_unlock(&shm_queue_mutex);
-    steque_destroy(&shm_queue);
+    for (int i = 0; i < NUMA_MAX_NODES; i++) {
+        steque_destroy(&shm_queue[i]);
+    }
     // printf("[Proxy] Cleaned up shared memory pool\n");
+}
+
+void shm_reader_begin(shm_data_t *shm) {
+    shm->cancelled = 0;
+    shm->finished = 0;
+    shm->owner_pid = 0;
+    shm->writer_pid = 0;
+    sem_init(&shm->wsem, 1, 0);
+    sem_init(&shm->rsem, 1, 1);
+}
+
+void shm_reader_wait(shm_data_t *shm) {
+    sem_wait(&shm->wsem);
+}
+
+void shm_reader_done(shm_data_t *shm) {
+    sem_post(&shm->rsem);
+}
+
+int shm_reader_poll(shm_data_t *shm) {
+    return sem_trywait(&shm->wsem);
+}
+
+int shm_reader_wait_until(shm_data_t *shm, uint64_t deadline_ns) {
+    return wait_watching(&shm->wsem, deadline_ns, shm_writer_alive, shm);
+}
+
+/* Abstract namespace, one socket per cache process: nothing to unlink */
+static socklen_t event_addr(struct sockaddr_un *addr, pid_t cache_pid) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    int len = snprintf(addr->sun_path + 1, sizeof(addr->sun_path) - 1, "gfcache-events.%d", (int)cache_pid);
+    return offsetof(struct sockaddr_un, sun_path) + 1 + len;
+}
+
+int shm_listen_events(void) {
+    struct sockaddr_un addr;
+    int sock = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        perror("[Cache] socket");
+        return -1;
+    }
+    if (bind(sock, (struct sockaddr *)&addr, event_addr(&addr, getpid())) < 0) {
+        perror("[Cache] bind event socket");
+        close(sock);
+        return -1;
+    }
+    event_sock = sock;
+    return 0;
+}
+
+void shm_send_events(shm_data_t *shm, pid_t cache_pid) {
+    pid_t *peers;
+    int slot = -1;
+
+    if (shm->event_fd < 0 || cache_pid == 0 || event_peers == NULL) {
+        return;
+    }
+    peers = event_peers[shm->index];
+    for (int i = 0; i < SHM_EVENT_PEERS; i++) {
+        if (peers[i] == cache_pid) {
+            return;
+        }
+        if (peers[i] == 0 && slot < 0) {
+            slot = i;
+        }
+    }
+
+    char control[CMSG_SPACE(sizeof(int))];
+    struct sockaddr_un addr;
+    shm_event_msg_t body = { .reader_pid = shm->reader_pid };
+    struct iovec iov = { &body, sizeof(body) };
+    struct msghdr msg = {0};
+    snprintf(body.name, sizeof(body.name), "%s", shm->name);
+    memset(control, 0, sizeof(control));
+    msg.msg_name = &addr;
+    msg.msg_namelen = event_addr(&addr, cache_pid);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &shm->event_fd, sizeof(int));
+
+    /* Only the request holding the segment sends for it; one socket serves them all */
+    static int sock = -1;
+    if (__atomic_load_n(&sock, __ATOMIC_ACQUIRE) < 0) {
+        int s = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        int expected = -1;
+        if (s < 0) {
+            return;
+        }
+        if (!__atomic_compare_exchange_n(&sock, &expected, s, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            close(s);
+        }
+    }
+    /* Refused by a cache without the socket: it is not remembered, so the next request tries again */
+    if (sendmsg(__atomic_load_n(&sock, __ATOMIC_ACQUIRE), &msg, MSG_NOSIGNAL) < 0) {
+        return;
+    }
+    peers[slot >= 0 ? slot : (int)(cache_pid % SHM_EVENT_PEERS)] = cache_pid;
+}
+
+static unsigned int event_bucket(const char *name) {
+    unsigned int h = 2166136261u;
+    for (; *name; name++) {
+        h = (h ^ (unsigned char)*name) * 16777619u;
+    }
+    return h % SHM_EVENT_BUCKETS;
+}
+
+/* Drops the eventfds of proxies that have exited; lock held */
+static void sweep_event_table(void) {
+    for (int b = 0; b < SHM_EVENT_BUCKETS; b++) {
+        shm_event_entry_t **p = &event_table[b];
+        while (*p != NULL) {
+            shm_event_entry_t *e = *p;
+            if (kill(e->reader_pid, 0) < 0 && errno == ESRCH) {
+                *p = e->next;
+                close(e->fd);
+                free(e);
+            } else {
+                p = &e->next;
+            }
+        }
+    }
+}
+
+/* Files every eventfd waiting on the socket; lock held */
+static void drain_event_socket(void) {
+    while (1) {
+        char control[CMSG_SPACE(sizeof(int))];
+        shm_event_msg_t body;
+        struct iovec iov = { &body, sizeof(body) };
+        struct msghdr msg = {0};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        ssize_t n = recvmsg(event_sock, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("[Cache] recvmsg event socket");
+            }
+            return;
+        }
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        int fd = -1;
+        if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+        }
+        if (fd < 0) {
+            continue;
+        }
+        if (n != sizeof(body)) {
+            close(fd);
+            continue;
+        }
+        body.name[sizeof(body.name) - 1] = '\0';
+
+        shm_event_entry_t **p = &event_table[event_bucket(body.name)];
+        while (*p != NULL && strcmp((*p)->name, body.name) != 0) {
+            p = &(*p)->next;
+        }
+        if (*p == NULL) {
+            if ((*p = calloc(1, sizeof(shm_event_entry_t))) == NULL) {
+                close(fd);
+                continue;
+            }
+            snprintf((*p)->name, sizeof((*p)->name), "%s", body.name);
+            if (++event_received % SHM_EVENT_SWEEP == 0) {
+                sweep_event_table();
+            }
+        } else {
+            close((*p)->fd);  // a resend, or a new proxy reusing the name
+        }
+        if (*p != NULL) {
+            (*p)->fd = fd;
+            (*p)->reader_pid = body.reader_pid;
+        }
+    }
+}
+
+/*
+ * The proxy's eventfd number means nothing here, so use the copy it sent
+ * for this segment. Each attach takes its own duplicate: the table's may
+ * be replaced while a transfer still posts. Without one the proxy's I/O
+ * threads still find each post on their liveness sweep.
+ */
+static void attach_event_fd(shm_data_t *shm) {
+    static int warned;
+    int fd = -1;
+
+    if (event_sock < 0) {
+        return;
+    }
+    pthread_mutex_lock(&event_lock);
+    for (int pass = 0; pass < 2 && fd < 0; pass++) {
+        shm_event_entry_t *e = event_table[event_bucket(shm->name)];
+        while (e != NULL && !(strcmp(e->name, shm->name) == 0 && e->reader_pid == shm->reader_pid)) {
+            e = e->next;
+        }
+        if (e != NULL) {
+            fd = fcntl(e->fd, F_DUPFD_CLOEXEC, 0);
+        } else if (pass == 0) {
+            drain_event_socket();
+        }
+    }
+    pthread_mutex_unlock(&event_lock);
+    if (fd < 0) {
+        if (!__atomic_exchange_n(&warned, 1, __ATOMIC_RELAXED)) {
+            fprintf(stderr, "[Cache] no eventfd for segment %s, proxy will poll\n", shm->name);
+        }
+        return;
+    }
+    if (notify_shm != NULL) {
+        close(notify_fd);
+    }
+    notify_fd = fd;
+    notify_shm = shm;
+}
+
+/* Posts wsem, and wakes the proxy's epoll if the segment has an eventfd */
+static void writer_post(shm_data_t *shm) {
+    sem_post(&shm->wsem);
+    if (notify_shm == shm) {
+        uint64_t one = 1;
+        if (write(notify_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            perror("[Cache] eventfd write");
+        }
+    }
+}
+
+shm_data_t *shm_attach_segment(const char *name, size_t segsize) {
+    int shmfd = shm_open(name, O_RDWR, 0);
+    if (shmfd < 0) {
+        perror("[Cache] shm_open");
+        return NULL;
+    }
+
+    size_t shm_total_size = sizeof(shm_data_t) + segsize;
+    if (ftruncate(shmfd, shm_total_size) == -1) {
+        perror("[Cache] ftruncate");
+        close(shmfd);
+        return NULL;
+    }
+
+    shm_data_t *shm = mmap(NULL, shm_total_size, PROT_READ | PROT_WRITE,
+                           MAP_SHARED, shmfd, 0);
+    close(shmfd);
+    if (shm == MAP_FAILED) {
+        perror("[Cache] mmap");
+        return NULL;
+    }
+    if (shm->event_fd >= 0) {
+        attach_event_fd(shm);
+    }
+    return shm;
+}
+
+void shm_detach_segment(shm_data_t *shm, size_t segsize) {
+    if (notify_shm == shm) {
+        close(notify_fd);
+        notify_fd = -1;
+        notify_shm = NULL;
+    }
+    munmap(shm, sizeof(shm_data_t) + segsize);
+}
+
+int shm_writer_wait(shm_data_t *shm) {
+    if (wait_watching(&shm->rsem, 0, reader_alive, shm) != 0) {
+        return -1;
+    }
+    __atomic_store_n(&shm->writer_pid, getpid(), __ATOMIC_SEQ_CST);
+    return 0;
+}
+
+void shm_write_status(shm_data_t *shm, int status, size_t file_size, uint64_t object_id) {
+    shm_write_encoded_status(shm, status, file_size, object_id, GF_ENC_IDENTITY, file_size);
+}
+
+void shm_write_encoded_status(shm_data_t *shm, int status, size_t file_size, uint64_t object_id,
+                              int encoding, size_t identity_size) {
+    shm->status = status;
+    shm->file_size = file_size;
+    shm->object_id = object_id;
+    shm->encoding = encoding;
+    shm->identity_size = identity_size;
+    if (status != 200 || file_size == 0) {
+        __atomic_store_n(&shm->finished, 1, __ATOMIC_SEQ_CST);  // no chunks follow
+    }
+    writer_post(shm);
+}
+
+size_t shm_write_file(shm_data_t *shm, int fd, off_t offset, size_t len, size_t segsize) {
+    size_t bytes_read = 0;
+
+    while (bytes_read < len) {
+        if (wait_watching(&shm->rsem, 0, reader_alive, shm) != 0) {
+            fprintf(stderr, "[Cache] proxy %d went away mid-transfer\n", (int)shm->reader_pid);
+            break;
+        }
+        if (bytes_read == 0 && shm->file_size < len) {
+            len = shm->file_size;  // the proxy striped the tail elsewhere
+        }
+        if (len == 0 || __atomic_load_n(&shm->cancelled, __ATOMIC_SEQ_CST)) {
+            /* Cancelled: acknowledge so the proxy can pool the segment */
+            shm->bytes_written = 0;
+            __atomic_store_n(&shm->finished, 1, __ATOMIC_SEQ_CST);
+            writer_post(shm);
+            break;
+        }
+
+        size_t bytes_to_read = (len - bytes_read < segsize)
+                               ? (len - bytes_read)
+                               : segsize;
+
+        /* pread straight into the segment: the proxy is not reading it now */
+        ssize_t nbytes = pread(fd, shm->data, bytes_to_read, offset + bytes_read);
+        if (nbytes <= 0) {
+            /* An empty chunk tells the proxy the transfer was cut short */
+            if (nbytes < 0) {
+                perror("[Cache] pread error");
+            } else {
+                fprintf(stderr, "[Cache] file shorter than expected: %zu of %zu bytes at offset %lld\n",
+                        bytes_read, len, (long long)offset);
+            }
+            shm->bytes_written = 0;
+            __atomic_store_n(&shm->finished, 1, __ATOMIC_SEQ_CST);
+            writer_post(shm);
+            break;
+        }
+
+        shm->bytes_written = nbytes;
+        GF_PROBE3(chunk__publish, shm->name, nbytes, offset + bytes_read);
+        bytes_read += nbytes;
+        if (bytes_read == len) {
+            __atomic_store_n(&shm->finished, 1, __ATOMIC_SEQ_CST);
+        }
+
+        writer_post(shm);  // Signal chunk ready
+    }
+    return bytes_read;
 }
\ No newline at end of file
@@ -1,6 +1,8 @@
 // In case you want to implement the shared memory IPC as a library
 // You may use this file. It is optional. It does help with code reuse
 //
+#ifndef __SHM_CHANNEL_H__
+#define __SHM_CHANNEL_H__
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -10,6 +12,7 @@
 #include <sys/stat.h>   
 #include <semaphore.h>
 #include <signal.h> 
+#include <stdint.h>
 #define MAX_CHUNK 8192
 
 typedef struct {
@@ -19,12 +22,96 @@ typedef struct {
     sem_t wsem;  // Signals when cache wrote a chunk
     int segsize; // segment size specified by user
     int status;  
+    int node;    // NUMA node the segment's memory is bound to
     size_t file_size;  // Total file size     
+    uint64_t object_id; // identity of the file version being served (see shm_write_status)
+    int encoding;       // GF_ENC_* of the bytes in data
+    int cancelled;      // set by the proxy when it gave up on the request
+    int finished;       // set by the cache just before its last post for the request
+    pid_t reader_pid;   // proxy that owns the segment
+    pid_t owner_pid;    // cache owning the queue the request went to, 0 if unknown
+    pid_t writer_pid;   // cache process that picked the request up, 0 until then
+    size_t identity_size; // size of the plain file when encoding is not identity
+    int event_fd;       // proxy's eventfd the cache bumps with every wsem post, -1 if none
+    int index;          // in the proxy's pool
     size_t bytes_written;  
     char data[];  // being tansferred  
 } shm_data_t;
 
+/* Prefers a segment on the calling thread's NUMA node, then any other */
 shm_data_t* get_shm_segment(void);
+/* Like get_shm_segment but returns NULL instead of waiting for a free segment */
+shm_data_t* try_get_shm_segment(void);
 void return_segment_to_pool(shm_data_t *shm);
+/*
+ * For a segment whose request the proxy gave up on while the cache may
+ * still hold it. Marks it cancelled and parks it until the cache has
+ * made its last post, then it goes back to the pool. ack says the proxy
+ * consumed a status or chunk it has not acknowledged with shm_reader_done.
+ */
+void shm_abandon_segment(shm_data_t *shm, int ack);
 void create_shm_pool(int nsegments, int segsize);
+/*
+ * Call before create_shm_pool to give every segment an eventfd. The cache
+ * writes it after each post, so a proxy thread can epoll many segments
+ * instead of blocking on one semaphore (see io_engine.h).
+ */
+void shm_enable_events(void);
+/*
+ * Proxy side: passes the segment's eventfd to the cache process
+ * cache_pid unless it already has it, before the first request that
+ * segment carries there. Caches that cannot take it are asked again.
+ */
+void shm_send_events(shm_data_t *shm, pid_t cache_pid);
+/* Cache side, before taking requests: binds the socket shm_send_events sends to */
+int shm_listen_events(void);
+/* Segments free in the pool, parked by shm_abandon_segment, and created */
+void shm_pool_usage(int *free_count, int *parked, int *total);
 void cleanup_shm_pool(void);
+
+/*
+ * Chunk handshake shared by the proxy (reader) and the cache (writer).
+ * The proxy calls shm_reader_begin before publishing the request; the
+ * cache waits for rsem, writes status or a chunk, then posts wsem.
+ */
+void shm_reader_begin(shm_data_t *shm);
+void shm_reader_wait(shm_data_t *shm);
+void shm_reader_done(shm_data_t *shm);
+/* Non-blocking shm_reader_wait: returns 0 if a chunk or status is ready */
+int shm_reader_poll(shm_data_t *shm);
+/*
+ * shm_reader_wait up to a CLOCK_MONOTONIC deadline (0 waits forever).
+ * Returns -1 on timeout, or SHM_WRITER_DEAD as soon as the cache process
+ * serving the request (or owning the queue it is still sitting in) is gone.
+ */
+#define SHM_WRITER_DEAD (-2)
+int shm_reader_wait_until(shm_data_t *shm, uint64_t deadline_ns);
+/* 0 once the process that would fill the segment is known to be dead */
+int shm_writer_alive(shm_data_t *shm);
+
+/* Cache side: map a segment named in a request, and unmap it when done */
+shm_data_t *shm_attach_segment(const char *name, size_t segsize);
+void shm_detach_segment(shm_data_t *shm, size_t segsize);
+
+/* Claims the segment for this process; -1 if the proxy that owns it is gone */
+int shm_writer_wait(shm_data_t *shm);
+/*
+ * Publishes the status for a request. object_id names the exact file
+ * version served so stripes of one response can insist on the same one.
+ */
+void shm_write_status(shm_data_t *shm, int status, size_t file_size, uint64_t object_id);
+/* Same, for a body of file_size encoded bytes that decode to identity_size */
+void shm_write_encoded_status(shm_data_t *shm, int status, size_t file_size, uint64_t object_id,
+                              int encoding, size_t identity_size);
+
+/*
+ * Streams len bytes of fd starting at offset through the segment, one
+ * segsize chunk per handshake. The proxy may lower file_size when it
+ * acknowledges the status to keep only the head of the range here and
+ * stripe the rest over other segments; lowering it to 0 cancels the
+ * transfer, acknowledged by one empty chunk, and so does setting cancelled
+ * at any point. Stops early if the proxy dies. Returns the number of bytes written.
+ */
+size_t shm_write_file(shm_data_t *shm, int fd, off_t offset, size_t len, size_t segsize);
+
+#endif // __SHM_CHANNEL_H__
@@ -0,0 +1,368 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <mqueue.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include "cache-student.h"
+#include "shm_channel.h"
+#include "stats.h"
+#include "transport.h"
+
+/*
+ * Microbenchmark for the proxy/cache transports in isolation. The parent
+ * plays the proxy (channel, request over a private message queue, body
+ * into a sink), a forked child plays simplecached (attach, publish from
+ * a page-cached file), both through transport.h exactly as the real
+ * pair does. Every combination of the swept parameters is run and
+ * reported as one row; the segment sweep only applies to sem, so the
+ * other transports run once per row of the rest and show segsize 0.
+ * Zero-copy transports send to /dev/null, the others copy each chunk
+ * out like the proxy would to its socket buffer.
+ */
+
+#define USAGE                                                                         \
+"usage:\n"                                                                            \
+"  shmbench [options]\n"                                                              \
+"options:\n"                                                                          \
+"  -x [transports]     Transports to sweep: sem, fd, pipe, stream (Default: sem)\n"   \
+"  -z [sizes]          Segment sizes to sweep (Default: 5712,65536,1048576)\n"        \
+"  -n [counts]         Segment counts to sweep (Default: 8)\n"                        \
+"  -c [concurrency]    Concurrent transfers to sweep (Default: 1,4)\n"                \
+"  -f [file_sizes]     File sizes to sweep (Default: 4096,1048576,16777216)\n"       \
+"  -r [transfers]      Transfers per configuration (Default: 200)\n"                  \
+"  -m [min_gbps]       Exit non-zero if any configuration is slower than this\n"      \
+"  -h                  Show this help message\n"
+
+static struct option gLongOptions[] = {
+  {"transports",     required_argument,      NULL,           'x'},
+  {"segment-sizes",  required_argument,      NULL,           'z'},
+  {"segment-counts", required_argument,      NULL,           'n'},
+  {"concurrency",    required_argument,      NULL,           'c'},
+  {"file-sizes",     required_argument,      NULL,           'f'},
+  {"transfers",      required_argument,      NULL,           'r'},
+  {"min-gbps",       required_argument,      NULL,           'm'},
+  {"help",           no_argument,            NULL,           'h'},
+  {NULL,             0,                      NULL,            0}
+};
+
+#define MAX_SWEEP 16
+
+typedef struct {
+    size_t values[MAX_SWEEP];
+    int n;
+} sweep_t;
+
+typedef struct {
+    const transport_ops_t *transport;
+    size_t segsize;
+    size_t file_size;
+    int transfers;
+    char queue[MAX_SHM_NAME];
+    int next;                  // next transfer number, shared by consumers
+    int errors;
+    stats_hist_t chunk_latency;
+} bench_t;
+
+/* Where a consumer puts the body; chunk latency is the gap between deliveries */
+typedef struct {
+    transport_sink_t sink;
+    char *buf;
+    size_t len;
+    uint64_t ready_ns;
+} bench_sink_t;
+
+static bench_t bench;
+static int src_fd = -1;
+
+static void parse_sweep(const char *arg, sweep_t *sweep) {
+    char *copy = strdup(arg), *ptr = copy, *tok;
+    sweep->n = 0;
+    while ((tok = strsep(&ptr, ",")) != NULL && sweep->n < MAX_SWEEP) {
+        if (*tok != '\0') {
+            sweep->values[sweep->n++] = strtoull(tok, NULL, 10);
+        }
+    }
+    free(copy);
+    if (sweep->n == 0) {
+        fprintf(stderr, "Empty sweep list: %s\n", arg);
+        exit(1);
+    }
+}
+
+static size_t sweep_max(const sweep_t *sweep) {
+    size_t max = 0;
+    for (int i = 0; i < sweep->n; i++) {
+        if (sweep->values[i] > max) max = sweep->values[i];
+    }
+    return max;
+}
+
+/* Producer side: the same steps cacheWorker takes for a hit */
+static void *producer(void *arg) {
+    mqd_t mq = *(mqd_t *)arg;
+    cache_req_t request;
+
+    while (1) {
+        if (mq_receive(mq, (char *)&request, sizeof(request), NULL) <= 0) {
+            perror("[Bench] mq_receive");
+            continue;
+        }
+        if (request.path[0] == '\0') {
+            return NULL;
+        }
+        const transport_ops_t *transport = transport_for(&request);
+        void *chan = transport ? transport->attach(&request) : NULL;
+        if (chan == NULL) {
+            continue;
+        }
+        transport_reply_t reply = { 200, GF_ENC_IDENTITY, 0, bench.file_size, bench.file_size, 1 };
+        transport->publish(chan, &request, &reply, src_fd);
+    }
+}
+
+static void sink_delivered(bench_sink_t *bs) {
+    uint64_t now = stats_now_ns();
+    stats_hist_record(&bench.chunk_latency, now - bs->ready_ns);
+    bs->ready_ns = now;
+}
+
+static ssize_t sink_copy(transport_sink_t *sink, const void *buf, size_t len) {
+    bench_sink_t *bs = (bench_sink_t *)sink;
+    sink_delivered(bs);
+    for (size_t done = 0; done < len; done += bs->len) {
+        memcpy(bs->buf, (const char *)buf + done, len - done < bs->len ? len - done : bs->len);
+    }
+    return len;
+}
+
+static void sink_sent(transport_sink_t *sink, size_t len) {
+    sink_delivered((bench_sink_t *)sink);
+}
+
+/* Consumer side: the same steps handle_with_cache takes, minus the socket */
+static void *consumer(void *arg) {
+    const transport_ops_t *transport = bench.transport;
+    pid_t child = *(pid_t *)arg;
+    bench_sink_t bs = {0};
+    bs.len = bench.segsize > 65536 ? bench.segsize : 65536;
+    bs.buf = malloc(bs.len);
+    bs.sink.write = sink_copy;
+    bs.sink.sent = sink_sent;
+    bs.sink.sock = transport->zero_copy ? open("/dev/null", O_WRONLY | O_CLOEXEC) : -1;
+    mqd_t mq = mq_open(bench.queue, O_WRONLY);
+    if (mq == (mqd_t)-1 || bs.buf == NULL) {
+        perror("[Bench] mq_open");
+        exit(1);
+    }
+
+    while (__atomic_fetch_add(&bench.next, 1, __ATOMIC_RELAXED) < bench.transfers) {
+        cache_req_t request = {0};
+        strcpy(request.path, "/shmbench");
+        transport_chan_t *ch = transport->acquire(&request);
+        if (ch == NULL) {
+            exit(1);
+        }
+
+        transport->arm(ch, &request, child);
+        request.sent_ns = bs.sink.start_ns = stats_now_ns();
+        if (mq_send(mq, (char *)&request, sizeof(request), 0) < 0) {
+            perror("[Bench] mq_send");
+            exit(1);
+        }
+
+        transport_reply_t reply;
+        if (transport->await(ch, &reply, 0) != 0 || reply.status != 200) {
+            __atomic_fetch_add(&bench.errors, 1, __ATOMIC_RELAXED);
+            transport->release(ch, 1);
+            continue;
+        }
+        bs.ready_ns = stats_now_ns();
+        ssize_t received = transport->consume(ch, &request, &reply, &bs.sink);
+        if (received != (ssize_t)bench.file_size) {
+            __atomic_fetch_add(&bench.errors, 1, __ATOMIC_RELAXED);
+        }
+        transport->release(ch, 0);
+    }
+
+    if (bs.sink.sock >= 0) {
+        close(bs.sink.sock);
+    }
+    mq_close(mq);
+    free(bs.buf);
+    return NULL;
+}
+
+static double run_config(const transport_ops_t *transport, size_t segsize, int nsegments,
+                         int concurrency, size_t file_size, int transfers) {
+    memset(&bench, 0, sizeof(bench));
+    bench.transport = transport;
+    bench.segsize = segsize;
+    bench.file_size = file_size;
+    bench.transfers = transfers;
+    snprintf(bench.queue, sizeof(bench.queue), "/shmbench_q_%d", getpid());
+
+    struct mq_attr attr = {0};
+    attr.mq_maxmsg = 10;
+    attr.mq_msgsize = sizeof(cache_req_t);
+    mq_unlink(bench.queue);
+    mqd_t mq = mq_open(bench.queue, O_CREAT | O_RDWR, 0600, &attr);
+    if (mq == (mqd_t)-1) {
+        perror("[Bench] mq_open");
+        exit(1);
+    }
+
+    transport->open(nsegments, segsize);
+
+    pid_t child = fork();
+    if (child == 0) {
+        pthread_t threads[concurrency];
+        for (int i = 0; i < concurrency; i++) {
+            pthread_create(&threads[i], NULL, producer, &mq);
+        }
+        for (int i = 0; i < concurrency; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        _exit(0);
+    }
+
+    uint64_t start_ns = stats_now_ns();
+    pthread_t threads[concurrency];
+    for (int i = 0; i < concurrency; i++) {
+        pthread_create(&threads[i], NULL, consumer, &child);
+    }
+    for (int i = 0; i < concurrency; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    double elapsed = (stats_now_ns() - start_ns) / 1e9;
+
+    cache_req_t stop = {0};
+    for (int i = 0; i < concurrency; i++) {
+        mq_send(mq, (char *)&stop, sizeof(stop), 0);
+    }
+    waitpid(child, NULL, 0);
+    transport->close();
+    mq_close(mq);
+    mq_unlink(bench.queue);
+
+    double gbps = (double)file_size * transfers / elapsed / 1e9;
+    printf("%-9s %10zu %6d %6d %12zu %9.3f %10.1f %10.1f %10.1f %6d\n",
+           transport->name, segsize, nsegments, concurrency, file_size, gbps, transfers / elapsed,
+           stats_hist_percentile(&bench.chunk_latency, 50.0) / 1e3,
+           stats_hist_percentile(&bench.chunk_latency, 99.0) / 1e3,
+           bench.errors);
+    return bench.errors ? 0.0 : gbps;
+}
+
+int main(int argc, char **argv) {
+    int option_char;
+    sweep_t segsizes, counts, concurrency, file_sizes;
+    const transport_ops_t *transports[MAX_SWEEP] = { transport_find("sem") };
+    int ntransports = 1;
+    int transfers = 200;
+    double min_gbps = 0;
+
+    parse_sweep("5712,65536,1048576", &segsizes);
+    parse_sweep("8", &counts);
+    parse_sweep("1,4", &concurrency);
+    parse_sweep("4096,1048576,16777216", &file_sizes);
+
+    while ((option_char = getopt_long(argc, argv, "x:z:n:c:f:r:m:h", gLongOptions, NULL)) != -1) {
+        switch (option_char) {
+            default:
+                fprintf(stderr, "%s", USAGE);
+                exit(1);
+            case 'h':
+                fprintf(stdout, "%s", USAGE);
+                exit(0);
+            case 'x': {
+                char *copy = strdup(optarg), *ptr = copy, *tok;
+                ntransports = 0;
+                while ((tok = strsep(&ptr, ",")) != NULL && ntransports < MAX_SWEEP) {
+                    if (*tok == '\0') {
+                        continue;
+                    }
+                    if ((transports[ntransports++] = transport_find(tok)) == NULL) {
+                        fprintf(stderr, "Unknown transport %s\n", tok);
+                        exit(1);
+                    }
+                }
+                free(copy);
+                if (ntransports == 0) {
+                    fprintf(stderr, "Empty transport list: %s\n", optarg);
+                    exit(1);
+                }
+                break;
+            }
+            case 'z':
+                parse_sweep(optarg, &segsizes);
+                break;
+            case 'n':
+                parse_sweep(optarg, &counts);
+                break;
+            case 'c':
+                parse_sweep(optarg, &concurrency);
+                break;
+            case 'f':
+                parse_sweep(optarg, &file_sizes);
+                break;
+            case 'r':
+                transfers = atoi(optarg);
+                break;
+            case 'm':
+                min_gbps = atof(optarg);
+                break;
+        }
+    }
+
+    /* One unlinked source file, read through the page cache like simplecached does */
+    char tmpl[] = "/tmp/shmbench_XXXXXX";
+    src_fd = mkstemp(tmpl);
+    if (src_fd < 0) {
+        perror("mkstemp");
+        exit(1);
+    }
+    unlink(tmpl);
+    size_t max_file = sweep_max(&file_sizes);
+    char block[65536];
+    memset(block, 0xa5, sizeof(block));
+    for (size_t written = 0; written < max_file; written += sizeof(block)) {
+        if (write(src_fd, block, sizeof(block)) != sizeof(block)) {
+            perror("write");
+            exit(1);
+        }
+    }
+
+    /* One segment per transfer: the stripes would need a second queue of workers */
+    stripe_max = 1;
+    /* The child exiting mid-transfer must fail the row, not kill the bench */
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("%-9s %10s %6s %6s %12s %9s %10s %10s %10s %6s\n", "transport", "segsize", "nseg", "conc",
+           "file_size", "GB/s", "xfers/s", "chunk_p50", "chunk_p99", "errors");
+
+    int failed = 0;
+    for (int x = 0; x < ntransports; x++)
+        for (int z = 0; z < segsizes.n; z++)
+            for (int n = 0; n < counts.n; n++)
+                for (int c = 0; c < concurrency.n; c++)
+                    for (int f = 0; f < file_sizes.n; f++) {
+                        int segmented = strcmp(transports[x]->name, "sem") == 0;
+                        if (!segmented && z > 0) {
+                            continue;
+                        }
+                        double gbps = run_config(transports[x], segmented ? segsizes.values[z] : 0,
+                                                 counts.values[n], concurrency.values[c],
+                                                 file_sizes.values[f], transfers);
+                        if (gbps <= min_gbps) {
+                            failed = 1;
+                        }
+                    }
+
+    close(src_fd);
+    return failed;
+}
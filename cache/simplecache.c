@@ -10,9 +10,16 @@
 #include <sys/signal.h>
 #include <printf.h>
 #include <curl/curl.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <zlib.h>
 
 #include "gfserver.h"
 #include "cache-student.h"
+#include "cache_index.h"
+#include "fd_cache.h"
 
 
 #define MAX_KEYLEN 1020 //KEYLEN definition
@@ -22,13 +29,44 @@
 #endif // CACHE_FAILURE
 
 typedef struct{
-	int fildes;
+	int fildes;		// -1 in a lazy index, which opens path through the fd cache
+	int shared;		// fildes belongs to an earlier item with the same content
+	size_t size;
+	uint32_t hash;		// crc32 of the content
+	unsigned short path;	// offset of the path in key, after the key's NUL
 	char key[MAX_KEYLEN];
 } item_t;
 //Item definition
 
-static int nitems;
-static item_t *items;
+typedef struct{
+	int nitems;
+	item_t *items;
+	int lazy;		// items are opened on first use (simplecache_set_fd_limit)
+	cache_index_t mapped;	// precompiled by mkindex instead of items, if mapped.header
+} index_t;
+//Index definition: a sorted, immutable snapshot of locals.txt
+
+static index_t *current;
+static int (*key_filter)(const char *key);
+static long fd_limit = -1;	// -1: a text index opens every file up front
+
+/* Entries of the fd cache this thread holds until simplecache_quiescent */
+static __thread fd_cache_entry_t **held;
+static __thread int nheld, held_cap;
+
+/*
+ * RCU-style readers. A worker thread announces the epoch it entered at
+ * before it loads the index, and goes offline (0) in simplecache_quiescent
+ * once it no longer uses any fd it was handed. A reload swaps the index,
+ * bumps the epoch and frees the old index only when no reader is still
+ * inside an older epoch.
+ */
+#define MAX_READERS 256
+static uint64_t global_epoch = 1;
+static uint64_t reader_epoch[MAX_READERS];
+static int nreaders;
+static __thread int reader_slot = -1;
+static pthread_mutex_t reload_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 static int _itemcmp(const void *a, const void *b){
 	return strcmp(((item_t*) a)->key,((item_t*) b)->key);
@@ -36,15 +74,108 @@ static int _itemcmp(const void *a, const void *b){
 
 extern unsigned long int cache_delay;
 
+void simplecache_set_filter(int (*keep)(const char *key)){
+	key_filter = keep;
+}
+
+void simplecache_set_fd_limit(long max_fds){
+	fd_limit = max_fds;
+}
 
-int simplecache_init(char *filename){
+static void _index_free(index_t *index){
+	int i;
+	if (index->mapped.header != NULL) {
+		cache_index_close(&index->mapped);
+		free(index);
+		return;
+	}
+	for(i = 0; i < index->nitems; i++)
+		if (!index->items[i].shared && index->items[i].fildes >= 0)
+			close(index->items[i].fildes);
+
+	free(index->items);
+	free(index);
+}
+
+/* Fills in size and content hash of an item whose file was just opened */
+static int _item_hash(item_t *item){
+	return cache_index_hash_fd(item->fildes, &item->size, &item->hash);
+}
+
+static int _contentcmp(const void *a, const void *b){
+	const item_t *x = *(item_t * const *)a, *y = *(item_t * const *)b;
+	if (x->size != y->size)
+		return x->size < y->size ? -1 : 1;
+	if (x->hash != y->hash)
+		return x->hash < y->hash ? -1 : 1;
+	return x < y ? -1 : (x > y);
+}
+
+/*
+ * Points items with identical bytes at one descriptor, so they share a
+ * single open file and one copy in the page cache. Hashes only pick the
+ * candidates; the bytes are compared before anything is merged.
+ */
+static int _index_dedup(item_t *items, int nitems){
+	item_t **order = malloc(nitems * sizeof(item_t *));
+	int i, j, merged = 0;
+
+	for (i = 0; i < nitems; i++)
+		order[i] = &items[i];
+	qsort(order, nitems, sizeof(item_t *), _contentcmp);
+	for (i = 0; i < nitems; i++) {
+		for (j = i - 1; j >= 0 && order[j]->size == order[i]->size &&
+		                order[j]->hash == order[i]->hash; j--) {
+			if (!order[j]->shared && cache_index_same_content(order[j]->fildes, order[i]->fildes, order[i]->size)) {
+				close(order[i]->fildes);
+				order[i]->fildes = order[j]->fildes;
+				order[i]->shared = 1;
+				merged++;
+				break;
+			}
+		}
+	}
+	free(order);
+	return merged;
+}
+
+/*
+ * Reads filename into a new index. At startup a missing file is fatal as
+ * before; on reload (strict == 0) it is skipped so a live daemon keeps
+ * serving everything else. With an fd limit nothing is opened here:
+ * files go through the fd cache on first lookup, and a missing one is
+ * only found then. An index built by mkindex is mapped instead and
+ * always opened that way; the key filter is applied on lookup there,
+ * so startup costs the same for any number of entries.
+ */
+static index_t *_index_build(char *filename, int strict){
 	FILE *filelist;
 	int capacity = 14;
 	char *path, *ptr;
+	index_t *index;
+	item_t *items;
+	int nitems;
+
+	index = calloc(1, sizeof(index_t));
+	switch (cache_index_open(filename, &index->mapped)) {
+		case 1:
+			index->nitems = index->mapped.header->nitems;
+			index->lazy = 1;
+			return index;
+		case -1:
+			free(index);
+			fprintf(stderr, "Unable to map index in simplecache_init.\n");
+			if (strict)
+				exit(CACHE_FAILURE);
+			return NULL;
+	}
 
 	if( NULL == (filelist = fopen(filename, "r"))){
 		fprintf(stderr, "Unable to open file in simplecache_init.\n");
-		exit(CACHE_FAILURE);
+		free(index);
+		if (strict)
+			exit(CACHE_FAILURE);
+		return NULL;
 	}
 
 	items = (item_t*) malloc(capacity * sizeof(item_t));
@@ -58,9 +189,28 @@ int simplecache_init(char *filename){
 		strsep(&ptr, " \t"); 		/* The key is first */
 		path = strsep(&ptr, " \t"); /* The path second */
 
-		if( 0 > (items[nitems].fildes = open(path, O_RDONLY))){
-			fprintf(stderr, "Unable to open file %s.\n", path);
-			exit(CACHE_FAILURE);
+		if (key_filter != NULL && !key_filter(items[nitems].key))
+			continue;
+
+		items[nitems].shared = 0;
+		if (path != NULL && fd_limit >= 0) {
+			/* Opened on first lookup, through the fd cache */
+			items[nitems].fildes = -1;
+			items[nitems].size = 0;
+			items[nitems].hash = 0;
+			items[nitems].path = path - items[nitems].key;
+			index->lazy = 1;
+		} else if( path == NULL || 0 > (items[nitems].fildes = open(path, O_RDONLY))){
+			fprintf(stderr, "Unable to open file %s.\n", path ? path : "(missing)");
+			if (strict)
+				exit(CACHE_FAILURE);
+			continue;
+		} else if (_item_hash(&items[nitems]) < 0) {
+			fprintf(stderr, "Unable to read file %s.\n", path);
+			close(items[nitems].fildes);
+			if (strict)
+				exit(CACHE_FAILURE);
+			continue;
 		}
 		nitems++;
 
@@ -73,38 +223,236 @@ int simplecache_init(char *filename){
 
 	fclose(filelist);
 
+	if (!index->lazy)
+		_index_dedup(items, nitems);
 	qsort(items, nitems, sizeof(item_t), _itemcmp);
 
+	index->nitems = nitems;
+	index->items = items;
+	return index;
+}
+
+/* Starts the fd cache the first time an index needs it */
+static void _fd_cache_start(index_t *index){
+	if (index->lazy && !fd_cache_enabled() && fd_cache_init(fd_limit > 0 ? fd_limit : 0) < 0) {
+		fprintf(stderr, "Unable to allocate the fd cache.\n");
+		exit(CACHE_FAILURE);
+	}
+}
+
+int simplecache_init(char *filename){
+	index_t *index = _index_build(filename, 1);
+	_fd_cache_start(index);
+	__atomic_store_n(&current, index, __ATOMIC_SEQ_CST);
 	return EXIT_SUCCESS;
 }
 
+int simplecache_reload(char *filename){
+	index_t *fresh, *old;
+	uint64_t epoch;
+	int i, busy, n;
+
+	if (NULL == (fresh = _index_build(filename, 0)))
+		return -1;
+	_fd_cache_start(fresh);
+
+	pthread_mutex_lock(&reload_mutex);
+	old = __atomic_exchange_n(&current, fresh, __ATOMIC_SEQ_CST);
+	epoch = __atomic_add_fetch(&global_epoch, 1, __ATOMIC_SEQ_CST);
+	/* Files replaced on disk are opened afresh; pinned descriptors close on release */
+	fd_cache_invalidate();
+
+	/* Grace period: wait out every reader that may still hold the old index */
+	do {
+		busy = 0;
+		for (i = 0; i < __atomic_load_n(&nreaders, __ATOMIC_SEQ_CST); i++) {
+			uint64_t seen = __atomic_load_n(&reader_epoch[i], __ATOMIC_SEQ_CST);
+			if (seen != 0 && seen < epoch) {
+				busy = 1;
+				break;
+			}
+		}
+		if (busy)
+			usleep(1000);
+	} while (busy);
+
+	n = fresh->nitems;
+	_index_free(old);
+	pthread_mutex_unlock(&reload_mutex);
+	return n;
+}
+
+/*
+ * Returns a descriptor for path from the fd cache, pinned until this
+ * thread's next simplecache_quiescent so eviction cannot close it while
+ * a transfer still reads from it.
+ */
+static int _lazy_get(const char *path){
+	fd_cache_entry_t *entry;
+	int fd;
+
+	if (nheld == held_cap) {
+		held_cap = held_cap ? 2 * held_cap : 4;
+		held = realloc(held, held_cap * sizeof(*held));
+	}
+	if (0 > (fd = fd_cache_acquire(path, &entry))) {
+		fprintf(stderr, "Unable to open file %s.\n", path);
+		return -1;
+	}
+	held[nheld++] = entry;
+	lseek(fd, 0, SEEK_SET);
+	return fd;
+}
+
+static int _mapped_get(index_t *index, const char *key){
+	long item = cache_index_find(&index->mapped, key);
+	uint32_t file;
+
+	if (item < 0 || (key_filter != NULL && !key_filter(key)))
+		return -1;
+	if ((file = index->mapped.items[item].file) >= index->mapped.header->nfiles)
+		return -1;
+	return _lazy_get(cache_index_path(&index->mapped, file));
+}
+
 int simplecache_get(char *key){
-	int lo = 0;
-	int hi = nitems - 1;
-	int mid, cmp;
+	int lo, hi, mid, cmp;
+	index_t *index;
 
 	if (cache_delay > 0) {
 		usleep(cache_delay);
 	}
 
+	if (reader_slot < 0) {
+		reader_slot = __atomic_fetch_add(&nreaders, 1, __ATOMIC_SEQ_CST);
+		if (reader_slot >= MAX_READERS) {
+			fprintf(stderr, "Too many simplecache reader threads.\n");
+			exit(CACHE_FAILURE);
+		}
+	}
+	/* Announce before loading the index so a concurrent reload waits for us */
+	if (__atomic_load_n(&reader_epoch[reader_slot], __ATOMIC_SEQ_CST) == 0)
+		__atomic_store_n(&reader_epoch[reader_slot],
+		                 __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+	index = __atomic_load_n(&current, __ATOMIC_SEQ_CST);
+	if (index->mapped.header != NULL)
+		return _mapped_get(index, key);
+
+	lo = 0;
+	hi = index->nitems - 1;
 	while (lo <= hi) {
 		// Key is in items[lo..hi] or not present.
 		mid = lo + (hi - lo) / 2;
-		cmp = strcmp(key,items[mid].key);
+		cmp = strcmp(key,index->items[mid].key);
 		if ( cmp < 0) hi = mid - 1;
 		else if (cmp > 0) lo = mid + 1;
+		else if (index->lazy)
+			return _lazy_get(index->items[mid].key + index->items[mid].path);
 		else{
-			lseek(items[mid].fildes, 0, SEEK_SET);
-			return items[mid].fildes;
+			lseek(index->items[mid].fildes, 0, SEEK_SET);
+			return index->items[mid].fildes;
 		} 
 	}
 	return -1;
 }
 
+static int _path_hash(const char *path, size_t *size, uint32_t *hash){
+	int fd = open(path, O_RDONLY), ret;
+	if (fd < 0)
+		return -1;
+	ret = cache_index_hash_fd(fd, size, hash);
+	close(fd);
+	return ret;
+}
+
+int simplecache_export_hashes(const char *filename){
+	char tmp[PATH_MAX];
+	FILE *out;
+	int i, n, written;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", filename);
+	if (NULL == (out = fopen(tmp, "w")))
+		return -1;
+	/* Hold the reload mutex so the index cannot be freed under us */
+	pthread_mutex_lock(&reload_mutex);
+	index_t *index = __atomic_load_n(&current, __ATOMIC_SEQ_CST);
+	n = index ? index->nitems : 0;
+	if (index != NULL && index->mapped.header != NULL) {
+		/* Sizes and hashes were taken by mkindex, so nothing is read here */
+		const cache_index_t *mapped = &index->mapped;
+		for (i = 0, n = 0; i < index->nitems; i++) {
+			const char *key = cache_index_key(mapped, i);
+			const cache_index_file_t *file = &mapped->files[mapped->items[i].file % mapped->header->nfiles];
+			if (key_filter != NULL && !key_filter(key))
+				continue;
+			fprintf(out, "%08x %" PRIu64 " %s\n", file->hash, file->size, key);
+			n++;
+		}
+	} else {
+		for (i = 0, written = 0; i < n; i++) {
+			item_t *item = &index->items[i];
+			size_t size = item->size;
+			uint32_t hash = item->hash;
+			/* A lazy index never read its files; hash them now, bypassing the fd cache */
+			if (index->lazy && _path_hash(item->key + item->path, &size, &hash) < 0)
+				continue;
+			fprintf(out, "%08x %zu %s\n", hash, size, item->key);
+			written++;
+		}
+		n = written;
+	}
+	pthread_mutex_unlock(&reload_mutex);
+	if (fclose(out) != 0 || rename(tmp, filename) < 0) {
+		unlink(tmp);
+		return -1;
+	}
+	return n;
+}
+
+int simplecache_foreach_key(void (*fn)(const char *key, void *arg), void *arg){
+	int i, n;
+
+	pthread_mutex_lock(&reload_mutex);
+	index_t *index = __atomic_load_n(&current, __ATOMIC_SEQ_CST);
+	n = index ? index->nitems : 0;
+	if (index != NULL && index->mapped.header != NULL) {
+		for (i = 0, n = 0; i < index->nitems; i++) {
+			const char *key = cache_index_key(&index->mapped, i);
+			if (key_filter != NULL && !key_filter(key))
+				continue;
+			if (fn != NULL)
+				fn(key, arg);
+			n++;
+		}
+	} else {
+		for (i = 0; fn != NULL && i < n; i++)
+			fn(index->items[i].key, arg);
+	}
+	pthread_mutex_unlock(&reload_mutex);
+	return n;
+}
+
+int simplecache_key_bits(int (*load)(const uint64_t *bits, uint64_t nbits, uint32_t nhashes)){
+	int ret = -1;
+
+	pthread_mutex_lock(&reload_mutex);
+	index_t *index = __atomic_load_n(&current, __ATOMIC_SEQ_CST);
+	if (index != NULL && index->mapped.header != NULL && index->mapped.header->filter_nbits > 0)
+		ret = load(index->mapped.filter, index->mapped.header->filter_nbits,
+		           index->mapped.header->filter_nhashes);
+	pthread_mutex_unlock(&reload_mutex);
+	return ret;
+}
+
+void simplecache_quiescent(){
+	while (nheld > 0)
+		fd_cache_release(held[--nheld]);
+	if (reader_slot >= 0)
+		__atomic_store_n(&reader_epoch[reader_slot], 0, __ATOMIC_SEQ_CST);
+}
+
 void simplecache_destroy(){
-	int i;
-	for(i = 0; i < nitems; i++)
-		close(items[i].fildes);
-	
-	free(items);
+	index_t *index = __atomic_exchange_n(&current, NULL, __ATOMIC_SEQ_CST);
+	if (index != NULL)
+		_index_free(index);
 }
@@ -1,21 +1,81 @@
 #ifndef _SIMPLECACHE_H_
 #define _SIMPLECACHE_H_
 
+#include <stdint.h>
+
 /* 
  * Initializes the input cache given the information from
  * the provided file.  Each row of the file is assumed
  * to contain a key and a file path separated by a space.
  * Subsequent calls to simplecache_get with a key value
  * as an argument will return the file descriptor for the 
- * given file path.
+ * given file path. The file may instead be an index built
+ * from such a list by mkindex, which is mapped rather than
+ * read and whose files are opened on first use.
  */
 int simplecache_init(char *filename);
 
+/*
+ * Restricts the next simplecache_init to keys for which keep returns
+ * non-zero; other rows are skipped without opening their files.
+ */
+void simplecache_set_filter(int (*keep)(const char *key));
+
+/*
+ * Makes the next simplecache_init open files on first use through a
+ * cache of at most max_fds descriptors (0 sizes it from RLIMIT_NOFILE)
+ * instead of opening every file up front. An index built by mkindex is
+ * always opened this way.
+ */
+void simplecache_set_fd_limit(long max_fds);
+
 /* 
  * Returns the file descriptor associated with the input key.
+ * The descriptor stays open until the calling thread calls
+ * simplecache_quiescent, even if the index is reloaded meanwhile
+ * or the fd cache would evict it.
  */
 int simplecache_get(char *key);
 
+/*
+ * Tells the cache the calling thread holds no descriptor from
+ * simplecache_get any more, letting a pending reload or the fd
+ * cache reclaim them.
+ */
+void simplecache_quiescent();
+
+/*
+ * Rebuilds the index from filename and swaps it in atomically. Rows
+ * whose file cannot be opened are skipped. Blocks until readers of the
+ * old index are quiescent, then closes its descriptors. Returns the
+ * number of entries in the new index, or -1 if filename is unreadable.
+ */
+int simplecache_reload(char *filename);
+
+/*
+ * Writes one "crc32 size key" line per entry of the current index to
+ * filename (replaced atomically), for checking downloads without
+ * rehashing the sources. Entries with identical bytes share one open
+ * file. Files opened on first use are hashed here instead. Returns
+ * the number of entries written, or -1 on error.
+ */
+int simplecache_export_hashes(const char *filename);
+
+/*
+ * Calls fn on every key of the current index (fn may be NULL to only
+ * count them). The index cannot be reloaded meanwhile, so fn must not
+ * call back into the cache. Returns the number of keys.
+ */
+int simplecache_foreach_key(void (*fn)(const char *key, void *arg), void *arg);
+
+/*
+ * Passes the miss filter of the current index's keys that mkindex
+ * precomputed to load, and returns what load returns; -1 without
+ * calling it for an index read from text. Sharded caches get a filter
+ * of every key, which only makes it less selective.
+ */
+int simplecache_key_bits(int (*load)(const uint64_t *bits, uint64_t nbits, uint32_t nhashes));
+
 /* 
  * Frees all memory and closes all file descriptors that are associated with the cache
  */
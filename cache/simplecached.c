@@ -10,10 +10,21 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <inttypes.h>
+#include <zlib.h>
 #include "cache-student.h"
 #include "shm_channel.h"
 #include "simplecache.h"
 #include "gfserver.h"
+#include "stats.h"
+#include "cache_log.h"
+#include "shard_ring.h"
+#include "numa_place.h"
+#include "disk_store.h"
+#include "miss_filter.h"
+#include "transport.h"
+#include "counters.h"
+#include "probes.h"
 #include <mqueue.h>
 
 // CACHE_FAILURE
@@ -26,9 +37,45 @@
 
 unsigned long int cache_delay;
 
+/* This instance's slice of the ring: keys it owns as primary or replica */
+static shard_ring_t ring;
+static int shard_index = 0;
+static int shard_count = 1;
+static int shard_replicas = 0;
+static char queue_name[MAX_SHM_NAME] = CACHE_COMMAND_QUEUE;
+
+/* Read-through tier: misses are fetched from origin and kept in the store */
+static char *origin = NULL;
+
+/* -z: keep gzip variants of objects in the store next to the originals */
+static int gzip_variants = 0;
+
+/* -H: content hashes of the local files, rewritten after every (re)load */
+static char *hash_file = NULL;
+
+/* Rebuilds the negative-lookup filter from the current index */
+static void add_filter_key(const char *key, void *arg) {
+	miss_filter_add(key);
+}
+
+static void publish_keys(void) {
+	if (origin != NULL) {
+		return;  // misses are fetched, so every key may be present
+	}
+	if (simplecache_key_bits(miss_filter_load) == 0) {
+		return;  // precomputed by mkindex
+	}
+	miss_filter_begin(simplecache_foreach_key(NULL, NULL));
+	simplecache_foreach_key(add_filter_key, NULL);
+	miss_filter_end();
+}
+
 static void _sig_handler(int signo){
 	if (signo == SIGTERM || signo == SIGINT){
-		mq_unlink(CACHE_COMMAND_QUEUE);		
+		miss_filter_remove(queue_name);
+		counters_remove(queue_name);
+		mq_unlink(queue_name);		
+		shard_unpublish_owner(queue_name);
 		simplecache_destroy();
 		exit(signo);
 	}
@@ -39,8 +86,21 @@ static void _sig_handler(int signo){
 "  simplecached [options]\n"                                                  \
 "options:\n"                                                                  \
 "  -c [cachedir]       Path to static files (Default: ./)\n"                  \
+"                      or an index of them built by mkindex\n"              \
+"                      Send SIGHUP to re-read it without restarting\n"       \
 "  -t [thread_count]   Thread count for work queue (Default is 8, Range is 1-100)\n"      \
-"  -d [delay]          Delay in simplecache_get (Default is 0, Range is 0-2500000 (microseconds)\n "	\
+"  -d [delay]          Delay in simplecache_get (Default is 0, Range is 0-2500000 (microseconds)\n"	\
+"  -s [shard]          This instance's shard index (Default: 0)\n"                   \
+"  -n [shard_count]    Cache instances the proxies hash over (Default: 1)\n"         \
+"  -r [replicas]       Shards that hold each key, primary included (Default: 2 with -n)\n" \
+"  -P                  Pin workers to cores and follow each segment's NUMA node\n"  \
+"  -u [origin_url]     Fetch misses from this server and keep them on disk (Default: off)\n" \
+"  -D [store_dir]      Directory of the on-disk store (Default: ./store)\n"          \
+"  -B [budget_mb]      Byte budget of the on-disk store in MiB (Default: 1024)\n"   \
+"  -z                  Keep gzip variants in the store and send them when accepted\n" \
+"  -H [hash_file]      Write \"crc32 size key\" for every local file here (Default: off)\n" \
+"  -f [max_fds]        Open local files on first use, keeping at most max_fds open\n" \
+"                      (0 sizes it from RLIMIT_NOFILE; Default: open all at startup)\n" \
 "  -h                  Show this help message\n"
 
 //OPTIONS
@@ -50,6 +110,16 @@ static struct option gLongOptions[] = {
   {"help",               no_argument,            NULL,           'h'},
   {"hidden",			 no_argument,			 NULL,			 'i'}, /* server side */
   {"delay", 			 required_argument,		 NULL, 			 'd'}, // delay.
+  {"shard",              required_argument,      NULL,           's'},
+  {"shard-count",        required_argument,      NULL,           'n'},
+  {"replicas",           required_argument,      NULL,           'r'},
+  {"pin",                no_argument,            NULL,           'P'},
+  {"origin",             required_argument,      NULL,           'u'},
+  {"store-dir",          required_argument,      NULL,           'D'},
+  {"store-budget",       required_argument,      NULL,           'B'},
+  {"gzip",               no_argument,            NULL,           'z'},
+  {"hash-file",          required_argument,      NULL,           'H'},
+  {"max-fds",            required_argument,      NULL,           'f'},
   {NULL,                 0,                      NULL,             0}
 };
 
@@ -59,131 +129,376 @@ void Usage() {
   fprintf(stdout, "%s", USAGE);
 }
 
+static int owns_key(const char *key) {
+    int owners[SHARD_MAX];
+    int n = shard_ring_owners(&ring, key, owners, shard_replicas);
+    for (int i = 0; i < n; i++) {
+        if (owners[i] == shard_index) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Names one version of a file: a replaced or rewritten file gets a new id.
+ * Store records are immutable, so their inode and offset are enough.
+ */
+static uint64_t object_identity(const struct stat *st, off_t base, int mutable) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    uint64_t parts[5] = { st->st_dev, st->st_ino, (uint64_t)base,
+                          mutable ? (uint64_t)st->st_size : 0,
+                          mutable ? (uint64_t)st->st_mtim.tv_sec * 1000000000ULL + st->st_mtim.tv_nsec : 0 };
+    for (int i = 0; i < 5; i++) {
+        h = (h ^ parts[i]) * 0x100000001b3ULL;
+    }
+    return h | 1;  // 0 means "any version" in cache_req_t
+}
+
+typedef struct {
+    char *data;
+    size_t size;
+    size_t capacity;
+} fetch_buf_t;
+
+/* Grows geometrically so a large body is not reallocated on every curl callback */
+static size_t fetch_write(void *data, size_t size, size_t nmemb, void *clientp) {
+    size_t realsize = size * nmemb;
+    fetch_buf_t *buf = clientp;
+    if (buf->size + realsize > buf->capacity) {
+        size_t capacity = buf->capacity ? buf->capacity : 65536;
+        while (capacity < buf->size + realsize) {
+            capacity *= 2;
+        }
+        char *ptr = realloc(buf->data, capacity);
+        if (ptr == NULL) {
+            return 0;
+        }
+        buf->data = ptr;
+        buf->capacity = capacity;
+    }
+    memcpy(buf->data + buf->size, data, realsize);
+    buf->size += realsize;
+    return realsize;
+}
+
+/* store_fetch_fn: GET origin + key into memory for disk_store to append */
+static int fetch_from_origin(const char *key, char **data, size_t *len, void *arg) {
+    char url[MAX_CACHE_REQUEST_LEN + 1024];
+    fetch_buf_t buf = {0};
+    long code = 0;
+    CURL *curl = curl_easy_init();
+    if (curl == NULL) {
+        return 500;
+    }
+    snprintf(url, sizeof(url), "%s%s", (char *)arg, key);
+    curl_easy_setopt(curl, CURLOPT_URL, url);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, fetch_write);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &buf);
+    CURLcode ret = curl_easy_perform(curl);
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+    curl_easy_cleanup(curl);
+
+    if (ret != CURLE_OK || code != 200) {
+        free(buf.data);
+        CLOG_WARN("[Cache] Origin fetch of %s failed: %s, HTTP %ld\n", url, curl_easy_strerror(ret), code);
+        return (ret == CURLE_OK && code == 404) ? 404 : 502;
+    }
+    *data = buf.data;
+    *len = buf.size;
+    return 200;
+}
+
+/* Text types whose gzip variant is worth building for clients that did not ask */
+static int compressible_type(const char *path) {
+    static const char *types[] = { ".html", ".htm", ".txt", ".css", ".js", ".json",
+                                   ".xml", ".svg", ".csv", ".md", NULL };
+    const char *ext = strrchr(path, '.');
+    for (int i = 0; ext != NULL && types[i] != NULL; i++) {
+        if (strcasecmp(ext, types[i]) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+typedef struct {
+    int fd;
+    off_t base;
+    size_t size;
+} variant_src_t;
+
+/* store_fetch_fn: gzips the plain object described by arg */
+static int compress_object(const char *key, char **data, size_t *len, void *arg) {
+    variant_src_t *src = arg;
+    z_stream zs = {0};
+    char in[65536];
+    size_t done = 0;
+    int ret = Z_OK;
+
+    if (deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return 500;
+    }
+    size_t bound = deflateBound(&zs, src->size);
+    char *out = malloc(bound);
+    if (out == NULL) {
+        deflateEnd(&zs);
+        return 500;
+    }
+    zs.next_out = (Bytef *)out;
+    zs.avail_out = bound;
+    /* The output buffer is deflateBound, so deflate never stops for space */
+    while (ret == Z_OK) {
+        size_t want = src->size - done < sizeof(in) ? src->size - done : sizeof(in);
+        ssize_t n = want > 0 ? pread(src->fd, in, want, src->base + done) : 0;
+        if (n < 0) {
+            break;
+        }
+        done += n;
+        zs.next_in = (Bytef *)in;
+        zs.avail_in = n;
+        ret = deflate(&zs, done == src->size ? Z_FINISH : Z_NO_FLUSH);
+    }
+    deflateEnd(&zs);
+    if (ret != Z_STREAM_END) {
+        CLOG_WARN("[Cache] Compressing %s failed after %zu of %zu bytes\n", key, done, src->size);
+        free(out);
+        return 500;
+    }
+    *data = out;
+    *len = zs.total_out;
+    return 200;
+}
+
+/*
+ * Pins the gzip variant of the object just looked up, building it on
+ * first use. The key names the object version, so a changed file never
+ * gets an old variant. Returns 0, or -1 if there is none worth sending:
+ * a client that did not ask for gzip only gets one that saves an eighth.
+ */
+static int gzip_variant(const cache_req_t *request, int fd, off_t base, size_t size,
+                        uint64_t object_id, store_ref_t *vref) {
+    char key[MAX_CACHE_REQUEST_LEN + 64];
+    variant_src_t src = { fd, base, size };
+
+    if (!gzip_variants || request->range.present || request->accept == GF_ACCEPT_IDENTITY ||
+        (request->accept == GF_ACCEPT_SMALLER && !compressible_type(request->path))) {
+        return -1;
+    }
+    snprintf(key, sizeof(key), "%s" GF_ENCODING_SUFFIX ";v=%016" PRIx64, request->path, object_id);
+    if (disk_store_fetch(key, compress_object, &src, vref) != 200) {
+        return -1;
+    }
+    if (request->accept == GF_ACCEPT_SMALLER && vref->length >= size - size / 8) {
+        disk_store_release(vref);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Finds the object for request in the index, then in the store (fetching
+ * a miss from origin). Returns an HTTP status; on 200, fd, base and size
+ * locate the bytes and ref pins them if they came from the store. An fd
+ * from the index belongs to simplecache, so it is never closed here.
+ */
+static int lookup_object(const cache_req_t *request, int *fd, off_t *base, size_t *size,
+                         uint64_t *object_id, store_ref_t *ref) {
+    struct stat st;
+    int status;
+
+    *base = 0;
+    *size = 0;
+    *object_id = 0;
+    *fd = simplecache_get((char *)request->path);
+    if (*fd >= 0) {
+        if (fstat(*fd, &st) == -1) {
+            perror("[Cache] fstat");
+            return 500;
+        }
+        *size = st.st_size;
+        *object_id = object_identity(&st, 0, 1);
+        return 200;
+    }
+    if (origin == NULL) {
+        return 404;
+    }
+    status = disk_store_fetch(request->path, fetch_from_origin, origin, ref);
+    *fd = ref->fd;
+    *base = ref->offset;
+    *size = ref->length;
+    if (status == 200 && fstat(*fd, &st) == 0) {
+        *object_id = object_identity(&st, *base, 0);
+    }
+    return status;
+}
+
+/* Per-thread counters, shared as <queue>.counters */
+static counters_t *cache_counters;
+
+static void count_reply(int status, ssize_t bytes, uint64_t start_ns) {
+    switch (status) {
+        case 200:
+            counter_add(cache_counters, CTR_OK, 1);
+            counter_add(cache_counters, CTR_BYTES, bytes > 0 ? bytes : 0);
+            break;
+        case 404:
+            counter_add(cache_counters, CTR_NOT_FOUND, 1);
+            break;
+        case 503:
+            counter_add(cache_counters, CTR_SHED, 1);
+            break;
+        default:
+            counter_add(cache_counters, CTR_ERRORS, 1);
+            break;
+    }
+    counter_add(cache_counters, CTR_BUSY_NS, stats_now_ns() - start_ns);
+}
+
 void *cacheWorker(void *arg) {
+    static int next_slot;
     pthread_t tid = pthread_self();
     cache_req_t request;
     mqd_t mqd = *(mqd_t *)arg; 
     
+    numa_pin_thread(__atomic_fetch_add(&next_slot, 1, __ATOMIC_RELAXED));
+    
     while (1) {
+        // Done with the previous fd; a pending reload may reclaim it
+        simplecache_quiescent();
+        
         // Receive request from message queue
         int n = mq_receive(mqd, (char*)&request, sizeof(request), NULL);
         if (n <= 0) {
             perror("[Cache] mq_receive");
             continue;
         }
+        uint64_t start_ns = stats_now_ns();
+        stats_record(STAGE_CACHE_DEQUEUE, start_ns - request.sent_ns);
+        counter_add(cache_counters, CTR_REQUESTS, 1);
+        GF_PROBE3(mq__receive, request.path, request.transport, start_ns - request.sent_ns);
         
-        printf("[Cache TID:%lu] Request: %s, segment: %s\n",
-               (unsigned long)tid, request.path, request.shm_name);
-        
-        // Open shared memory segment
-        int shmfd = shm_open(request.shm_name, O_RDWR, 0);
-        if (shmfd < 0) {
-            perror("[Cache] shm_open");
+        const transport_ops_t *transport = transport_for(&request);
+        if (transport == NULL) {
+            CLOG_WARN("[Cache TID:%lu] Unknown transport %d for %s\n", (unsigned long)tid,
+                      request.transport, request.path);
+            counter_add(cache_counters, CTR_ERRORS, 1);
             continue;
         }
+        CLOG_DEBUG("[Cache TID:%lu] Request: %s over %s\n",
+               (unsigned long)tid, request.path, transport->name);
         
-        size_t shm_total_size = sizeof(shm_data_t) + request.segsize;
-        
-        if (ftruncate(shmfd, shm_total_size) == -1) {
-            perror("[Cache] ftruncate");
-            close(shmfd);
+        // Claim the proxy's channel (a segment, or nothing for the socket transports)
+        void *chan = transport->attach(&request);
+        if (chan == NULL) {
+            CLOG_WARN("[Cache TID:%lu] Proxy gave up on %s\n", (unsigned long)tid, request.path);
+            counter_add(cache_counters, CTR_SHED, 1);
             continue;
         }
         
-        shm_data_t *shm = mmap(NULL, shm_total_size, PROT_READ | PROT_WRITE,
-                               MAP_SHARED, shmfd, 0);
-        if (shm == MAP_FAILED) {
-            perror("[Cache] mmap");
-            close(shmfd);
-            continue;
-        }
+        transport_reply_t reply = { .encoding = GF_ENC_IDENTITY };
+        store_ref_t ref = {0}, vref = {0};
+        int fd = -1;
+        off_t base = 0;
+        size_t size = 0, offset, length;
         
-        // Wait for proxy to initialize semaphores
-        sem_wait(&shm->rsem);
-        
-        // Try to get file from cache
-        int fd = simplecache_get(request.path);
-        
-        if (fd < 0) {
-            // File not found
-            printf("[Cache TID:%lu] File not found: %s\n", (unsigned long)tid, request.path);
-            shm->status = 404;
-            shm->file_size = 0;
-            sem_post(&shm->wsem);
-            munmap(shm, shm_total_size);
-            close(shmfd);
-            continue;
+        if (request.deadline_ns != 0 && stats_now_ns() > request.deadline_ns) {
+            /* The proxy gave up while this sat in the queue; don't add to the backlog */
+            CLOG_INFO("[Cache TID:%lu] Shedding expired request for %s\n", (unsigned long)tid, request.path);
+            reply.status = 503;
+        } else {
+            // Try to get file from cache, then from the on-disk store (fetching misses)
+            uint64_t lookup_ns = stats_now_ns();
+            reply.status = lookup_object(&request, &fd, &base, &size, &reply.object_id, &ref);
+            stats_record(STAGE_LOOKUP, stats_now_ns() - lookup_ns);
+            if (reply.status != 200) {
+                CLOG_INFO("[Cache TID:%lu] %s: %s\n", (unsigned long)tid,
+                          reply.status == 404 ? "File not found" : "Fetch failed", request.path);
+            }
         }
         
-        // Get file size
-        struct stat st;
-        if (fstat(fd, &st) == -1) {
-            perror("[Cache] fstat");
-            close(fd);
-            munmap(shm, shm_total_size);
-            close(shmfd);
-            continue;
+        if (reply.status != 200) {
+            /* already logged */
+        } else if (request.object_id != 0 && request.object_id != reply.object_id) {
+            /* A stripe of a response whose file changed (e.g. reloaded) since the first lookup */
+            CLOG_INFO("[Cache TID:%lu] %s changed under a striped transfer\n", (unsigned long)tid, request.path);
+            reply.status = 409;
+        } else if (gf_range_resolve(&request.range, size, &offset, &length) < 0) {
+            CLOG_INFO("[Cache TID:%lu] Unsatisfiable range for %s\n", (unsigned long)tid, request.path);
+            reply.status = 416;
+        } else if (gzip_variant(&request, fd, base, size, reply.object_id, &vref) == 0) {
+            CLOG_INFO("[Cache TID:%lu] Serving: %s gzip (%zu bytes for %zu) over %s\n",
+                   (unsigned long)tid, request.path, vref.length, size, transport->name);
+            fd = vref.fd;
+            reply.encoding = GF_ENC_GZIP;
+            reply.offset = vref.offset;
+            reply.length = vref.length;
+            reply.identity_size = size;
+        } else if (request.accept == GF_ACCEPT_GZIP) {
+            /* The client asked for gzip and this cache keeps no variants */
+            CLOG_INFO("[Cache TID:%lu] No gzip variant of %s\n", (unsigned long)tid, request.path);
+            reply.status = 406;
+        } else {
+            CLOG_INFO("[Cache TID:%lu] Serving: %s (%zu of %zu bytes at %zu) over %s\n",
+                   (unsigned long)tid, request.path, length, size, offset, transport->name);
+            reply.offset = base + offset;
+            reply.length = reply.identity_size = length;
         }
-        size_t file_size = st.st_size;
-        
-        printf("[Cache TID:%lu] Serving: %s (%zu bytes) in segment %s\n",
-               (unsigned long)tid, request.path, file_size, request.shm_name);
         
-        // Send status and file size to proxy
-        shm->status = 200;
-        shm->file_size = file_size;
-        sem_post(&shm->wsem);  // Signal metadata ready
+        GF_PROBE3(lookup__done, request.path, reply.status, reply.length);
         
-        // Transfer file in chunks
-        char buffer[request.segsize];
-        size_t bytes_read = 0;
-        size_t offset = 0;
+        // Send status and length to proxy, then the body
+        ssize_t bytes_read = transport->publish(chan, &request, &reply, fd);
+        CLOG_DEBUG("[Cache TID:%lu] Finished: %zd bytes\n", (unsigned long)tid, bytes_read);
+        count_reply(reply.status, bytes_read, start_ns);
         
-        while (bytes_read < file_size) {
-            sem_wait(&shm->rsem);  // Wait for proxy to be ready
-            
-            size_t bytes_to_read = (file_size - bytes_read < request.segsize) 
-                                   ? (file_size - bytes_read) 
-                                   : request.segsize;
-            
-            ssize_t nbytes = pread(fd, buffer, bytes_to_read, offset);
-            if (nbytes <= 0) {
-                perror("[Cache] pread error");
-                break;
+        disk_store_release(&vref);
+        disk_store_release(&ref);
+    }
+    
+    return NULL;
+}
+
+/* SIGHUP re-reads the locals file and swaps the index in place */
+static void *reloadWorker(void *arg) {
+    char *cachedir = arg;
+    sigset_t set;
+    int signo;
+    
+    sigemptyset(&set);
+    sigaddset(&set, SIGHUP);
+    while (1) {
+        if (sigwait(&set, &signo) != 0) {
+            continue;
+        }
+        uint64_t start_ns = stats_now_ns();
+        int n = simplecache_reload(cachedir);
+        if (n < 0) {
+            CLOG_WARN("[Main] Reload of %s failed, keeping the current index\n", cachedir);
+        } else {
+            CLOG_INFO("[Main] Reloaded %s: %d entries in %.1f ms\n", cachedir, n,
+                      (stats_now_ns() - start_ns) / 1e6);
+            publish_keys();
+            if (hash_file != NULL && simplecache_export_hashes(hash_file) < 0) {
+                CLOG_WARN("[Main] Unable to write content hashes to %s\n", hash_file);
             }
-            
-            // Copy to shared memory
-            shm->bytes_written = nbytes;
-            memcpy(shm->data, buffer, nbytes);
-            
-            bytes_read += nbytes;
-            offset += nbytes;
-            
-            printf("[Cache TID:%lu] Chunk: %zd bytes (total: %zu/%zu)\n",
-                   (unsigned long)tid, nbytes, bytes_read, file_size);
-            
-            sem_post(&shm->wsem);  // Signal chunk ready
         }
-        
-        printf("[Cache TID:%lu] Finished: %zu bytes\n", (unsigned long)tid, bytes_read);
-        
-        close(fd);
-        munmap(shm, shm_total_size);
-        close(shmfd);
     }
-    
     return NULL;
 }
 
 int main(int argc, char **argv) {
 	int nthreads = 6;
 	char *cachedir = "locals.txt";
+	char *store_dir = "store";
+	size_t store_budget_mb = 1024;
 	char option_char;
 
 	/* disable buffering to stdout */
 	setbuf(stdout, NULL);
 
-	while ((option_char = getopt_long(argc, argv, "d:ic:hlt:x", gLongOptions, NULL)) != -1) {
+	while ((option_char = getopt_long(argc, argv, "d:ic:hlt:xs:n:r:Pu:D:B:zH:f:", gLongOptions, NULL)) != -1) {
 		switch (option_char) {
 			default:
 				Usage();
@@ -201,6 +516,36 @@ int main(int argc, char **argv) {
             case 'd':
 				cache_delay = (unsigned long int) atoi(optarg);
 				break;
+			case 's': // shard index
+				shard_index = atoi(optarg);
+				break;
+			case 'n': // shard count
+				shard_count = atoi(optarg);
+				break;
+			case 'r': // replicas
+				shard_replicas = atoi(optarg);
+				break;
+			case 'P': // NUMA placement
+				numa_place_init(1);
+				break;
+			case 'u': // origin for misses
+				origin = optarg;
+				break;
+			case 'D': // store directory
+				store_dir = optarg;
+				break;
+			case 'B': // store budget
+				store_budget_mb = strtoul(optarg, NULL, 10);
+				break;
+			case 'z': // gzip variants
+				gzip_variants = 1;
+				break;
+			case 'H': // content hash export
+				hash_file = optarg;
+				break;
+			case 'f': // lazy opening through a bounded fd cache
+				simplecache_set_fd_limit(strtol(optarg, NULL, 10));
+				break;
 			case 'i': // server side usage
 			case 'o': // do not modify
 			case 'a': // experimental
@@ -217,6 +562,11 @@ int main(int argc, char **argv) {
 		fprintf(stderr, "Invalid number of threads must be in between 1-100\n");
 		exit(__LINE__);
 	}
+	if ((shard_count < 1) || (shard_count > SHARD_MAX) ||
+	    (shard_index < 0) || (shard_index >= shard_count) || (shard_replicas < 0)) {
+		fprintf(stderr, "Invalid shard settings: need 0 <= shard < shard_count <= %d\n", SHARD_MAX);
+		exit(__LINE__);
+	}
 	if (SIG_ERR == signal(SIGINT, _sig_handler)){
 		fprintf(stderr,"Unable to catch SIGINT...exiting.\n");
 		exit(CACHE_FAILURE);
@@ -225,8 +575,46 @@ int main(int argc, char **argv) {
 		fprintf(stderr,"Unable to catch SIGTERM...exiting.\n");
 		exit(CACHE_FAILURE);
 	}
+	/* A proxy that closes a pipe or stream transport early must not kill the cache */
+	signal(SIGPIPE, SIG_IGN);
+	/* Only reloadWorker takes SIGHUP; every thread started from here inherits the mask */
+	sigset_t hup;
+	sigemptyset(&hup);
+	sigaddset(&hup, SIGHUP);
+	pthread_sigmask(SIG_BLOCK, &hup, NULL);
+
 	/*Initialize cache*/
+	if (shard_replicas == 0) {
+		shard_replicas = shard_count > 1 ? 2 : 1;
+	}
+	if (shard_count > 1) {
+		shard_ring_init(&ring, shard_count, SHARD_DEFAULT_VNODES);
+		shard_queue_name(queue_name, sizeof(queue_name), shard_index, shard_count);
+		simplecache_set_filter(owns_key);
+	}
+	if (origin != NULL) {
+		miss_filter_remove(queue_name);  // left by an earlier run without -u
+	} else if (miss_filter_create(queue_name) < 0) {
+		fprintf(stderr, "Unable to publish the key filter of %s\n", queue_name);
+	}
 	simplecache_init(cachedir);
+	publish_keys();
+	if (hash_file != NULL && simplecache_export_hashes(hash_file) < 0) {
+		fprintf(stderr, "Unable to write content hashes to %s\n", hash_file);
+	}
+	if (origin != NULL) {
+		curl_global_init(CURL_GLOBAL_DEFAULT);
+	}
+	if (origin != NULL || gzip_variants) {
+		if (disk_store_open(store_dir, store_budget_mb << 20) < 0) {
+			fprintf(stderr, "Unable to open store in %s\n", store_dir);
+			exit(CACHE_FAILURE);
+		}
+	}
+	stats_attach();
+	/* Read by the proxies' /__stats */
+	cache_counters = counters_create(queue_name);
+	cache_log_init();
 
 	// Cache should go here
      struct mq_attr attr = {0};
@@ -234,15 +622,23 @@ int main(int argc, char **argv) {
     attr.mq_maxmsg = 10;
     attr.mq_msgsize = sizeof(cache_req_t);
 
-    mq_unlink(CACHE_COMMAND_QUEUE); // remove old queue
+    mq_unlink(queue_name); // remove old queue
+    shm_listen_events();  // segment eventfds from proxies run with -E
 
-    mqd = mq_open(CACHE_COMMAND_QUEUE, O_CREAT | O_RDWR, 0666, &attr);
+    mqd = mq_open(queue_name, O_CREAT | O_RDWR, 0666, &attr);
     if (mqd == (mqd_t)-1) {
         perror("mq_open");
         exit(CACHE_FAILURE);
     }
 
-    printf("[Main] Message queue created\n");
+    shard_publish_owner(queue_name);
+    printf("[Main] Message queue %s created\n", queue_name);
+
+    pthread_t reloader;
+    if (pthread_create(&reloader, NULL, reloadWorker, cachedir) != 0) {
+        perror("pthread_create");
+        exit(CACHE_FAILURE);
+    }
 
    pthread_t workers[nthreads];
     for (int i = 0; i < nthreads; i++) {
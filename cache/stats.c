@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "stats.h"
+
+static stats_segment_t *stats_seg = NULL;
+
+static const char *stage_names[STAGE_COUNT] = {
+    "segment_wait",
+    "mq_send",
+    "cache_dequeue",
+    "lookup",
+    "first_chunk",
+    "last_chunk",
+    "socket_send",
+};
+
+const char *stats_stage_name(stats_stage_t stage) {
+    return (stage < STAGE_COUNT) ? stage_names[stage] : "unknown";
+}
+
+static int stats_bucket(uint64_t ns) {
+    if (ns < STATS_SUB_COUNT) {
+        return (int)ns;
+    }
+    int msb = 63 - __builtin_clzll(ns);
+    int shift = msb - STATS_SUB_BITS;
+    return (shift + 1) * STATS_SUB_COUNT + (int)((ns >> shift) & (STATS_SUB_COUNT - 1));
+}
+
+static uint64_t stats_bucket_floor(int idx) {
+    if (idx < STATS_SUB_COUNT) {
+        return (uint64_t)idx;
+    }
+    int shift = idx / STATS_SUB_COUNT - 1;
+    uint64_t sub = idx % STATS_SUB_COUNT;
+    return (STATS_SUB_COUNT + sub) << shift;
+}
+
+stats_segment_t *stats_open(int readonly) {
+    int fd = shm_open(STATS_SHM_NAME, readonly ? O_RDONLY : O_RDWR, 0);
+    if (fd < 0) {
+        return NULL;
+    }
+    stats_segment_t *seg = mmap(NULL, sizeof(stats_segment_t),
+                                readonly ? PROT_READ : PROT_READ | PROT_WRITE,
+                                MAP_SHARED, fd, 0);
+    close(fd);
+    return (seg == MAP_FAILED) ? NULL : seg;
+}
+
+int stats_attach(void) {
+    /* Whoever starts first creates it; a zero-filled segment is already valid */
+    int fd = shm_open(STATS_SHM_NAME, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+    if (fd < 0) {
+        perror("[Stats] shm_open");
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size < sizeof(stats_segment_t)) {
+        if (ftruncate(fd, sizeof(stats_segment_t)) < 0) {
+            perror("[Stats] ftruncate");
+            close(fd);
+            return -1;
+        }
+    }
+    stats_segment_t *seg = mmap(NULL, sizeof(stats_segment_t), PROT_READ | PROT_WRITE,
+                                MAP_SHARED, fd, 0);
+    close(fd);
+    if (seg == MAP_FAILED) {
+        perror("[Stats] mmap");
+        return -1;
+    }
+    if (seg->magic != STATS_MAGIC || seg->version != STATS_VERSION) {
+        seg->version = STATS_VERSION;
+        __atomic_store_n(&seg->magic, STATS_MAGIC, __ATOMIC_RELEASE);
+    }
+    stats_seg = seg;
+    return 0;
+}
+
+void stats_detach(void) {
+    if (stats_seg != NULL) {
+        munmap(stats_seg, sizeof(stats_segment_t));
+        stats_seg = NULL;
+    }
+}
+
+void stats_hist_record(stats_hist_t *hist, uint64_t ns) {
+    __atomic_fetch_add(&hist->buckets[stats_bucket(ns)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist->sum_ns, ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist->count, 1, __ATOMIC_RELAXED);
+
+    uint64_t max = __atomic_load_n(&hist->max_ns, __ATOMIC_RELAXED);
+    while (ns > max &&
+           !__atomic_compare_exchange_n(&hist->max_ns, &max, ns, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+void stats_record(stats_stage_t stage, uint64_t ns) {
+    if (stats_seg == NULL || stage >= STAGE_COUNT) {
+        return;
+    }
+    stats_hist_record(&stats_seg->stages[stage], ns);
+}
+
+uint64_t stats_hist_percentile(const stats_hist_t *hist, double pct) {
+    /* Sum the buckets rather than trusting count: writers may be mid-update */
+    uint64_t total = 0;
+    for (int i = 0; i < STATS_NBUCKETS; i++) {
+        total += __atomic_load_n(&hist->buckets[i], __ATOMIC_RELAXED);
+    }
+    if (total == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)((pct / 100.0) * (double)total + 0.5);
+    if (rank < 1) rank = 1;
+    if (rank > total) rank = total;
+
+    uint64_t seen = 0;
+    for (int i = 0; i < STATS_NBUCKETS; i++) {
+        seen += __atomic_load_n(&hist->buckets[i], __ATOMIC_RELAXED);
+        if (seen >= rank) {
+            return stats_bucket_floor(i);
+        }
+    }
+    return __atomic_load_n(&hist->max_ns, __ATOMIC_RELAXED);
+}
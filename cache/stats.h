@@ -0,0 +1,75 @@
+/*
+ Per-stage latency histograms kept in a small shared memory segment.
+ Both webproxy and simplecached attach to the same segment and record
+ into it with relaxed atomics; cachestat maps it read-only to dump it.
+ */
+#ifndef __CACHE_STATS_H__
+#define __CACHE_STATS_H__
+
+#include <stdint.h>
+#include <time.h>
+
+#define STATS_SHM_NAME "/cache_stats"
+#define STATS_MAGIC 0x53544154u
+#define STATS_VERSION 1
+
+/* HDR-style log-linear buckets: 16 linear sub-buckets per power of two,
+ * so any recorded value is within 1/16 of its bucket's lower bound. */
+#define STATS_SUB_BITS 4
+#define STATS_SUB_COUNT (1 << STATS_SUB_BITS)
+#define STATS_NBUCKETS ((64 - STATS_SUB_BITS + 1) * STATS_SUB_COUNT)
+
+typedef enum {
+    STAGE_SEGMENT_WAIT,   // proxy: waiting for a free segment in the pool
+    STAGE_MQ_SEND,        // proxy: mq_open + mq_send of the request
+    STAGE_CACHE_DEQUEUE,  // request sent -> picked up by a cache worker
+    STAGE_LOOKUP,         // cache: simplecache_get
+    STAGE_FIRST_CHUNK,    // proxy: request start -> first chunk available
+    STAGE_LAST_CHUNK,     // proxy: request start -> last chunk available
+    STAGE_SOCKET_SEND,    // proxy: total time spent in gfs_send per request
+    STAGE_COUNT
+} stats_stage_t;
+
+typedef struct {
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t max_ns;
+    uint64_t buckets[STATS_NBUCKETS];
+} stats_hist_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    stats_hist_t stages[STAGE_COUNT];
+} stats_segment_t;
+
+/* Monotonic clock in nanoseconds; comparable across processes. */
+static inline uint64_t stats_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * Maps (creating if needed) the shared stats segment. Returns 0 on success.
+ * If this fails every stats_record call is a no-op.
+ */
+int stats_attach(void);
+
+/* Maps the segment read-only (readonly != 0) or read-write without creating it. */
+stats_segment_t *stats_open(int readonly);
+
+void stats_detach(void);
+
+/* Records one sample for the given stage into the shared segment. */
+void stats_record(stats_stage_t stage, uint64_t ns);
+
+/* Records a sample into a caller-owned histogram (not necessarily shared). */
+void stats_hist_record(stats_hist_t *hist, uint64_t ns);
+
+/* Returns the lower bound of the bucket holding the given percentile (0-100). */
+uint64_t stats_hist_percentile(const stats_hist_t *hist, double pct);
+
+const char *stats_stage_name(stats_stage_t stage);
+
+#endif // __CACHE_STATS_H__
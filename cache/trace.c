@@ -0,0 +1,232 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include "stats.h"
+#include "trace.h"
+
+/* Records in flight between the workers and the file; a power of two */
+#define TRACE_RING_SLOTS 8192
+/* How long the flusher sleeps once the ring is empty */
+#define TRACE_FLUSH_NS (10 * 1000000L)
+/* How long trace_stop waits for the flusher's last drain */
+#define TRACE_STOP_NS (1000 * 1000000ull)
+
+typedef struct {
+    uint64_t seq;           // == position when free, position + 1 once filled
+    trace_rec_t rec;
+    char path[TRACE_PATH_MAX];
+} trace_slot_t;
+
+static struct {
+    uint64_t head __attribute__((aligned(64)));  // next position to fill
+    uint64_t tail __attribute__((aligned(64)));  // next position to drain
+    uint64_t dropped;
+    trace_slot_t slots[TRACE_RING_SLOTS];
+} *ring;
+
+static FILE *trace_fp;
+static uint64_t trace_start_ns;
+/* trace_stop sets stopping; the flusher sets stopped after its last drain */
+static int stopping, stopped;
+
+/* Takes the oldest record off the ring into buf; returns its size, 0 if empty */
+static size_t ring_pop(char *buf) {
+    uint64_t pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    trace_slot_t *slot;
+    while (1) {
+        slot = &ring->slots[pos & (TRACE_RING_SLOTS - 1)];
+        int64_t diff = (int64_t)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - (pos + 1));
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&ring->tail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return 0;
+        } else {
+            pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+        }
+    }
+    size_t len = sizeof(trace_rec_t) + slot->rec.path_len;
+    memcpy(buf, &slot->rec, sizeof(trace_rec_t));
+    memcpy(buf + sizeof(trace_rec_t), slot->path, slot->rec.path_len);
+    __atomic_store_n(&slot->seq, pos + TRACE_RING_SLOTS, __ATOMIC_RELEASE);
+    return len;
+}
+
+static int drain(void) {
+    char buf[sizeof(trace_rec_t) + TRACE_PATH_MAX];
+    size_t len;
+    int n = 0;
+    while ((len = ring_pop(buf)) > 0) {
+        fwrite(buf, 1, len, trace_fp);
+        n++;
+    }
+    if (n > 0) {
+        fflush(trace_fp);
+    }
+    return n;
+}
+
+/* The only thread that touches trace_fp once tracing has started */
+static void *flusher_main(void *arg) {
+    struct timespec ts = { 0, TRACE_FLUSH_NS };
+    while (!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE)) {
+        if (drain() == 0) {
+            nanosleep(&ts, NULL);
+        }
+    }
+    drain();
+    fflush(trace_fp);
+    __atomic_store_n(&stopped, 1, __ATOMIC_RELEASE);
+    /* The process is exiting; a thread that ended now would race its teardown */
+    while (1) {
+        pause();
+    }
+    return NULL;
+}
+
+int trace_open(const char *filename) {
+    pthread_t thread;
+    trace_header_t header;
+    struct timespec now;
+
+    ring = calloc(1, sizeof(*ring));
+    trace_fp = fopen(filename, "w");
+    if (ring == NULL || trace_fp == NULL) {
+        perror(filename);
+        return -1;
+    }
+    for (uint64_t i = 0; i < TRACE_RING_SLOTS; i++) {
+        ring->slots[i].seq = i;
+    }
+    clock_gettime(CLOCK_REALTIME, &now);
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.started_unix_ns = (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+    trace_start_ns = stats_now_ns();
+    if (fwrite(&header, sizeof(header), 1, trace_fp) != 1 || fflush(trace_fp) != 0) {
+        perror(filename);
+        return -1;
+    }
+    /* With every signal blocked, so the shutdown handler never interrupts a write in progress */
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    int rc = pthread_create(&thread, NULL, flusher_main, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (rc != 0) {
+        perror("[Trace] pthread_create");
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
+
+int trace_enabled(void) {
+    return trace_fp != NULL;
+}
+
+void trace_record(const char *path, int status, uint64_t bytes, uint64_t start_ns, uint64_t end_ns) {
+    if (ring == NULL) {
+        return;
+    }
+    uint64_t pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    trace_slot_t *slot;
+    while (1) {
+        slot = &ring->slots[pos & (TRACE_RING_SLOTS - 1)];
+        int64_t diff = (int64_t)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&ring->head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            __atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);  // full: never wait for the file
+            return;
+        } else {
+            pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+        }
+    }
+    size_t len = strnlen(path, TRACE_PATH_MAX);
+    slot->rec.arrival_ns = start_ns > trace_start_ns ? start_ns - trace_start_ns : 0;
+    slot->rec.latency_ns = end_ns - start_ns;
+    slot->rec.bytes = bytes;
+    slot->rec.status = status;
+    slot->rec.path_len = len;
+    memcpy(slot->path, path, len);
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+void trace_stop(void) {
+    struct timespec ts = { 0, 1000000L };
+    uint64_t waited = 0;
+    if (trace_fp == NULL) {
+        return;
+    }
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+    while (!__atomic_load_n(&stopped, __ATOMIC_ACQUIRE) && waited < TRACE_STOP_NS) {
+        nanosleep(&ts, NULL);
+        waited += ts.tv_nsec;
+    }
+}
+
+uint64_t trace_dropped(void) {
+    return ring ? __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED) : 0;
+}
+
+static int by_arrival(const void *a, const void *b) {
+    const trace_entry_t *x = a, *y = b;
+    return x->arrival_ns < y->arrival_ns ? -1 : x->arrival_ns > y->arrival_ns;
+}
+
+long trace_load(const char *filename, trace_entry_t **entries) {
+    FILE *fp = fopen(filename, "r");
+    trace_header_t header;
+    trace_rec_t rec;
+    long n = 0, capacity = 1024;
+
+    if (fp == NULL) {
+        perror(filename);
+        return -1;
+    }
+    if (fread(&header, sizeof(header), 1, fp) != 1 ||
+        memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0) {
+        fprintf(stderr, "%s is not a request trace\n", filename);
+        fclose(fp);
+        return -1;
+    }
+    *entries = malloc(capacity * sizeof(trace_entry_t));
+    while (*entries != NULL && fread(&rec, sizeof(rec), 1, fp) == 1) {
+        char *path = malloc(rec.path_len + 1);
+        if (path == NULL || fread(path, 1, rec.path_len, fp) != rec.path_len) {
+            free(path);
+            break;  // a trace cut off mid-record keeps what came before
+        }
+        path[rec.path_len] = '\0';
+        if (n == capacity) {
+            capacity *= 2;
+            *entries = realloc(*entries, capacity * sizeof(trace_entry_t));
+            if (*entries == NULL) {
+                break;
+            }
+        }
+        trace_entry_t *e = &(*entries)[n++];
+        e->arrival_ns = rec.arrival_ns;
+        e->latency_ns = rec.latency_ns;
+        e->bytes = rec.bytes;
+        e->status = rec.status;
+        e->path = path;
+    }
+    fclose(fp);
+    if (*entries == NULL) {
+        fprintf(stderr, "Out of memory reading %s\n", filename);
+        return -1;
+    }
+    qsort(*entries, n, sizeof(trace_entry_t), by_arrival);
+    for (long i = n - 1; i >= 0; i--) {
+        (*entries)[i].arrival_ns -= (*entries)[0].arrival_ns;
+    }
+    return n;
+}
@@ -0,0 +1,61 @@
+/*
+ Request traces: webproxy -L writes one compact binary record per
+ request, and gfload -T replays a trace at its recorded arrival times
+ (or faster) against a local proxy and cache.
+
+ Workers hand records to a bounded lock-free ring (a Vyukov MPMC queue)
+ and never wait on the file: a thread drains the ring in the
+ background, and when it falls behind new records are dropped and
+ counted. The file is a trace_header_t followed by records, each a
+ trace_rec_t and then path_len bytes of path, in completion order.
+ */
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TRACE_MAGIC "GFTRACE1"
+/* Paths longer than this are cut in the trace */
+#define TRACE_PATH_MAX 256
+
+typedef struct {
+    char magic[8];
+    uint64_t started_unix_ns;   // CLOCK_REALTIME when the trace was opened
+} trace_header_t;
+
+typedef struct __attribute__((packed)) {
+    uint64_t arrival_ns;    // since the trace was opened
+    uint64_t latency_ns;    // until the worker was done with the request
+    uint64_t bytes;         // body length in the header, 0 unless GF_OK
+    int32_t status;         // GF_OK, GF_FILE_NOT_FOUND or GF_ERROR as the client saw it
+    uint16_t path_len;
+} trace_rec_t;
+
+/* Starts tracing to filename (truncated); -1 on failure */
+int trace_open(const char *filename);
+int trace_enabled(void);
+/* Queues one request, which arrived at start_ns (CLOCK_MONOTONIC); no-op unless tracing */
+void trace_record(const char *path, int status, uint64_t bytes, uint64_t start_ns, uint64_t end_ns);
+/*
+ * Has the flusher write out whatever is queued and stop, waiting up to a
+ * second for it. Called on shutdown, from the signal handler: only the
+ * flusher thread, which blocks signals, ever writes the file.
+ */
+void trace_stop(void);
+/* Records lost because the ring was full */
+uint64_t trace_dropped(void);
+
+/* One record read back, with arrival_ns relative to the first arrival */
+typedef struct {
+    uint64_t arrival_ns;
+    uint64_t latency_ns;
+    uint64_t bytes;
+    int status;
+    char *path;
+} trace_entry_t;
+
+/* Reads a whole trace sorted by arrival; returns the count, -1 on error */
+long trace_load(const char *filename, trace_entry_t **entries);
+
+#endif // __TRACE_H__
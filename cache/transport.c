@@ -0,0 +1,664 @@
+#define _GNU_SOURCE  // splice
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include "shm_channel.h"
+#include "fd_channel.h"
+#include "numa_place.h"
+#include "stats.h"
+#include "transport.h"
+#include "probes.h"
+#include "io_engine.h"
+
+enum { TRANSPORT_SEM, TRANSPORT_FD, TRANSPORT_PIPE, TRANSPORT_STREAM, TRANSPORT_COUNT };
+
+/* Upper bound for -r; stripes live on the consumer's stack */
+#define STRIPE_MAX_LIMIT 64
+
+unsigned int stripe_max = 4;
+size_t stripe_min = 1 << 20;
+
+struct transport_chan {
+    shm_data_t *shm;    // sem: the request's segment, stripe 0 of the body
+    int done;           // sem: the cache made its last post on shm
+    int unacked;        // sem: its status was read but not acknowledged
+    pid_t owner;        // cache the request was last sent to
+    int sock;           // socket backends: this thread's reply socket
+    int fd;             // socket backends: the passed file, pipe or socket
+    uint64_t ticket;
+};
+
+static uint64_t sink_deadline(const transport_sink_t *sink) {
+    return sink->timeout_ns ? stats_now_ns() + sink->timeout_ns : 0;
+}
+
+/* ---- sem: segment pool and semaphore handshake ---- */
+
+/* One contiguous slice of the response body, filled through its own segment */
+typedef struct {
+    shm_data_t *shm;
+    size_t offset;      // from the start of the response body
+    size_t length;
+    size_t received;    // bytes read out of the segment
+    size_t sent;        // bytes written to the sink
+    char *staging;      // holds chunks that arrive before the stripe reaches the head
+    int ready;          // status for this stripe has been read
+    int done;           // the cache made its last post, or never got the request
+    int failed;
+} stripe_t;
+
+/*
+ * Lays out stripes over primary and as many spare segments as the pool
+ * has right now. Never waits for a segment, so a busy proxy degrades to
+ * the single-segment transfer. Stripes are whole multiples of segsize.
+ */
+/* Stripes a body would be split into if the pool had the segments */
+static unsigned int stripes_wanted(int encoding, size_t file_size) {
+    unsigned int want = stripe_max < STRIPE_MAX_LIMIT ? stripe_max : STRIPE_MAX_LIMIT;
+    if (encoding != GF_ENC_IDENTITY) {
+        want = 1;  // a compressed body has no byte offsets to split at
+    }
+    if (stripe_min > 0 && file_size / stripe_min < want) {
+        want = file_size / stripe_min;
+    }
+    return want;
+}
+
+static int plan_stripes(stripe_t *stripes, shm_data_t *primary, int encoding, size_t file_size) {
+    size_t segsize = primary->segsize;
+    unsigned int want = stripes_wanted(encoding, file_size);
+    int n = 1;
+
+    memset(stripes, 0, sizeof(stripe_t) * STRIPE_MAX_LIMIT);
+    stripes[0].shm = primary;
+    stripes[0].ready = 1;
+    while (n < (int)want) {
+        shm_data_t *spare = try_get_shm_segment();
+        if (spare == NULL) {
+            break;
+        }
+        stripes[n++].shm = spare;
+    }
+
+    size_t per = (file_size + n - 1) / n;
+    per = (per + segsize - 1) / segsize * segsize;
+    int used = 0;
+    for (size_t offset = 0; used < n && (offset < file_size || used == 0); used++) {
+        stripes[used].offset = offset;
+        stripes[used].length = file_size - offset < per ? file_size - offset : per;
+        offset += stripes[used].length;
+    }
+    for (int i = used; i < n; i++) {
+        return_segment_to_pool(stripes[i].shm);
+    }
+    return used;
+}
+
+/* Pools a stripe's segment, or parks it if the cache may still write to it */
+static void release_stripe(stripe_t *s) {
+    if (s->shm == NULL) {
+        return;
+    }
+    if (s->done) {
+        return_segment_to_pool(s->shm);
+    } else {
+        shm_abandon_segment(s->shm, 0);
+    }
+    s->shm = NULL;
+}
+
+static int seg_open(int nchannels, size_t chunk) {
+    create_shm_pool(nchannels, chunk);
+    return 0;
+}
+
+static void seg_close(void) {
+    cleanup_shm_pool();
+}
+
+static transport_chan_t *seg_acquire(cache_req_t *request) {
+    uint64_t start_ns = stats_now_ns();
+    transport_chan_t *ch = calloc(1, sizeof(*ch));
+    if (ch == NULL) {
+        return NULL;
+    }
+    // Get shared memory segment from pool (local NUMA node first)
+    ch->shm = get_shm_segment();
+    stats_record(STAGE_SEGMENT_WAIT, stats_now_ns() - start_ns);
+    snprintf(request->shm_name, sizeof(request->shm_name), "%s", ch->shm->name);
+    request->segsize = ch->shm->segsize;
+    request->transport = TRANSPORT_SEM;
+    return ch;
+}
+
+static void seg_arm(transport_chan_t *ch, cache_req_t *request, pid_t owner) {
+    shm_reader_begin(ch->shm);
+    shm_send_events(ch->shm, owner);
+    ch->shm->owner_pid = owner;
+    ch->owner = owner;
+}
+
+static int seg_await(transport_chan_t *ch, transport_reply_t *reply, uint64_t deadline_ns) {
+    shm_data_t *shm = ch->shm;
+    int rc = shm_reader_wait_until(shm, deadline_ns);
+    if (rc == 0) {
+        reply->status = shm->status;
+        reply->encoding = shm->encoding;
+        reply->offset = 0;
+        reply->length = shm->file_size;
+        reply->identity_size = shm->identity_size;
+        reply->object_id = shm->object_id;
+        ch->done = shm->status != 200;  // no chunks follow an error
+        ch->unacked = 1;
+    }
+    return rc;
+}
+
+/*
+ * Splits a large body over spare segments so several cache workers fill
+ * them at once, then drains the stripes to the sink in order, staging
+ * any that arrive ahead of the head. Every segment is pooled or parked
+ * before returning.
+ */
+static ssize_t seg_consume(transport_chan_t *ch, const cache_req_t *request,
+                           const transport_reply_t *reply, transport_sink_t *sink) {
+    shm_data_t *shm = ch->shm;
+    size_t file_size = reply->length;
+    uint64_t object_id = reply->object_id;
+    stripe_t stripes[STRIPE_MAX_LIMIT];
+    size_t base = request->range.present ? request->range.start : 0;
+    int nstripes = plan_stripes(stripes, shm, reply->encoding, file_size);
+    for (int i = 1; i < nstripes; i++) {
+        cache_req_t stripe_req = *request;
+        stripe_req.range.present = 1;
+        stripe_req.range.start = base + stripes[i].offset;
+        stripe_req.range.end = base + stripes[i].offset + stripes[i].length - 1;
+        stripe_req.range.has_end = 1;
+        stripe_req.object_id = object_id;  // same file version as stripe 0, or a 409
+        stripe_req.accept = GF_ACCEPT_IDENTITY;
+        strncpy(stripe_req.shm_name, stripes[i].shm->name, sizeof(stripe_req.shm_name) - 1);
+        stripe_req.sent_ns = stats_now_ns();
+        stripe_req.deadline_ns = sink_deadline(sink);
+        shm_reader_begin(stripes[i].shm);
+        shm_send_events(stripes[i].shm, ch->owner);
+        stripes[i].shm->owner_pid = ch->owner;
+        if (sink->request(sink, &stripe_req) == -1) {
+            perror("[Proxy] mq_send stripe");
+            /* Nobody will fill the rest; the transfer fails when it reaches them */
+            for (int j = i; j < nstripes; j++) {
+                stripes[j].failed = stripes[j].done = 1;
+            }
+            break;
+        }
+    }
+
+    // Keep only stripe 0 in the primary segment
+    shm->file_size = stripes[0].length;
+    stripes[0].done = stripes[0].length == 0;  // no chunks follow an empty status
+    shm_reader_done(shm);  // Signal cache to start sending data
+    ch->shm = NULL;        // the stripes own it from here
+
+    size_t bytes_transferred = 0;
+    int head = 0;
+    int failed = 0;
+
+    while (head < nstripes && !failed) {
+        stripe_t *h = &stripes[head];
+        if (h->failed) {
+            failed = 1;
+            break;
+        }
+        if (h->staging != NULL && h->sent < h->received) {
+            ssize_t bytes_sent = sink->write(sink, h->staging + h->sent, h->received - h->sent);
+            if (bytes_sent <= 0) {
+                failed = 1;
+                break;
+            }
+            h->sent += bytes_sent;
+            bytes_transferred += bytes_sent;
+        }
+        if (h->sent == h->length) {
+            free(h->staging);
+            h->staging = NULL;
+            head++;
+            continue;
+        }
+
+        for (int i = head; i < nstripes && !failed; i++) {
+            stripe_t *s = &stripes[i];
+            if (s->received == s->length || s->failed) {
+                continue;
+            }
+            if (i == head) {
+                if (shm_reader_wait_until(s->shm, sink_deadline(sink)) < 0) {
+                    fprintf(stderr, "[Proxy] stripe %d of %s timed out or lost its cache\n", i, request->path);
+                    failed = 1;
+                    break;
+                }
+            } else if (shm_reader_poll(s->shm) != 0) {
+                continue;
+            }
+
+            if (!s->ready) {
+                /* First post on a striped segment is the cache's status for that range */
+                if (s->shm->status != 200 || s->shm->file_size != s->length ||
+                    s->shm->object_id != object_id) {
+                    fprintf(stderr, "[Proxy] stripe %d of %s failed: status %d\n", i, request->path, s->shm->status);
+                    if (s->shm->status == 200) {
+                        /* The worker is waiting to stream the wrong bytes */
+                        shm_abandon_segment(s->shm, 1);
+                        s->shm = NULL;
+                    } else {
+                        s->done = 1;
+                    }
+                    s->failed = failed = 1;
+                    break;
+                }
+                s->ready = 1;
+                shm_reader_done(s->shm);
+                continue;
+            }
+
+            size_t nbytes = s->shm->bytes_written;
+            if (nbytes == 0) {
+                s->done = s->failed = failed = 1;  // the cache cut the stripe short
+                break;
+            }
+            if (nbytes > s->length - s->received) {
+                shm_abandon_segment(s->shm, 1);
+                s->shm = NULL;
+                s->failed = failed = 1;
+                break;
+            }
+
+            GF_PROBE3(chunk__consume, s->shm->name, nbytes, i);
+            if (bytes_transferred == 0 && i == 0) {
+                stats_record(STAGE_FIRST_CHUNK, stats_now_ns() - sink->start_ns);
+            }
+
+            if (i == head && h->sent == h->received) {
+                ssize_t bytes_sent = sink->write(sink, s->shm->data, nbytes);
+                if (bytes_sent <= 0) {
+                    failed = 1;
+                } else {
+                    s->sent += bytes_sent;
+                    bytes_transferred += bytes_sent;
+                }
+            } else {
+                if (s->staging == NULL) {
+                    s->staging = malloc(s->length);
+                }
+                if (s->staging == NULL) {
+                    failed = 1;
+                } else {
+                    memcpy(s->staging + s->received, s->shm->data, nbytes);
+                }
+            }
+            s->received += nbytes;
+            s->done = s->received == s->length;
+
+            shm_reader_done(s->shm);
+        }
+    }
+
+    for (int i = 0; i < nstripes; i++) {
+        free(stripes[i].staging);
+        release_stripe(&stripes[i]);
+    }
+    return bytes_transferred;
+}
+
+/*
+ * Single-segment bodies only: one big enough to stripe keeps the worker,
+ * which fans it out over several cache workers. Needs the segment's
+ * eventfd, or the I/O thread would only notice chunks on its tick.
+ */
+static int seg_handoff(transport_chan_t *ch, const cache_req_t *request,
+                       const transport_reply_t *reply, int sock, uint64_t timeout_ns) {
+    if (ch->shm->event_fd < 0 || reply->length == 0 || stripes_wanted(reply->encoding, reply->length) > 1) {
+        return -1;
+    }
+    if (io_engine_stream(ch->shm, sock, reply->length, request->path, timeout_ns) < 0) {
+        return -1;
+    }
+    ch->shm = NULL;  // the I/O thread pools or parks it
+    return 0;
+}
+
+static void seg_release(transport_chan_t *ch, int clean) {
+    if (ch->shm != NULL) {
+        if (clean || ch->done) {
+            return_segment_to_pool(ch->shm);
+        } else {
+            shm_abandon_segment(ch->shm, ch->unacked);
+        }
+    }
+    free(ch);
+}
+
+static void *seg_attach(const cache_req_t *request) {
+    shm_data_t *shm = shm_attach_segment(request->shm_name, request->segsize);
+    if (shm == NULL) {
+        return NULL;
+    }
+    /* Copy into the segment from the node its memory is bound to */
+    numa_move_thread(shm->node);
+
+    // Wait for proxy to initialize semaphores
+    if (shm_writer_wait(shm) < 0) {
+        fprintf(stderr, "[Cache] Proxy of %s is gone\n", request->shm_name);
+        shm_detach_segment(shm, request->segsize);
+        return NULL;
+    }
+    if (__atomic_load_n(&shm->cancelled, __ATOMIC_SEQ_CST)) {
+        /* The proxy gave up while this sat in the queue; don't add to the backlog */
+        shm_write_status(shm, 503, 0, 0);
+        shm_detach_segment(shm, request->segsize);
+        return NULL;
+    }
+    return shm;
+}
+
+static ssize_t seg_publish(void *chan, const cache_req_t *request, const transport_reply_t *reply, int fd) {
+    shm_data_t *shm = chan;
+    ssize_t written = 0;
+
+    if (reply->status != 200) {
+        shm_write_status(shm, reply->status, 0, 0);
+    } else {
+        // Send status and length to proxy, then transfer the body in chunks
+        shm_write_encoded_status(shm, 200, reply->length, reply->object_id,
+                                 reply->encoding, reply->identity_size);
+        written = shm_write_file(shm, fd, reply->offset, reply->length, request->segsize);
+    }
+    shm_detach_segment(shm, request->segsize);
+    return written;
+}
+
+/* ---- fd, pipe, stream: a descriptor passed over a Unix socket ---- */
+
+static int sock_open(int nchannels, size_t chunk) {
+    return 0;
+}
+
+static void sock_close(void) {
+}
+
+static transport_chan_t *sock_acquire(cache_req_t *request, int transport) {
+    transport_chan_t *ch = calloc(1, sizeof(*ch));
+    if (ch == NULL) {
+        return NULL;
+    }
+    ch->fd = -1;
+    ch->sock = fd_reply_socket(request->reply_to, sizeof(request->reply_to));
+    if (ch->sock < 0) {
+        free(ch);
+        return NULL;
+    }
+    request->transport = transport;
+    return ch;
+}
+
+static transport_chan_t *fd_acquire(cache_req_t *request) {
+    return sock_acquire(request, TRANSPORT_FD);
+}
+
+static transport_chan_t *pipe_acquire(cache_req_t *request) {
+    return sock_acquire(request, TRANSPORT_PIPE);
+}
+
+static transport_chan_t *stream_acquire(cache_req_t *request) {
+    return sock_acquire(request, TRANSPORT_STREAM);
+}
+
+/* A fresh ticket per send, so a reply to an earlier attempt is dropped */
+static void sock_arm(transport_chan_t *ch, cache_req_t *request, pid_t owner) {
+    static __thread uint64_t next_ticket;
+    request->ticket = ch->ticket = ++next_ticket;
+    ch->owner = owner;
+}
+
+static int sock_await(transport_chan_t *ch, transport_reply_t *reply, uint64_t deadline_ns) {
+    fd_reply_t r;
+    int rc = fd_reply_recv(ch->sock, ch->ticket, &r, &ch->fd, deadline_ns, ch->owner);
+    if (rc == 0) {
+        reply->status = r.status;
+        reply->encoding = r.encoding;
+        reply->offset = r.offset;
+        reply->length = r.length;
+        reply->identity_size = r.identity_size;
+        reply->object_id = r.object_id;
+        if (r.status != 200 && ch->fd >= 0) {
+            close(ch->fd);
+            ch->fd = -1;
+        }
+    }
+    return rc;
+}
+
+/* read (or pread from *offset) and write through the sink; for sinks that must see the bytes */
+static ssize_t copy_to_sink(int fd, off_t *offset, size_t len, transport_sink_t *sink) {
+    char buf[65536];
+    size_t done = 0;
+    while (done < len) {
+        size_t want = len - done < sizeof(buf) ? len - done : sizeof(buf);
+        ssize_t n = offset ? pread(fd, buf, want, *offset) : read(fd, buf, want);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;  // the cache cut the body short
+        }
+        if (offset) {
+            *offset += n;
+        }
+        if (sink->write(sink, buf, n) != n) {
+            break;
+        }
+        done += n;
+    }
+    return done;
+}
+
+static ssize_t fd_consume(transport_chan_t *ch, const cache_req_t *request,
+                          const transport_reply_t *reply, transport_sink_t *sink) {
+    off_t offset = reply->offset;
+    size_t sent = 0;
+
+    stats_record(STAGE_FIRST_CHUNK, stats_now_ns() - sink->start_ns);
+    if (sink->sock < 0) {
+        return copy_to_sink(ch->fd, &offset, reply->length, sink);
+    }
+    uint64_t send_ns = stats_now_ns();
+    while (sent < reply->length) {
+        ssize_t n = sendfile(sink->sock, ch->fd, &offset, reply->length - sent);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            perror("[Proxy] sendfile");
+            break;
+        }
+        sent += n;
+        sink->sent(sink, n);
+    }
+    sink->send_ns += stats_now_ns() - send_ns;
+    return sent;
+}
+
+static ssize_t pipe_consume(transport_chan_t *ch, const cache_req_t *request,
+                            const transport_reply_t *reply, transport_sink_t *sink) {
+    size_t sent = 0;
+
+    stats_record(STAGE_FIRST_CHUNK, stats_now_ns() - sink->start_ns);
+    if (sink->sock < 0) {
+        return copy_to_sink(ch->fd, NULL, reply->length, sink);
+    }
+    uint64_t send_ns = stats_now_ns();
+    while (sent < reply->length) {
+        /* No SPLICE_F_MORE: on TCP it corks the tail until the 200ms timer */
+        ssize_t n = splice(ch->fd, NULL, sink->sock, NULL, reply->length - sent, SPLICE_F_MOVE);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            if (n < 0) {
+                perror("[Proxy] splice");
+            }
+            break;  // n == 0: the cache cut the body short
+        }
+        sent += n;
+        sink->sent(sink, n);
+    }
+    sink->send_ns += stats_now_ns() - send_ns;
+    return sent;
+}
+
+static ssize_t stream_consume(transport_chan_t *ch, const cache_req_t *request,
+                              const transport_reply_t *reply, transport_sink_t *sink) {
+    stats_record(STAGE_FIRST_CHUNK, stats_now_ns() - sink->start_ns);
+    return copy_to_sink(ch->fd, NULL, reply->length, sink);
+}
+
+static void sock_release(transport_chan_t *ch, int clean) {
+    if (ch->fd >= 0) {
+        close(ch->fd);
+    }
+    free(ch);
+}
+
+/* Nothing to claim up front: the reply socket is named in the request */
+static void *sock_attach(const cache_req_t *request) {
+    return (void *)request;
+}
+
+static void fill_reply(fd_reply_t *r, const cache_req_t *request, const transport_reply_t *reply) {
+    memset(r, 0, sizeof(*r));
+    r->ticket = request->ticket;
+    r->status = reply->status;
+    r->encoding = reply->encoding;
+    r->offset = reply->offset;
+    r->length = reply->length;
+    r->identity_size = reply->identity_size;
+    r->object_id = reply->object_id;
+}
+
+static ssize_t fd_publish(void *chan, const cache_req_t *request, const transport_reply_t *reply, int fd) {
+    fd_reply_t r;
+    fill_reply(&r, request, reply);
+    if (fd_reply_send(request->reply_to, &r, reply->status == 200 ? fd : -1) < 0) {
+        fprintf(stderr, "[Cache] Proxy socket %s is gone\n", request->reply_to);
+        return -1;
+    }
+    return reply->status == 200 ? (ssize_t)reply->length : 0;
+}
+
+/*
+ * pipe and stream: passes one end of a fresh pipe or socketpair, then
+ * pushes the body into the other without copying it through user space.
+ * A proxy that stops reading for as long as it would wait for us is
+ * given up on, so a worker never blocks forever on a full pipe.
+ */
+static ssize_t stream_out(const cache_req_t *request, const transport_reply_t *reply, int fd, int use_pipe) {
+    fd_reply_t r;
+    int ends[2];
+
+    fill_reply(&r, request, reply);
+    if (reply->status != 200) {
+        return fd_reply_send(request->reply_to, &r, -1) < 0 ? -1 : 0;
+    }
+    if ((use_pipe ? pipe2(ends, O_CLOEXEC) : socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, ends)) < 0) {
+        perror("[Cache] pipe");
+        r.status = 500;
+        fd_reply_send(request->reply_to, &r, -1);
+        return -1;
+    }
+    int sent_end = fd_reply_send(request->reply_to, &r, ends[0]);
+    close(ends[0]);
+    if (sent_end < 0) {
+        fprintf(stderr, "[Cache] Proxy socket %s is gone\n", request->reply_to);
+        close(ends[1]);
+        return -1;
+    }
+    fcntl(ends[1], F_SETFL, fcntl(ends[1], F_GETFL) | O_NONBLOCK);
+
+    int stall_ms = -1;
+    if (request->deadline_ns > request->sent_ns) {
+        stall_ms = (request->deadline_ns - request->sent_ns + 999999) / 1000000;
+    }
+    off_t offset = reply->offset;
+    size_t written = 0;
+    while (written < reply->length) {
+        ssize_t n = use_pipe
+            ? splice(fd, &offset, ends[1], NULL, reply->length - written,
+                     SPLICE_F_MOVE | SPLICE_F_MORE | SPLICE_F_NONBLOCK)
+            : sendfile(ends[1], fd, &offset, reply->length - written);
+        if (n > 0) {
+            written += n;
+            continue;
+        }
+        if (n < 0 && errno == EAGAIN) {
+            struct pollfd pfd = { ends[1], POLLOUT, 0 };
+            if (poll(&pfd, 1, stall_ms) == 0) {
+                fprintf(stderr, "[Cache] Proxy stopped reading %s\n", request->path);
+                break;
+            }
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        break;  // EOF on a shrunk file, or the proxy hung up (EPIPE)
+    }
+    close(ends[1]);
+    return written;
+}
+
+static ssize_t pipe_publish(void *chan, const cache_req_t *request, const transport_reply_t *reply, int fd) {
+    return stream_out(request, reply, fd, 1);
+}
+
+static ssize_t stream_publish(void *chan, const cache_req_t *request, const transport_reply_t *reply, int fd) {
+    return stream_out(request, reply, fd, 0);
+}
+
+static const transport_ops_t transports[TRANSPORT_COUNT] = {
+    [TRANSPORT_SEM] = {
+        "sem", 0, seg_open, seg_close, seg_acquire, seg_arm, seg_await, seg_consume, seg_handoff, seg_release,
+        seg_attach, seg_publish,
+    },
+    [TRANSPORT_FD] = {
+        "fd", 1, sock_open, sock_close, fd_acquire, sock_arm, sock_await, fd_consume, NULL, sock_release,
+        sock_attach, fd_publish,
+    },
+    [TRANSPORT_PIPE] = {
+        "pipe", 1, sock_open, sock_close, pipe_acquire, sock_arm, sock_await, pipe_consume, NULL, sock_release,
+        sock_attach, pipe_publish,
+    },
+    [TRANSPORT_STREAM] = {
+        "stream", 0, sock_open, sock_close, stream_acquire, sock_arm, sock_await, stream_consume, NULL, sock_release,
+        sock_attach, stream_publish,
+    },
+};
+
+const transport_ops_t *transport_find(const char *name) {
+    for (int i = 0; i < TRANSPORT_COUNT; i++) {
+        if (strcmp(transports[i].name, name) == 0) {
+            return &transports[i];
+        }
+    }
+    return NULL;
+}
+
+const transport_ops_t *transport_for(const cache_req_t *request) {
+    if (request->transport < 0 || request->transport >= TRANSPORT_COUNT) {
+        return NULL;
+    }
+    return &transports[request->transport];
+}
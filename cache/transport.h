@@ -0,0 +1,104 @@
+/*
+ Transports that carry a response body from simplecached to the proxy.
+
+ The request always travels through the cache's command queue; what
+ differs is how the status and the bytes come back. Each backend fills
+ in the same table of operations, so handle_with_cache and cacheWorker
+ are written once and the transport is picked at proxy startup (the
+ request names it, so the cache serves every backend at once):
+
+   proxy: open -> acquire -> (arm, send, await)... -> consume|handoff -> release
+   cache: attach -> publish
+
+   sem     body streamed through a shared memory segment, one chunk per
+           semaphore handshake; large bodies are striped over spare
+           segments (the default)
+   fd      the open file is passed over a Unix socket (SCM_RIGHTS) and
+           sent to the client with sendfile
+   pipe    a pipe is passed instead; the cache splices the file into it
+           and the proxy splices it on to the client
+   stream  a socketpair is passed; the cache sendfiles into it and the
+           proxy copies from it to the client
+ */
+#ifndef __TRANSPORT_H__
+#define __TRANSPORT_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "cache-student.h"
+
+/* What the cache found for a request, whatever carries it */
+typedef struct {
+    int status;             // HTTP-style: 200, 404, 409, 416, 503...
+    int encoding;           // GF_ENC_* of the body
+    off_t offset;           // cache side: where the body starts in its fd
+    size_t length;          // body bytes
+    size_t identity_size;   // plain size when encoding is not identity
+    uint64_t object_id;
+} transport_reply_t;
+
+/*
+ * Where the proxy puts a body. write sends all of buf or fails; sock,
+ * when not -1, lets a backend send to the client without user-space
+ * copies and report them through sent. request asks the same cache for
+ * more of the response (stripes).
+ */
+typedef struct transport_sink {
+    ssize_t (*write)(struct transport_sink *sink, const void *buf, size_t len);
+    void (*sent)(struct transport_sink *sink, size_t len);
+    int (*request)(struct transport_sink *sink, cache_req_t *request);
+    int sock;
+    uint64_t timeout_ns;    // longest wait for the cache, 0 for none
+    uint64_t start_ns;      // request start, for STAGE_FIRST_CHUNK
+    uint64_t send_ns;       // time spent sending, for STAGE_SOCKET_SEND
+} transport_sink_t;
+
+typedef struct transport_chan transport_chan_t;
+
+typedef struct {
+    const char *name;
+    /*
+     * The body reaches the client without passing through proxy memory,
+     * so a gzip variant is only worth it when the client asked for one.
+     */
+    int zero_copy;
+
+    /* Proxy side */
+    int (*open)(int nchannels, size_t chunk);
+    void (*close)(void);
+    /* A channel for one request, described in request; NULL on failure */
+    transport_chan_t *(*acquire)(cache_req_t *request);
+    /* Before each (re)send of request to the cache owned by owner */
+    void (*arm)(transport_chan_t *ch, cache_req_t *request, pid_t owner);
+    /* 0 with reply filled, -1 on timeout, SHM_WRITER_DEAD if the cache died first */
+    int (*await)(transport_chan_t *ch, transport_reply_t *reply, uint64_t deadline_ns);
+    /* Moves a 200's body to sink; returns the bytes delivered */
+    ssize_t (*consume)(transport_chan_t *ch, const cache_req_t *request,
+                       const transport_reply_t *reply, transport_sink_t *sink);
+    /*
+     * Instead of consume: gives a 200's body and sock, a descriptor for
+     * the client it then closes, to the I/O threads (io_engine.h). -1 if
+     * it can't, with nothing taken over; NULL for backends that never can.
+     */
+    int (*handoff)(transport_chan_t *ch, const cache_req_t *request,
+                   const transport_reply_t *reply, int sock, uint64_t timeout_ns);
+    /* clean: the cache is known to be done with the channel */
+    void (*release)(transport_chan_t *ch, int clean);
+
+    /* Cache side: NULL if the proxy is gone or gave up before we started */
+    void *(*attach)(const cache_req_t *request);
+    /* Answers with reply and, for a 200, the bytes of fd it locates; returns the bytes sent */
+    ssize_t (*publish)(void *chan, const cache_req_t *request, const transport_reply_t *reply, int fd);
+} transport_ops_t;
+
+/* Backend named name, or NULL */
+const transport_ops_t *transport_find(const char *name);
+/* Backend a request asked for (cache_req_t.transport), or NULL */
+const transport_ops_t *transport_for(const cache_req_t *request);
+
+/* Set from webproxy's -r and -b: striping over spare segments (sem) */
+extern unsigned int stripe_max;
+extern size_t stripe_min;
+
+#endif // __TRANSPORT_H__
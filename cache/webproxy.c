@@ -13,6 +13,13 @@
 #include "cache-student.h"
 #include "shm_channel.h"
 #include "gfserver.h"
+#include "stats.h"
+#include "shard_ring.h"
+#include "numa_place.h"
+#include "transport.h"
+#include "counters.h"
+#include "io_engine.h"
+#include "trace.h"
 
 // Note that the -n and -z parameters are NOT used for Part 1 
                         
@@ -22,6 +29,16 @@
 "options:\n"                                                                          \
 "  -n [segment_count]  Number of segments to use (Default: 8)\n"                      \
 "  -p [listen_port]    Listen port (Default: 25362)\n"                                 \
+"  -r [stripes]        Max segments one file is striped over (Default: 4, 1 disables)\n" \
+"  -b [stripe_bytes]   Minimum bytes per stripe (Default: 1048576)\n"                 \
+"  -c [cache_count]    simplecached instances to hash paths over (Default: 1)\n"   \
+"  -R [replicas]       Shards to try per path before failing (Default: 2 with -c)\n" \
+"  -P                  Pin workers to cores and bind segments to their NUMA node\n" \
+"  -T [timeout_ms]     Longest wait for any reply from the cache, 0 for none (Default: 60000)\n" \
+"  -I [max_inflight]   Requests this proxy has out before it sheds more (Default: 0, no limit)\n" \
+"  -F [transport]      How bodies come back from the cache: sem, fd, pipe or stream (Default: sem)\n" \
+"  -E [io_threads]     Threads that stream sem bodies to clients over epoll, freeing workers (Default: 0, off)\n" \
+"  -L [trace_file]     Record every request to trace_file for gfload -T to replay\n" \
 "  -s [server]         The server to connect to (Default: GitHub test data)\n"     \
 "  -t [thread_count]   Num worker threads (Default: 8 Range: 200)\n"              \
 "  -z [segment_size]   The segment size (in bytes, Default: 5712).\n"                  \
@@ -34,6 +51,16 @@ static struct option gLongOptions[] = {
   {"segment-count", required_argument,      NULL,           'n'},
   {"listen-port",   required_argument,      NULL,           'p'},
   {"thread-count",  required_argument,      NULL,           't'},
+  {"stripes",       required_argument,      NULL,           'r'},
+  {"stripe-bytes",  required_argument,      NULL,           'b'},
+  {"cache-count",   required_argument,      NULL,           'c'},
+  {"replicas",      required_argument,      NULL,           'R'},
+  {"pin",           no_argument,            NULL,           'P'},
+  {"timeout",       required_argument,      NULL,           'T'},
+  {"max-inflight",  required_argument,      NULL,           'I'},
+  {"transport",     required_argument,      NULL,           'F'},
+  {"io-threads",    required_argument,      NULL,           'E'},
+  {"trace",         required_argument,      NULL,           'L'},
   {"segment-size",  required_argument,      NULL,           'z'},         
   {"help",          no_argument,            NULL,           'h'},
 
@@ -46,11 +73,20 @@ static struct option gLongOptions[] = {
 static gfserver_t gfs;
 //handles cache
 extern ssize_t handle_with_cache(gfcontext_t *ctx, char *path, void* arg);
+extern shard_ring_t cache_ring;
+extern int cache_replicas;
+extern uint64_t cache_timeout_ns;
+extern unsigned int max_inflight;
+extern const transport_ops_t *cache_transport;
+extern counters_t *proxy_counters;
 
 static void _sig_handler(int signo) {
   if (signo == SIGINT || signo == SIGTERM) {
     gfserver_stop(&gfs);
-    cleanup_shm_pool();
+    trace_stop();
+    if (cache_transport != NULL) {
+      cache_transport->close();
+    }
     exit(signo);
   }
 }
@@ -62,6 +98,12 @@ int main(int argc, char **argv) {
   unsigned short port = 25362;
   unsigned short nworkerthreads = 8;
   size_t segsize = 5712;
+  int ncaches = 1;
+  int replicas = 0;
+  int pin = 0;
+  const char *transport = "sem";
+  int io_threads = 0;
+  const char *trace_file = NULL;
 
   //disable buffering on stdout so it prints immediately */
   setbuf(stdout, NULL);
@@ -76,8 +118,11 @@ int main(int argc, char **argv) {
     exit(SERVER_FAILURE);
   }
 
+  /* A client hanging up mid-transfer must fail that send, not kill the proxy */
+  signal(SIGPIPE, SIG_IGN);
+
   // Parse and set command line arguments */
-  while ((option_char = getopt_long(argc, argv, "s:qht:xn:p:lz:", gLongOptions, NULL)) != -1) {
+  while ((option_char = getopt_long(argc, argv, "s:qht:xn:p:lz:r:b:c:R:PT:I:F:E:L:", gLongOptions, NULL)) != -1) {
     switch (option_char) {
       default:
         fprintf(stderr, "%s", USAGE);
@@ -101,6 +146,36 @@ int main(int argc, char **argv) {
       case 't': // thread-count
         nworkerthreads = atoi(optarg);
         break;
+      case 'r': // stripes per file
+        stripe_max = atoi(optarg);
+        break;
+      case 'b': // minimum stripe size
+        stripe_min = strtoul(optarg, NULL, 10);
+        break;
+      case 'c': // cache instances
+        ncaches = atoi(optarg);
+        break;
+      case 'R': // replicas to try
+        replicas = atoi(optarg);
+        break;
+      case 'P': // NUMA placement
+        pin = 1;
+        break;
+      case 'T': // cache timeout
+        cache_timeout_ns = strtoull(optarg, NULL, 10) * 1000000ull;
+        break;
+      case 'I': // in-flight limit
+        max_inflight = strtoul(optarg, NULL, 10);
+        break;
+      case 'F': // transport
+        transport = optarg;
+        break;
+      case 'E': // I/O threads
+        io_threads = atoi(optarg);
+        break;
+      case 'L': // request trace
+        trace_file = optarg;
+        break;
       case 'i':
       //do not modify
       case 'O':
@@ -131,13 +206,52 @@ int main(int argc, char **argv) {
     fprintf(stderr, "Invalid number of worker threads\n");
     exit(__LINE__);
   }
+  if ((stripe_max < 1) || (stripe_max > 64)) {
+    fprintf(stderr, "Invalid number of stripes, must be in between 1-64\n");
+    exit(__LINE__);
+  }
+  if ((ncaches < 1) || (ncaches > SHARD_MAX)) {
+    fprintf(stderr, "Invalid number of caches, must be in between 1-%d\n", SHARD_MAX);
+    exit(__LINE__);
+  }
+  if (replicas < 0) {
+    fprintf(stderr, "Invalid number of replicas\n");
+    exit(__LINE__);
+  }
+  cache_transport = transport_find(transport);
+  if (cache_transport == NULL) {
+    fprintf(stderr, "Unknown transport %s, must be sem, fd, pipe or stream\n", transport);
+    exit(__LINE__);
+  }
   if (nsegments < 1) {
     fprintf(stderr, "Must have a positive number of segments\n");
     exit(__LINE__);
   }
+  if ((io_threads < 0) || (io_threads > 64)) {
+    fprintf(stderr, "Invalid number of I/O threads, must be in between 0-64\n");
+    exit(__LINE__);
+  }
+
+  /* Route paths over the cache instances; must match simplecached's -n */
+  shard_ring_init(&cache_ring, ncaches, SHARD_DEFAULT_VNODES);
+  cache_replicas = replicas ? replicas : (ncaches > 1 ? 2 : 1);
 
   /* Initialize shared memory set-up here */
-  create_shm_pool(nsegments, segsize);
+  numa_place_init(pin);
+  if (io_threads > 0) {
+    shm_enable_events();  // before the pool is created
+  }
+  if (cache_transport->open(nsegments, segsize) < 0) {
+    exit(__LINE__);
+  }
+  stats_attach();
+  proxy_counters = counters_create(NULL);
+  if (io_threads > 0 && io_engine_start(io_threads, proxy_counters) < 0) {
+    exit(__LINE__);
+  }
+  if (trace_file != NULL && trace_open(trace_file) < 0) {
+    exit(__LINE__);
+  }
   // Initialize server structure here
   gfserver_init(&gfs, nworkerthreads);
 
@@ -1,9 +1,17 @@
 #include "proxy-student.h"
 #include "gfserver.h"
+#include "gfrange.h"
+#include "counters.h"
+#include "stats.h"
+#include "probes.h"
+#include "origin_pool.h"
 
 #define MAX_REQUEST_N 512
 #define BUFSIZE (6426)
 
+/* Created by webproxy; answered on /__stats */
+counters_t *curl_counters;
+
 typedef struct  {
     char *res;
     size_t size;
@@ -27,42 +35,198 @@ static size_t write_callback(void *data, size_t size, size_t nmemb, void *client
     return realsize;
 }
 
-ssize_t handle_with_curl(gfcontext_t *ctx, const char *path, void *arg)
-{
-    CURL *curl = curl_easy_init();
-    if (!curl) return SERVER_FAILURE;
+/* One transfer of a request, to one origin */
+typedef struct {
+    CURL *curl;
+    int origin;
+    int hedge;
+    uint64_t start_ns;
+    memory body;
+} attempt_t;
 
+static int start_attempt(CURLM *multi, attempt_t *a, origin_pool_t *pool, int origin, int hedge,
+                         const char *clean, const char *range_spec)
+{
     char url[BUFSIZE];
-    snprintf(url, sizeof(url), "%s%s", (char *)arg, path);
 
-    CURLcode ret;
-    memory chunk = {0};
+    memset(a, 0, sizeof(*a));
+    a->origin = origin;
+    a->hedge = hedge;
+    if ((a->curl = curl_easy_init()) == NULL) return -1;
+
+    snprintf(url, sizeof(url), "%s%s", pool->origins[origin].url, clean);
+    curl_easy_setopt(a->curl, CURLOPT_URL, url);
+    if (range_spec != NULL) {
+        curl_easy_setopt(a->curl, CURLOPT_RANGE, range_spec);
+    }
+    curl_easy_setopt(a->curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(a->curl, CURLOPT_FAILONERROR, 1L);
+    curl_easy_setopt(a->curl, CURLOPT_WRITEFUNCTION, write_callback);
+    curl_easy_setopt(a->curl, CURLOPT_WRITEDATA, &a->body);
+    curl_easy_setopt(a->curl, CURLOPT_PRIVATE, a);
+
+    a->start_ns = stats_now_ns();
+    if (curl_multi_add_handle(multi, a->curl) != CURLM_OK) {
+        curl_easy_cleanup(a->curl);
+        a->curl = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+/* Removing the handle is what cancels a transfer still in flight */
+static void end_attempt(CURLM *multi, attempt_t *a)
+{
+    curl_multi_remove_handle(multi, a->curl);
+    curl_easy_cleanup(a->curl);
+    a->curl = NULL;
+}
 
-    curl_easy_setopt(curl, CURLOPT_URL, url);
-    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-    curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &chunk);
+/*
+ * Fetches clean into *body, hedging and failing over across the pool as
+ * origin_pool.h describes. A body or a 4xx is an answer, which every
+ * origin would give alike; a transport error or a 5xx sends the request
+ * on to the next origin. Returns the curl result and sets the HTTP
+ * status of the answer served, or of the last failure.
+ */
+static CURLcode fetch_from_pool(origin_pool_t *pool, const char *clean, const char *range_spec,
+                                memory *body, long *response_code)
+{
+    attempt_t attempts[ORIGIN_MAX];
+    int nattempts = 0, active = 0, hedged = 0, winner = -1, primary = -1, hedge = -1;
+    uint32_t tried = 0;
+    uint64_t hedge_at = 0;
+    CURLcode ret = CURLE_COULDNT_CONNECT;
+    CURLM *multi = curl_multi_init();
 
+    *response_code = 0;
+    if (!multi) return CURLE_OUT_OF_MEMORY;
 
-    // fprintf(stderr, "URL: %s\n", url);
+    for (;;) {
+        // Nothing in flight: fail over to an origin not tried yet
+        if (active == 0) {
+            int origin = origin_pool_pick(pool, tried, 0);
+            if (origin < 0) break;
+            tried |= 1u << origin;
+            if (start_attempt(multi, &attempts[nattempts], pool, origin, 0, clean, range_spec) < 0) {
+                origin_pool_cancelled(pool, origin, 0, 0);
+                ret = CURLE_OUT_OF_MEMORY;
+                break;
+            }
+            hedge_at = attempts[nattempts].start_ns + origin_pool_hedge_delay(pool, origin);
+            primary = nattempts++;
+            active++;
+        }
 
-    ret = curl_easy_perform(curl);
-    curl_easy_cleanup(curl);
+        int running, queued;
+        CURLMsg *msg;
+        curl_multi_perform(multi, &running);
+        while (winner < 0 && (msg = curl_multi_info_read(multi, &queued)) != NULL) {
+            if (msg->msg != CURLMSG_DONE) continue;
+            attempt_t *a;
+            long code = 0;
+            ret = msg->data.result;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&a);
+            curl_easy_getinfo(a->curl, CURLINFO_RESPONSE_CODE, &code);
+            end_attempt(multi, a);
+            active--;
+            *response_code = code;
+            if (ret == CURLE_OK || (code >= 400 && code < 500)) {
+                origin_pool_answered(pool, a->origin, stats_now_ns() - a->start_ns, a->hedge);
+                winner = a - attempts;
+            } else {
+                origin_pool_failed(pool, a->origin);
+            }
+        }
+        if (winner >= 0) break;
+        if (active == 0) continue;
+
+        uint64_t now = stats_now_ns();
+        if (!hedged && now >= hedge_at) {
+            hedged = 1;
+            int origin = origin_pool_pick(pool, tried, 1);
+            if (origin >= 0) {
+                tried |= 1u << origin;
+                GF_PROBE2(origin__hedge, clean, origin);
+                if (start_attempt(multi, &attempts[nattempts], pool, origin, 1, clean, range_spec) < 0) {
+                    origin_pool_cancelled(pool, origin, 0, 1);
+                } else {
+                    hedge = nattempts++;
+                    active++;
+                }
+            }
+            continue;
+        }
+        curl_multi_poll(multi, NULL, 0, hedged ? 1000 : (int)((hedge_at - now + 999999) / 1000000), NULL);
+    }
+
+    // Whether a hedge beat the request still out on its origin says more about it than its p95
+    if (hedge >= 0 && winner == hedge && attempts[primary].curl != NULL) {
+        origin_pool_hedge_result(pool, attempts[primary].origin, 1);
+    } else if (winner == primary && hedge >= 0 && primary < hedge) {
+        origin_pool_hedge_result(pool, attempts[primary].origin, 0);
+    }
+    // The loser, if any, is cancelled here
+    for (int i = 0; i < nattempts; i++) {
+        if (attempts[i].curl != NULL) {
+            end_attempt(multi, &attempts[i]);
+            origin_pool_cancelled(pool, attempts[i].origin, stats_now_ns() - attempts[i].start_ns,
+                                  attempts[i].hedge);
+        }
+        if (i != winner) free(attempts[i].body.res);
+    }
+    curl_multi_cleanup(multi);
+    if (winner >= 0) *body = attempts[winner].body;
+    return ret;
+}
+
+static ssize_t serve_from_origin(gfcontext_t *ctx, const char *path, origin_pool_t *pool)
+{
+    char clean[BUFSIZE];
+    char range_spec[64];
+    gf_range_t range;
+    if (gf_parse_range(path, clean, sizeof(clean), &range) < 0) {
+        return SERVER_FAILURE;
+    }
+    if (range.present) {
+        if (range.has_end) {
+            snprintf(range_spec, sizeof(range_spec), "%zu-%zu", range.start, range.end);
+        } else {
+            snprintf(range_spec, sizeof(range_spec), "%zu-", range.start);
+        }
+    }
+
+    memory chunk = {0};
+    long response_code = 0;
+    CURLcode ret = fetch_from_pool(pool, clean, range.present ? range_spec : NULL, &chunk, &response_code);
 
     if (ret != CURLE_OK) {
         free(chunk.res);
-        return gfs_sendheader(ctx, GF_FILE_NOT_FOUND, 0);
+        // An unsatisfiable range is an error, as it is through the cache; anything else is a miss
+        counter_add(curl_counters, response_code == 416 ? CTR_ERRORS : CTR_NOT_FOUND, 1);
+        return gfs_sendheader(ctx, response_code == 416 ? GF_ERROR : GF_FILE_NOT_FOUND, 0);
+    }
+
+    // An origin that ignores Range answers 200 with the whole body; cut the range out here
+    size_t offset = 0, length = chunk.size;
+    if (range.present && response_code != 206 &&
+        gf_range_resolve(&range, chunk.size, &offset, &length) < 0) {
+        free(chunk.res);
+        counter_add(curl_counters, CTR_ERRORS, 1);
+        return gfs_sendheader(ctx, GF_ERROR, 0);
     }
 
     // Send header with actual size
     // fprintf(stderr, "downloaded size: %zu bytes\n", chunk.size);
-    gfs_sendheader(ctx, GF_OK, chunk.size);
+    counter_add(curl_counters, CTR_OK, 1);
+    gfs_sendheader(ctx, GF_OK, length);
 
     // Stream data to client
     size_t total_sent = 0;
-    while (total_sent < chunk.size) {
-        ssize_t sent = gfs_send(ctx, chunk.res + total_sent, chunk.size - total_sent);
+    while (total_sent < length) {
+        uint64_t send_ns = stats_now_ns();
+        ssize_t sent = gfs_send(ctx, chunk.res + offset + total_sent, length - total_sent);
+        GF_PROBE2(gfs__send, sent, stats_now_ns() - send_ns);
         if (sent <= 0) {
             // fprintf(stderr, "gfs_send failed after %zu bytes sent\n", total_sent);
             free(chunk.res);
@@ -73,9 +237,39 @@ ssize_t handle_with_curl(gfcontext_t *ctx, const char *path, void *arg)
     }
 
     free(chunk.res);
+    counter_add(curl_counters, CTR_BYTES, total_sent);
     return total_sent;
 }
 
+static ssize_t serve_stats(gfcontext_t *ctx, origin_pool_t *pool)
+{
+    size_t len = 1 << 16, off = 0;
+    char *buf = malloc(len);
+    if (buf == NULL) return SERVER_FAILURE;
+
+    counters_format(curl_counters, "proxy", buf, len, &off);
+    origin_pool_format(pool, "proxy", buf, len, &off);
+    gfs_sendheader(ctx, GF_OK, off);
+    ssize_t sent = gfs_send(ctx, buf, off);
+    free(buf);
+    return sent;
+}
+
+ssize_t handle_with_curl(gfcontext_t *ctx, const char *path, void *arg)
+{
+    if (strcmp(path, STATS_PATH) == 0) return serve_stats(ctx, arg);
+
+    uint64_t start_ns = stats_now_ns();
+    GF_PROBE1(request__start, path);
+    counter_add(curl_counters, CTR_REQUESTS, 1);
+    ssize_t ret = serve_from_origin(ctx, path, arg);
+    if (ret < 0) counter_add(curl_counters, CTR_ERRORS, 1);
+    uint64_t busy_ns = stats_now_ns() - start_ns;
+    counter_add(curl_counters, CTR_BUSY_NS, busy_ns);
+    GF_PROBE3(request__done, path, ret, busy_ns);
+    return ret;
+}
+
 ssize_t handle_with_file(gfcontext_t *ctx, const char *path, void* arg) {
     return handle_with_curl(ctx, path, arg);
 }
\ No newline at end of file
@@ -0,0 +1,373 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+
+/*
+ * Minimal HTTP/1.1 origin that serves a directory, standing in for the
+ * GitHub test data so webproxy can be benchmarked offline. Latency,
+ * stalls, bandwidth, error and 404 injection are configurable per run.
+ */
+
+#define USAGE                                                                         \
+"usage:\n"                                                                            \
+"  origin [options]\n"                                                                \
+"options:\n"                                                                          \
+"  -p [listen_port]    Listen port (Default: 18080)\n"                                \
+"  -d [docroot]        Directory to serve (Default: .)\n"                             \
+"  -l [latency_ms]     Delay before each response (Default: 0)\n"                     \
+"  -j [jitter_ms]      Extra uniformly random delay (Default: 0)\n"                   \
+"  -s [percent:ms]     Percent of requests stalled a further ms, a long tail (Default: 0)\n" \
+"  -b [bytes_per_sec]  Per-response bandwidth cap (Default: 0 = unlimited)\n"         \
+"  -e [percent]        Percent of requests answered with 500 (Default: 0)\n"          \
+"  -n [percent]        Percent of requests answered with 404 (Default: 0)\n"          \
+"  -k                  Disable keep-alive (close after every response)\n"             \
+"  -r                  Ignore Range headers (always answer 200 with the whole file)\n" \
+"  -h                  Show this help message\n"
+
+static struct option gLongOptions[] = {
+  {"port",          required_argument,      NULL,           'p'},
+  {"docroot",       required_argument,      NULL,           'd'},
+  {"latency",       required_argument,      NULL,           'l'},
+  {"jitter",        required_argument,      NULL,           'j'},
+  {"stall",         required_argument,      NULL,           's'},
+  {"bandwidth",     required_argument,      NULL,           'b'},
+  {"error-rate",    required_argument,      NULL,           'e'},
+  {"notfound-rate", required_argument,      NULL,           'n'},
+  {"no-keepalive",  no_argument,            NULL,           'k'},
+  {"no-ranges",     no_argument,            NULL,           'r'},
+  {"help",          no_argument,            NULL,           'h'},
+  {NULL,            0,                      NULL,            0}
+};
+
+#define MAX_HEADER_LEN 8192
+#define MAX_PATH_LEN 4096
+#define BANDWIDTH_TICKS 20 // bandwidth cap is enforced in 1/20 s slices
+
+typedef struct {
+    const char *docroot;
+    unsigned int latency_ms;
+    unsigned int jitter_ms;
+    double stall_pct;
+    unsigned int stall_ms;
+    size_t bandwidth;
+    double error_pct;
+    double notfound_pct;
+    int keepalive;
+    int ranges;
+} origin_opts_t;
+
+static origin_opts_t opts = { ".", 0, 0, 0, 0, 0, 0, 0, 1, 1 };
+
+static int send_all(int sock, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(sock, buf, len, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* Sends a bodyless response. Returns 0 if the connection stays open, -1 otherwise. */
+static int send_status(int sock, int code, const char *reason, int keepalive) {
+    char hdr[256];
+    int n = snprintf(hdr, sizeof(hdr),
+                     "HTTP/1.1 %d %s\r\nContent-Length: 0\r\nConnection: %s\r\n\r\n",
+                     code, reason, keepalive ? "keep-alive" : "close");
+    return (send_all(sock, hdr, n) == 0 && keepalive) ? 0 : -1;
+}
+
+/*
+ * Parses a single "bytes=FIRST-LAST", "bytes=FIRST-" or "bytes=-SUFFIX" range.
+ * Returns 0 with first/last clamped to the file, or -1 if unsatisfiable.
+ */
+static int parse_byte_range(const char *value, off_t size, off_t *first, off_t *last) {
+    long long a = -1, b = -1;
+    if (strncmp(value, "bytes=", 6) != 0) {
+        return -1;
+    }
+    value += 6;
+    if (*value == '-') {
+        b = strtoll(value + 1, NULL, 10);
+        if (b <= 0 || size == 0) return -1;
+        *first = b < size ? size - b : 0;
+        *last = size - 1;
+        return 0;
+    }
+    char *end;
+    a = strtoll(value, &end, 10);
+    if (*end != '-' || a < 0 || a >= size) return -1;
+    if (end[1] != '\0') {
+        b = strtoll(end + 1, NULL, 10);
+        if (b < a) return -1;
+    }
+    *first = a;
+    *last = (b < 0 || b >= size) ? size - 1 : b;
+    return 0;
+}
+
+static int send_body(int sock, int fd, off_t first, size_t len) {
+    off_t offset = first;
+    off_t end = first + len;
+    size_t slice = opts.bandwidth ? opts.bandwidth / BANDWIDTH_TICKS : len;
+    if (slice == 0) slice = 1;
+
+    while (offset < end) {
+        size_t want = (size_t)(end - offset) < slice ? (size_t)(end - offset) : slice;
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        while (want > 0) {
+            ssize_t n = sendfile(sock, fd, &offset, want);
+            if (n <= 0) {
+                return -1;
+            }
+            want -= n;
+        }
+        if (opts.bandwidth && offset < end) {
+            struct timespec next = start;
+            next.tv_nsec += 1000000000L / BANDWIDTH_TICKS;
+            if (next.tv_nsec >= 1000000000L) {
+                next.tv_sec++;
+                next.tv_nsec -= 1000000000L;
+            }
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+        }
+    }
+    return 0;
+}
+
+/* Serves one request. Returns 0 to keep the connection open, -1 to close it. */
+static int serve_request(int sock, char *request, unsigned int *seed) {
+    char *ptr = request;
+    char *line = strsep(&ptr, "\r\n");
+    char *method = strsep(&line, " ");
+    char *target = strsep(&line, " ");
+    char *version = strsep(&line, " ");
+
+    if (method == NULL || target == NULL || version == NULL || target[0] != '/') {
+        return send_status(sock, 400, "Bad Request", 0);
+    }
+
+    int keepalive = opts.keepalive && strcmp(version, "HTTP/1.0") != 0;
+    char *range = NULL;
+    char *header;
+    while ((header = strsep(&ptr, "\r\n")) != NULL) {
+        if (opts.ranges && strncasecmp(header, "Range:", 6) == 0) {
+            range = header + 6;
+            while (*range == ' ') range++;
+        } else if (strncasecmp(header, "Connection:", 11) == 0) {
+            char *value = header + 11;
+            while (*value == ' ') value++;
+            if (strncasecmp(value, "close", 5) == 0) keepalive = 0;
+            else if (strncasecmp(value, "keep-alive", 10) == 0) keepalive = opts.keepalive;
+        }
+    }
+
+    int head_only = strcmp(method, "HEAD") == 0;
+    if (!head_only && strcmp(method, "GET") != 0) {
+        return send_status(sock, 405, "Method Not Allowed", keepalive);
+    }
+
+    unsigned int delay_ms = opts.latency_ms;
+    if (opts.jitter_ms) {
+        delay_ms += rand_r(seed) % (opts.jitter_ms + 1);
+    }
+    if (opts.stall_pct > 0 && (rand_r(seed) % 10000) / 100.0 < opts.stall_pct) {
+        delay_ms += opts.stall_ms;
+    }
+    if (delay_ms) {
+        usleep(delay_ms * 1000);
+    }
+
+    double roll = (rand_r(seed) % 10000) / 100.0;
+    if (roll < opts.error_pct) {
+        return send_status(sock, 500, "Internal Server Error", keepalive);
+    }
+    if (roll < opts.error_pct + opts.notfound_pct || strstr(target, "..") != NULL) {
+        return send_status(sock, 404, "Not Found", keepalive);
+    }
+
+    char *query = strchr(target, '?');
+    if (query) *query = '\0';
+
+    char path[MAX_PATH_LEN];
+    snprintf(path, sizeof(path), "%s%s", opts.docroot, target);
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+        if (fd >= 0) close(fd);
+        return send_status(sock, 404, "Not Found", keepalive);
+    }
+
+    off_t first = 0, last = st.st_size - 1;
+    if (range != NULL && parse_byte_range(range, st.st_size, &first, &last) < 0) {
+        close(fd);
+        return send_status(sock, 416, "Range Not Satisfiable", keepalive);
+    }
+
+    char hdr[512];
+    int n;
+    if (range != NULL) {
+        n = snprintf(hdr, sizeof(hdr),
+                     "HTTP/1.1 206 Partial Content\r\nContent-Length: %lld\r\n"
+                     "Content-Range: bytes %lld-%lld/%lld\r\n"
+                     "Content-Type: application/octet-stream\r\nConnection: %s\r\n\r\n",
+                     (long long)(last - first + 1), (long long)first, (long long)last,
+                     (long long)st.st_size, keepalive ? "keep-alive" : "close");
+    } else {
+        n = snprintf(hdr, sizeof(hdr),
+                     "HTTP/1.1 200 OK\r\nContent-Length: %lld\r\n"
+                     "Content-Type: application/octet-stream\r\nConnection: %s\r\n\r\n",
+                     (long long)st.st_size, keepalive ? "keep-alive" : "close");
+    }
+    int rc = send_all(sock, hdr, n);
+    if (rc == 0 && !head_only) {
+        rc = send_body(sock, fd, first, last - first + 1);
+    }
+    close(fd);
+    return (rc == 0 && keepalive) ? 0 : -1;
+}
+
+static unsigned int connections;
+
+static void *connection_main(void *arg) {
+    int sock = (int)(intptr_t)arg;
+    /* Spread the seeds: rand_r's first draws from nearby seeds are alike, and clients
+     * that open a connection per request only ever see those */
+    unsigned int seed = (unsigned int)time(NULL) ^ (unsigned int)sock ^ (unsigned int)pthread_self() ^
+                        __atomic_fetch_add(&connections, 1, __ATOMIC_RELAXED) * 2654435761u;
+    char buf[MAX_HEADER_LEN + 1];
+    size_t used = 0;
+
+    while (1) {
+        char *end;
+        buf[used] = '\0';
+        while ((end = strstr(buf, "\r\n\r\n")) == NULL) {
+            if (used == MAX_HEADER_LEN) {
+                send_status(sock, 431, "Request Header Fields Too Large", 0);
+                close(sock);
+                return NULL;
+            }
+            ssize_t n = recv(sock, buf + used, MAX_HEADER_LEN - used, 0);
+            if (n <= 0) {
+                close(sock);
+                return NULL;
+            }
+            used += n;
+            buf[used] = '\0';
+        }
+
+        /* Requests carry no body (GET/HEAD), so the next one starts after the blank line */
+        size_t reqlen = end - buf + 4;
+        end[2] = '\0';
+        if (serve_request(sock, buf, &seed) < 0) {
+            break;
+        }
+        memmove(buf, buf + reqlen, used - reqlen);
+        used -= reqlen;
+    }
+    close(sock);
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    int option_char;
+    unsigned short port = 18080;
+
+    while ((option_char = getopt_long(argc, argv, "p:d:l:j:s:b:e:n:krh", gLongOptions, NULL)) != -1) {
+        switch (option_char) {
+            default:
+                fprintf(stderr, "%s", USAGE);
+                exit(1);
+            case 'h':
+                fprintf(stdout, "%s", USAGE);
+                exit(0);
+            case 'p':
+                port = atoi(optarg);
+                break;
+            case 'd':
+                opts.docroot = optarg;
+                break;
+            case 'l':
+                opts.latency_ms = atoi(optarg);
+                break;
+            case 'j':
+                opts.jitter_ms = atoi(optarg);
+                break;
+            case 's':
+                if (sscanf(optarg, "%lf:%u", &opts.stall_pct, &opts.stall_ms) != 2) {
+                    fprintf(stderr, "%s", USAGE);
+                    exit(1);
+                }
+                break;
+            case 'b':
+                opts.bandwidth = strtoull(optarg, NULL, 10);
+                break;
+            case 'e':
+                opts.error_pct = atof(optarg);
+                break;
+            case 'n':
+                opts.notfound_pct = atof(optarg);
+                break;
+            case 'k':
+                opts.keepalive = 0;
+                break;
+            case 'r':
+                opts.ranges = 0;
+                break;
+        }
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    int listenfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listenfd < 0) {
+        perror("socket");
+        exit(1);
+    }
+    int one = 1;
+    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(listenfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listenfd, 256) < 0) {
+        perror("bind/listen");
+        exit(1);
+    }
+
+    printf("[Origin] serving %s on port %u\n", opts.docroot, port);
+    while (1) {
+        int sock = accept(listenfd, NULL, NULL);
+        if (sock < 0) {
+            if (errno != EINTR) perror("accept");
+            continue;
+        }
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, connection_main, (void *)(intptr_t)sock) != 0) {
+            perror("pthread_create");
+            close(sock);
+            continue;
+        }
+        pthread_detach(tid);
+    }
+    return 0;
+}
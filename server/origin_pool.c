@@ -0,0 +1,249 @@
+#include <string.h>
+#include <inttypes.h>
+#include "counters.h"
+#include "origin_pool.h"
+
+/* Answers between recomputations of an origin's p95 */
+#define ORIGIN_HEDGE_REFRESH 16
+/* Weight of the latest hedged request in an origin's hedge_losses, as a shift */
+#define ORIGIN_LOSS_SHIFT 3
+
+void origin_pool_init(origin_pool_t *pool, int hedge_pct) {
+    memset(pool, 0, sizeof(*pool));
+    pool->hedge_pct = hedge_pct;
+    pool->hedge_credit = ORIGIN_HEDGE_BURST * 100;
+}
+
+/* Adds delta to the hedge budget, keeping it within [0, ORIGIN_HEDGE_BURST]; 0 if it would go below */
+static int credit_add(origin_pool_t *pool, int64_t delta) {
+    int64_t old = __atomic_load_n(&pool->hedge_credit, __ATOMIC_RELAXED), next;
+    do {
+        next = old + delta;
+        if (next < 0) {
+            return 0;
+        }
+        if (next > ORIGIN_HEDGE_BURST * 100) {
+            next = ORIGIN_HEDGE_BURST * 100;
+        }
+    } while (!__atomic_compare_exchange_n(&pool->hedge_credit, &old, next, 1,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    return 1;
+}
+
+int origin_pool_add(origin_pool_t *pool, const char *url) {
+    if (pool->n == ORIGIN_MAX) {
+        return -1;
+    }
+    origin_t *o = &pool->origins[pool->n];
+    memset(o, 0, sizeof(*o));
+    o->url = url;
+    o->backoff_ns = ORIGIN_BACKOFF_NS;
+    o->window_start_ns = stats_now_ns();
+    pthread_mutex_init(&o->lock, NULL);
+    pool->n++;
+    return 0;
+}
+
+/* Moves on to a fresh window once the current one is ORIGIN_WINDOW_NS old; lock held */
+static void rotate(origin_t *o, uint64_t now) {
+    if (now - o->window_start_ns < ORIGIN_WINDOW_NS) {
+        return;
+    }
+    if (now - o->window_start_ns < 2 * ORIGIN_WINDOW_NS) {
+        o->window[1] = o->window[0];
+    } else {
+        memset(&o->window[1], 0, sizeof(o->window[1]));  // idle for a while: nothing is recent
+    }
+    memset(&o->window[0], 0, sizeof(o->window[0]));
+    o->window_start_ns = now;
+    o->hedge_ns = 0;
+}
+
+/* Lock held */
+static int usable(origin_t *o, uint64_t now) {
+    return o->failures < ORIGIN_FAIL_LIMIT || (now >= o->down_until_ns && !o->probing);
+}
+
+int origin_pool_pick(origin_pool_t *pool, uint32_t tried, int hedge) {
+    uint64_t now = stats_now_ns(), soonest = UINT64_MAX;
+    int chosen = -1, slow = -1, fallback = -1;
+
+    if (hedge && (pool->hedge_pct == 0 || !credit_add(pool, -100))) {
+        return -1;
+    }
+
+    unsigned start = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED);
+    for (int k = 0; k < pool->n && chosen < 0; k++) {
+        int i = (start + k) % pool->n;
+        origin_t *o = &pool->origins[i];
+        if (tried & (1u << i)) {
+            continue;
+        }
+        pthread_mutex_lock(&o->lock);
+        if (usable(o, now) && now < o->slow_until_ns) {
+            if (slow < 0) {
+                slow = i;
+            }
+        } else if (usable(o, now)) {
+            if (o->failures >= ORIGIN_FAIL_LIMIT) {
+                o->probing = 1;
+            }
+            chosen = i;
+        } else if (o->down_until_ns < soonest) {
+            soonest = o->down_until_ns;
+            fallback = i;
+        }
+        pthread_mutex_unlock(&o->lock);
+    }
+    /* A hedge is only worth it on a healthy, fast origin; a request goes somewhere regardless */
+    if (chosen < 0 && slow >= 0 && !hedge) {
+        origin_t *o = &pool->origins[slow];
+        pthread_mutex_lock(&o->lock);
+        if (usable(o, now)) {
+            if (o->failures >= ORIGIN_FAIL_LIMIT) {
+                o->probing = 1;
+            }
+            chosen = slow;
+        }
+        pthread_mutex_unlock(&o->lock);
+    }
+    if (chosen < 0 && !hedge) {
+        chosen = fallback >= 0 ? fallback : slow;
+    }
+    if (chosen < 0) {
+        if (hedge) {
+            credit_add(pool, 100);
+        }
+        return -1;
+    }
+
+    origin_t *o = &pool->origins[chosen];
+    __atomic_fetch_add(&o->requests, 1, __ATOMIC_RELAXED);
+    if (hedge) {
+        __atomic_fetch_add(&o->hedges, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&pool->hedges, 1, __ATOMIC_RELAXED);
+    } else {
+        credit_add(pool, pool->hedge_pct);
+    }
+    return chosen;
+}
+
+uint64_t origin_pool_hedge_delay(origin_pool_t *pool, int origin) {
+    origin_t *o = &pool->origins[origin];
+    uint64_t delay;
+
+    pthread_mutex_lock(&o->lock);
+    rotate(o, stats_now_ns());
+    if (o->hedge_ns == 0 || o->since_hedge >= ORIGIN_HEDGE_REFRESH) {
+        if (o->window[0].count + o->window[1].count < ORIGIN_MIN_SAMPLES) {
+            o->hedge_ns = ORIGIN_DEFAULT_HEDGE_NS;
+        } else {
+            stats_hist_t both;
+            for (int i = 0; i < STATS_NBUCKETS; i++) {
+                both.buckets[i] = o->window[0].buckets[i] + o->window[1].buckets[i];
+            }
+            both.max_ns = o->window[0].max_ns > o->window[1].max_ns ? o->window[0].max_ns
+                                                                    : o->window[1].max_ns;
+            o->hedge_ns = stats_hist_percentile(&both, 95);
+            if (o->hedge_ns < ORIGIN_MIN_HEDGE_NS) {
+                o->hedge_ns = ORIGIN_MIN_HEDGE_NS;
+            }
+        }
+        o->since_hedge = 0;
+    }
+    delay = o->hedge_ns;
+    pthread_mutex_unlock(&o->lock);
+    return delay;
+}
+
+void origin_pool_answered(origin_pool_t *pool, int origin, uint64_t latency_ns, int hedge) {
+    origin_t *o = &pool->origins[origin];
+
+    pthread_mutex_lock(&o->lock);
+    rotate(o, stats_now_ns());
+    stats_hist_record(&o->window[0], latency_ns);
+    o->since_hedge++;
+    o->failures = 0;
+    o->probing = 0;
+    o->backoff_ns = ORIGIN_BACKOFF_NS;
+    if (hedge) {
+        o->hedge_wins++;
+    }
+    pthread_mutex_unlock(&o->lock);
+}
+
+void origin_pool_failed(origin_pool_t *pool, int origin) {
+    origin_t *o = &pool->origins[origin];
+
+    pthread_mutex_lock(&o->lock);
+    o->errors++;
+    o->failures++;
+    /*
+     * Back off when the origin crosses the limit or its probe fails, not for
+     * every request that was already in flight when it went down.
+     */
+    if (o->failures == ORIGIN_FAIL_LIMIT || o->probing) {
+        o->down_until_ns = stats_now_ns() + o->backoff_ns;
+        o->backoff_ns = o->backoff_ns * 2 < ORIGIN_BACKOFF_MAX_NS ? o->backoff_ns * 2
+                                                                 : ORIGIN_BACKOFF_MAX_NS;
+        o->probing = 0;
+    }
+    pthread_mutex_unlock(&o->lock);
+}
+
+void origin_pool_cancelled(origin_pool_t *pool, int origin, uint64_t latency_ns, int hedge) {
+    origin_t *o = &pool->origins[origin];
+
+    pthread_mutex_lock(&o->lock);
+    o->cancelled++;
+    /* A hedge is cancelled whenever the request it backs up answers, however soon */
+    if (!hedge && latency_ns > 0) {
+        rotate(o, stats_now_ns());
+        stats_hist_record(&o->window[0], 2 * latency_ns);
+        o->since_hedge++;
+    }
+    o->probing = 0;  // no verdict: the next request may probe it
+    pthread_mutex_unlock(&o->lock);
+}
+
+void origin_pool_hedge_result(origin_pool_t *pool, int origin, int hedge_won) {
+    origin_t *o = &pool->origins[origin];
+
+    pthread_mutex_lock(&o->lock);
+    o->hedge_losses -= o->hedge_losses >> ORIGIN_LOSS_SHIFT;
+    if (hedge_won) {
+        o->hedge_losses += 1024 >> ORIGIN_LOSS_SHIFT;
+    }
+    /* Starts afresh after its time out, so it takes as many losses to be slow again */
+    if (o->hedge_losses >= 1024 * ORIGIN_SLOW_PCT / 100) {
+        o->slow_until_ns = stats_now_ns() + ORIGIN_SLOW_NS;
+        o->hedge_losses = 0;
+    }
+    pthread_mutex_unlock(&o->lock);
+}
+
+void origin_pool_format(origin_pool_t *pool, const char *prefix, char *buf, size_t len, size_t *off) {
+    uint64_t now = stats_now_ns();
+
+    counters_printf(buf, len, off, "%s.hedges %" PRIu64 "\n", prefix,
+                    __atomic_load_n(&pool->hedges, __ATOMIC_RELAXED));
+    for (int i = 0; i < pool->n; i++) {
+        origin_t *o = &pool->origins[i];
+        uint64_t hedge_ns = origin_pool_hedge_delay(pool, i);
+
+        pthread_mutex_lock(&o->lock);
+        counters_printf(buf, len, off, "%s.origin.%d.url %s\n", prefix, i, o->url);
+        counters_printf(buf, len, off, "%s.origin.%d.healthy %d\n", prefix, i,
+                        o->failures < ORIGIN_FAIL_LIMIT || now >= o->down_until_ns);
+        counters_printf(buf, len, off, "%s.origin.%d.slow %d\n", prefix, i, now < o->slow_until_ns);
+        counters_printf(buf, len, off, "%s.origin.%d.hedge_ns %" PRIu64 "\n", prefix, i, hedge_ns);
+        counters_printf(buf, len, off, "%s.origin.%d.requests %" PRIu64 "\n", prefix, i,
+                        __atomic_load_n(&o->requests, __ATOMIC_RELAXED));
+        counters_printf(buf, len, off, "%s.origin.%d.errors %" PRIu64 "\n", prefix, i, o->errors);
+        counters_printf(buf, len, off, "%s.origin.%d.hedges %" PRIu64 "\n", prefix, i,
+                        __atomic_load_n(&o->hedges, __ATOMIC_RELAXED));
+        counters_printf(buf, len, off, "%s.origin.%d.hedge_wins %" PRIu64 "\n", prefix, i, o->hedge_wins);
+        counters_printf(buf, len, off, "%s.origin.%d.cancelled %" PRIu64 "\n", prefix, i, o->cancelled);
+        pthread_mutex_unlock(&o->lock);
+    }
+}
@@ -0,0 +1,108 @@
+/*
+ Equivalent upstream origins for handle_with_curl, one per -s.
+
+ Requests go to the healthy origins in turn. Each origin keeps the
+ latencies of its recent answers in two rotating windows, so its p95
+ follows the load; a request still unanswered after its origin's p95 is
+ hedged: a copy goes to another healthy origin, the first answer is
+ served and the other transfer is cancelled. Hedges draw on a budget
+ that every request tops up by hedge_pct/100 and that holds at most
+ ORIGIN_HEDGE_BURST, so at any time they add no more than hedge_pct% of
+ the requests plus that burst, however calm the time before was.
+
+ An origin whose hedges keep answering first is slow, whatever its p95
+ says: once ORIGIN_SLOW_PCT of its recent hedged requests went that way
+ it only gets requests no other origin can take for ORIGIN_SLOW_NS.
+
+ An origin that fails ORIGIN_FAIL_LIMIT times in a row (a transport
+ error or a 5xx) is skipped for a backoff that doubles up to
+ ORIGIN_BACKOFF_MAX_NS; once it is over, a single request probes it and
+ its answer decides whether the origin is back. A request whose origin
+ fails goes on to the next one untried. When every origin is down the
+ one due back soonest is still used: requests are never refused here.
+ */
+#ifndef __ORIGIN_POOL_H__
+#define __ORIGIN_POOL_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include "stats.h"
+
+#define ORIGIN_MAX 8
+#define ORIGIN_FAIL_LIMIT 3
+#define ORIGIN_BACKOFF_NS (500 * 1000000ull)
+#define ORIGIN_BACKOFF_MAX_NS (30 * 1000000000ull)
+/* Each latency window covers this long; the p95 is over the last two */
+#define ORIGIN_WINDOW_NS (10 * 1000000000ull)
+/* Below this many answers the p95 means little: hedge after the default instead */
+#define ORIGIN_MIN_SAMPLES 20
+#define ORIGIN_DEFAULT_HEDGE_NS (1000 * 1000000ull)
+#define ORIGIN_MIN_HEDGE_NS (1 * 1000000ull)
+/* Most hedges the budget holds, so the first slow requests can hedge */
+#define ORIGIN_HEDGE_BURST 10
+/* Share of an origin's hedged requests lost to the hedge that marks it slow, and for how long */
+#define ORIGIN_SLOW_PCT 75
+#define ORIGIN_SLOW_NS (2 * 1000000000ull)
+
+typedef struct {
+    const char *url;
+    pthread_mutex_t lock;
+    stats_hist_t window[2];     // [0] is being filled, [1] is the one before
+    uint64_t window_start_ns;
+    uint64_t hedge_ns;          // cached p95 of both windows
+    uint32_t since_hedge;       // answers since hedge_ns was computed
+    int failures;               // in a row
+    int probing;                // its backoff is over and a probe is out
+    uint64_t down_until_ns;
+    uint64_t backoff_ns;
+    uint32_t hedge_losses;      // moving share of its hedged requests the hedge won, in 1/1024
+    uint64_t slow_until_ns;
+    /* Reported on /__stats */
+    uint64_t requests;
+    uint64_t errors;
+    uint64_t hedges;            // hedged copies sent to it
+    uint64_t hedge_wins;        // of those, answered first
+    uint64_t cancelled;
+} origin_t;
+
+typedef struct {
+    int n;
+    int hedge_pct;              // hedges allowed per 100 requests; 0 disables hedging
+    unsigned next;
+    int64_t hedge_credit;       // in 1/100 hedge: a request adds hedge_pct, a hedge takes 100
+    uint64_t hedges;
+    origin_t origins[ORIGIN_MAX];
+} origin_pool_t;
+
+void origin_pool_init(origin_pool_t *pool, int hedge_pct);
+/* Returns -1 once ORIGIN_MAX origins are in */
+int origin_pool_add(origin_pool_t *pool, const char *url);
+
+/*
+ * Picks the origin for a request (hedge 0) or its hedge (hedge 1) among
+ * those not in the tried bit mask. Returns -1 if there is none, or for a
+ * hedge when no other origin is healthy or the hedge budget is spent.
+ */
+int origin_pool_pick(origin_pool_t *pool, uint32_t tried, int hedge);
+/* How long to wait for an answer from origin before hedging */
+uint64_t origin_pool_hedge_delay(origin_pool_t *pool, int origin);
+
+/*
+ * Reports how a request to origin ended: answered (a body or a 4xx),
+ * failed, or cancelled because another copy answered first. A request
+ * cancelled after latency_ns would have taken longer still, and is
+ * counted as twice that: were it left out, or counted at latency_ns, an
+ * origin that slowed down would keep about its old p95 for as long as
+ * hedges won.
+ */
+void origin_pool_answered(origin_pool_t *pool, int origin, uint64_t latency_ns, int hedge);
+void origin_pool_failed(origin_pool_t *pool, int origin);
+void origin_pool_cancelled(origin_pool_t *pool, int origin, uint64_t latency_ns, int hedge);
+/* Reports that a request to origin was hedged, and whether the hedge answered first */
+void origin_pool_hedge_result(origin_pool_t *pool, int origin, int hedge_won);
+
+/* Appends "<prefix>.origin.<i>.<field> <value>" lines to buf at *off */
+void origin_pool_format(origin_pool_t *pool, const char *prefix, char *buf, size_t len, size_t *off);
+
+#endif // __ORIGIN_POOL_H__
@@ -1,10 +1,14 @@
 #include "gfserver.h"
+#include "counters.h"
+#include "origin_pool.h"
 
 #define USAGE                                                                         \
 "usage:\n"                                                                            \
 "  webproxy [options]\n"                                                              \
 "options:\n"                                                                          \
-"  -s [server]         The server to connect to (Default: GitHub test data)\n"        \
+"  -s [server]         The server to connect to (Default: GitHub test data);\n"       \
+"                      repeat for equivalent origins to hedge and fail over across\n" \
+"  -H [hedge_pct]      Hedged requests allowed per 100, 0 disables (Default: 10)\n"  \
 "  -h                  Show this help message\n"                                      \
 "  -p [listen_port]    Listen port (Default: 16652)\n"                                \
 "  -t [thread_count]   Num worker threads (Default is 8, Range is 1-80)\n"          
@@ -16,6 +20,7 @@ static struct option gLongOptions[] = {
   {"thread-count",  required_argument,      NULL,           't'},
   {"port",          required_argument,      NULL,           'p'},
   {"server",        required_argument,      NULL,           's'},
+  {"hedge",         required_argument,      NULL,           'H'},
   {NULL,            0,                      NULL,            0}
 };
 
@@ -23,6 +28,8 @@ static struct option gLongOptions[] = {
 #define MAX_REQUEST_LENGTH_N 822
 
 static gfserver_t gfs;
+static origin_pool_t origins;
+static const char *servers[ORIGIN_MAX];
 
 static void _sig_handler(int signo){
   if (signo == SIGTERM || signo == SIGINT){
@@ -33,6 +40,7 @@ static void _sig_handler(int signo){
 
 extern ssize_t handle_with_file(gfcontext_t *ctx, const char *path, void* arg);
 extern ssize_t handle_with_curl(gfcontext_t *ctx, const char *path, void* arg);
+extern counters_t *curl_counters;
 
 int main(int argc, char **argv) {
   int i;
@@ -40,6 +48,8 @@ int main(int argc, char **argv) {
   unsigned short port = 16652;
   unsigned short nworkerthreads = 8;
   const char *server = "https://raw.githubusercontent.com/gt-cs6200/image_data";
+  int nservers = 0;
+  int hedge_pct = 10;
 
   // disable buffering on stdout
   setbuf(stdout, NULL);
@@ -55,7 +65,7 @@ int main(int argc, char **argv) {
   }
 
   // Parse and set command line arguments
-  while ((option_char = getopt_long(argc, argv, "p:qs:xt:h", gLongOptions, NULL)) != -1) {
+  while ((option_char = getopt_long(argc, argv, "p:qs:xt:hH:", gLongOptions, NULL)) != -1) {
     switch (option_char) {
       case 'a':
       case 'd':
@@ -65,8 +75,15 @@ int main(int argc, char **argv) {
         port = atoi(optarg);
         break;
       case 's': // file-path
-        server = optarg;
+        if (nservers == ORIGIN_MAX) {
+          fprintf(stderr, "At most %d servers\n", ORIGIN_MAX);
+          exit(__LINE__);
+        }
+        servers[nservers++] = server = optarg;
         break;              
+      case 'H': // hedge
+        hedge_pct = atoi(optarg);
+        break;
       case 't': // thread-count 6
         nworkerthreads = atoi(optarg);
         break;
@@ -95,8 +112,22 @@ int main(int argc, char **argv) {
     exit(__LINE__);
   }
 
+  if (hedge_pct < 0 || hedge_pct > 100) {
+    fprintf(stderr, "Invalid hedge percentage\n");
+    exit(__LINE__);
+  }
+
+  origin_pool_init(&origins, hedge_pct);
+  if (nservers == 0) {
+    servers[nservers++] = server;
+  }
+  for (i = 0; i < nservers; i++) {
+    origin_pool_add(&origins, servers[i]);
+  }
+
   // Initialize server structure here
   curl_global_init(CURL_GLOBAL_ALL);
+  curl_counters = counters_create(NULL);
   gfserver_init(&gfs, nworkerthreads);
 // Set server options here
   gfserver_setopt(&gfs, GFS_MAXNPENDING, 90);
@@ -104,7 +135,7 @@ int main(int argc, char **argv) {
   gfserver_setopt(&gfs, GFS_PORT, port);
   // Set up arguments for worker here
   for(i = 0; i < nworkerthreads; i++) {
-    gfserver_setopt(&gfs, GFS_WORKER_ARG, i, server);
+    gfserver_setopt(&gfs, GFS_WORKER_ARG, i, &origins);
   }
   // Invoke the framework - this is an infinite loop and shouldn't return
   gfserver_serve(&gfs);